@@ -0,0 +1,370 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "allocation-counter.h"
+#include "benchmark/benchmark.h"
+#include "btree.h"
+
+using std::map;
+using std::pair;
+using std::unique_ptr;
+using std::vector;
+
+// Benchmarks of the BTree at a range of MAX_KEYS, against std::map and a sorted std::vector. Each
+// index is loaded with the keys 0 to n - 1, each with itself as its value. Each benchmark reports
+// the heap that the loaded index takes per key, as the counting allocator (allocation-counter.h)
+// saw it.
+//
+// Indexes of 100M keys take several GB, so a benchmark that wouldn't fit in this machine's memory
+// is skipped. Select a subset with --benchmark_filter, e.g. 'BTree.*/1000000/'.
+
+static const vector<int64_t> NUM_KEYS = {1000000, 10000000, 100000000};
+static const vector<int64_t> MAX_KEYS = {8, 16, 32, 64, 128, 256};
+
+// The length of range scans, as YCSB's workload E does at most.
+static constexpr int SCAN_LENGTH = 100;
+
+// Lookups and scans start at keys drawn from this many, which are generated up front.
+static constexpr int NUM_LOOKUP_KEYS = 1 << 20;
+
+class BTreeIndex {
+ public:
+  explicit BTreeIndex(int max_keys) : tree_(max_keys) { }
+
+  void Insert(int key, int value) { tree_.Insert(key, value); }
+  void FinishLoad() { }
+  int Find(int key) { return tree_.Find(key); }
+  int Scan(int start_key, int max_values, int* values) {
+    return tree_.Scan(start_key, max_values, values);
+  }
+
+  const BTree& tree() const { return tree_; }
+
+  // An overestimate: leaves are at least half full, and each allocates MAX_KEYS keys and values.
+  static int64_t MaxBytes(int64_t num_keys, int max_keys) {
+    int64_t num_leaves = num_keys / std::max(max_keys / 2, 1) + 1;
+    return num_leaves * (sizeof(Node) + 2 * max_keys * sizeof(int) + 64) * 5 / 4;
+  }
+
+ private:
+  BTree tree_;
+};
+
+class StdMapIndex {
+ public:
+  explicit StdMapIndex(int /* max_keys */) { }
+
+  void Insert(int key, int value) { map_.emplace(key, value); }
+  void FinishLoad() { }
+  int Find(int key) {
+    auto it = map_.find(key);
+    return it == map_.end() ? -1 : it->second;
+  }
+  int Scan(int start_key, int max_values, int* values) {
+    int num_values = 0;
+    for (auto it = map_.lower_bound(start_key); it != map_.end() && num_values < max_values; ++it) {
+      values[num_values++] = it->second;
+    }
+    return num_values;
+  }
+
+  // A red-black tree node of three pointers, a colour and the pair, rounded up by malloc.
+  static int64_t MaxBytes(int64_t num_keys, int /* max_keys */) { return num_keys * 48; }
+
+ private:
+  map<int, int> map_;
+};
+
+// The best case for lookups and scans: one binary search, then contiguous values. It is loaded in
+// bulk, by appending every key and sorting once, since inserting into the middle of a vector costs
+// O(n); its insert numbers are those of a bulk load, not of incremental inserts.
+class SortedVectorIndex {
+ public:
+  explicit SortedVectorIndex(int /* max_keys */) { }
+
+  void Insert(int key, int value) { entries_.emplace_back(key, value); }
+  void FinishLoad() { std::sort(entries_.begin(), entries_.end()); }
+  int Find(int key) {
+    auto it = LowerBound(key);
+    return it == entries_.end() || it->first != key ? -1 : it->second;
+  }
+  int Scan(int start_key, int max_values, int* values) {
+    int num_values = 0;
+    for (auto it = LowerBound(start_key); it != entries_.end() && num_values < max_values; ++it) {
+      values[num_values++] = it->second;
+    }
+    return num_values;
+  }
+
+  // While the vector grows, its old and new arrays are both live.
+  static int64_t MaxBytes(int64_t num_keys, int /* max_keys */) {
+    return num_keys * 3 * sizeof(pair<int, int>);
+  }
+
+ private:
+  vector<pair<int, int>>::iterator LowerBound(int key) {
+    return std::lower_bound(entries_.begin(), entries_.end(), pair<int, int>(key, INT32_MIN));
+  }
+
+  vector<pair<int, int>> entries_;
+};
+
+// Benchmark arguments are the number of keys and, for the BTree, MAX_KEYS.
+template <typename Index>
+int MaxKeysArg(const benchmark::State& /* state */) { return 0; }
+
+template <>
+int MaxKeysArg<BTreeIndex>(const benchmark::State& state) { return state.range(1); }
+
+void ReportBytesPerKey(benchmark::State& state, int64_t index_bytes, int64_t num_keys) {
+  state.counters["Bytes/key"] = static_cast<double>(index_bytes) / num_keys;
+}
+
+template <typename Index>
+void ReportShape(benchmark::State& /* state */, const Index& /* index */) { }
+
+void ReportShape(benchmark::State& state, const BTreeIndex& index) {
+  state.counters["Height"] = index.tree().height();
+  state.counters["Nodes"] = index.tree().num_nodes();
+}
+
+// Skips the benchmark, and returns false, if loading 'num_keys' into an Index might not fit in
+// three quarters of memory, leaving the rest for everything else. Besides the index, random loads
+// keep a shuffled copy of the keys.
+template <typename Index>
+bool CheckFitsInMemory(benchmark::State& state, int64_t num_keys) {
+  int64_t bytes = Index::MaxBytes(num_keys, MaxKeysArg<Index>(state)) + num_keys * sizeof(int);
+  int64_t physical_bytes = static_cast<int64_t>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+  if (bytes < physical_bytes / 4 * 3) return true;
+  state.SkipWithError("index may not fit in memory");
+  return false;
+}
+
+// The keys 0 to num_keys - 1 in a random order. The last order is kept for the next benchmark,
+// since shuffling 100M keys takes seconds.
+const vector<int>& ShuffledKeys(int64_t num_keys) {
+  static vector<int> keys;
+  if (keys.size() != static_cast<size_t>(num_keys)) {
+    keys.clear();
+    keys.shrink_to_fit();
+    keys.resize(num_keys);
+    for (int i = 0; i < num_keys; ++i) keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(0));
+  }
+  return keys;
+}
+
+template <typename Index>
+void Load(Index* index, int64_t num_keys, bool random) {
+  if (random) {
+    for (int key: ShuffledKeys(num_keys)) index->Insert(key, key);
+  } else {
+    for (int key = 0; key < num_keys; ++key) index->Insert(key, key);
+  }
+  index->FinishLoad();
+}
+
+// Frees the index kept by LoadedIndex(), if any.
+static std::function<void()> release_loaded_index;
+
+// Returns an Index loaded with 'num_keys' in a random order, so that its nodes are as full as
+// after a run of random inserts, and sets 'index_bytes' to the heap it takes. Google benchmark runs
+// each benchmark several times while it works out how many iterations to do, so the last index
+// loaded is kept, and the lookup and scan benchmarks of the same index are registered one after the
+// other to share it.
+template <typename Index>
+Index* LoadedIndex(int64_t num_keys, int max_keys, int64_t* index_bytes) {
+  static unique_ptr<Index> index;
+  static int64_t index_num_keys;
+  static int index_max_keys;
+  static int64_t loaded_bytes;
+  *index_bytes = loaded_bytes;
+  if (index && index_num_keys == num_keys && index_max_keys == max_keys) return index.get();
+
+  if (release_loaded_index) release_loaded_index();
+  // The shuffled keys are generated before counting, so that they aren't counted as the index's.
+  ShuffledKeys(num_keys);
+  int64_t heap_before = formica::AllocatedBytes();
+  index.reset(new Index(max_keys));
+  Load(index.get(), num_keys, true);
+  *index_bytes = loaded_bytes = formica::AllocatedBytes() - heap_before;
+  index_num_keys = num_keys;
+  index_max_keys = max_keys;
+  release_loaded_index = [] { index.reset(); };
+  return index.get();
+}
+
+template <typename Index>
+void DoInsertBenchmark(benchmark::State& state, bool random) {
+  int64_t num_keys = state.range(0);
+  if (release_loaded_index) release_loaded_index();
+  if (!CheckFitsInMemory<Index>(state, num_keys)) return;
+  if (random) ShuffledKeys(num_keys);
+
+  int64_t index_bytes = 0;
+  for (auto _ : state) {
+    int64_t heap_before = formica::AllocatedBytes();
+    unique_ptr<Index> index(new Index(MaxKeysArg<Index>(state)));
+    Load(index.get(), num_keys, random);
+
+    state.PauseTiming();
+    index_bytes = formica::AllocatedBytes() - heap_before;
+    ReportShape(state, *index);
+    index.reset();
+    state.ResumeTiming();
+  }
+  ReportBytesPerKey(state, index_bytes, num_keys);
+  state.SetItemsProcessed(state.iterations() * num_keys);
+}
+
+template <typename Index>
+void RandomInsert(benchmark::State& state) { DoInsertBenchmark<Index>(state, true); }
+
+template <typename Index>
+void SequentialInsert(benchmark::State& state) { DoInsertBenchmark<Index>(state, false); }
+
+vector<int> LookupKeys(int64_t num_keys) {
+  std::mt19937_64 rng(1);
+  vector<int> keys(NUM_LOOKUP_KEYS);
+  for (int& key: keys) key = rng() % num_keys;
+  return keys;
+}
+
+// Point lookups of uniformly random keys, all of which are present.
+template <typename Index>
+void Lookup(benchmark::State& state) {
+  int64_t num_keys = state.range(0);
+  if (!CheckFitsInMemory<Index>(state, num_keys)) return;
+  int64_t index_bytes;
+  Index* index = LoadedIndex<Index>(num_keys, MaxKeysArg<Index>(state), &index_bytes);
+  vector<int> keys = LookupKeys(num_keys);
+
+  int i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index->Find(keys[i++ & (NUM_LOOKUP_KEYS - 1)]));
+  }
+  ReportShape(state, *index);
+  ReportBytesPerKey(state, index_bytes, num_keys);
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Range scans of SCAN_LENGTH keys from uniformly random keys. Items are keys scanned.
+template <typename Index>
+void Scan(benchmark::State& state) {
+  int64_t num_keys = state.range(0);
+  if (!CheckFitsInMemory<Index>(state, num_keys)) return;
+  int64_t index_bytes;
+  Index* index = LoadedIndex<Index>(num_keys, MaxKeysArg<Index>(state), &index_bytes);
+  vector<int> keys = LookupKeys(num_keys);
+  int values[SCAN_LENGTH];
+
+  int i = 0;
+  int64_t num_values = 0;
+  for (auto _ : state) {
+    num_values += index->Scan(keys[i++ & (NUM_LOOKUP_KEYS - 1)], SCAN_LENGTH, values);
+    benchmark::DoNotOptimize(values);
+  }
+  ReportShape(state, *index);
+  ReportBytesPerKey(state, index_bytes, num_keys);
+  state.SetItemsProcessed(num_values);
+}
+
+void BTreeArgs(benchmark::internal::Benchmark* b) {
+  for (int64_t num_keys: NUM_KEYS) {
+    for (int64_t max_keys: MAX_KEYS) b->Args({num_keys, max_keys});
+  }
+}
+
+void BaselineArgs(benchmark::internal::Benchmark* b) {
+  for (int64_t num_keys: NUM_KEYS) b->Arg(num_keys);
+}
+
+BENCHMARK_TEMPLATE(RandomInsert, BTreeIndex)->Apply(BTreeArgs)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(RandomInsert, StdMapIndex)->Apply(BaselineArgs)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(RandomInsert, SortedVectorIndex)->Apply(BaselineArgs)->
+    Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(SequentialInsert, BTreeIndex)->Apply(BTreeArgs)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(SequentialInsert, StdMapIndex)->Apply(BaselineArgs)->
+    Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(SequentialInsert, SortedVectorIndex)->Apply(BaselineArgs)->
+    Unit(benchmark::kMillisecond);
+
+// One benchmark per index and number of keys, so that the lookup and scan benchmarks of each index
+// run one after the other, and share it.
+void RegisterReadBenchmarks() {
+  for (int64_t num_keys: NUM_KEYS) {
+    for (int64_t max_keys: MAX_KEYS) {
+      benchmark::RegisterBenchmark("Lookup<BTreeIndex>", Lookup<BTreeIndex>)->
+          Args({num_keys, max_keys});
+      benchmark::RegisterBenchmark("Scan<BTreeIndex>", Scan<BTreeIndex>)->
+          Args({num_keys, max_keys});
+    }
+    benchmark::RegisterBenchmark("Lookup<StdMapIndex>", Lookup<StdMapIndex>)->Arg(num_keys);
+    benchmark::RegisterBenchmark("Scan<StdMapIndex>", Scan<StdMapIndex>)->Arg(num_keys);
+    benchmark::RegisterBenchmark("Lookup<SortedVectorIndex>", Lookup<SortedVectorIndex>)->
+        Arg(num_keys);
+    benchmark::RegisterBenchmark("Scan<SortedVectorIndex>", Scan<SortedVectorIndex>)->
+        Arg(num_keys);
+  }
+}
+
+// FastVector against std::vector, for the inserts that fill a node: 'capacity' inserts, each at a
+// random position, into a vector with room for them all.
+class StdVector {
+ public:
+  explicit StdVector(int capacity) { values_.reserve(capacity); }
+
+  void Insert(int idx, int val) { values_.insert(values_.begin() + idx, val); }
+  void Resize(int size) { values_.resize(size); }
+
+ private:
+  vector<int> values_;
+};
+
+template <typename Vector>
+void NodeInsert(benchmark::State& state) {
+  int capacity = state.range(0);
+  std::mt19937_64 rng(0);
+  vector<int> positions(capacity);
+  for (int i = 0; i < capacity; ++i) positions[i] = rng() % (i + 1);
+
+  Vector values(capacity);
+  for (auto _ : state) {
+    for (int i = 0; i < capacity; ++i) values.Insert(positions[i], i);
+    benchmark::ClobberMemory();
+    values.Resize(0);
+  }
+  state.SetItemsProcessed(state.iterations() * capacity);
+}
+
+BENCHMARK_TEMPLATE(NodeInsert, FastVector<int>)->RangeMultiplier(2)->Range(8, 256);
+BENCHMARK_TEMPLATE(NodeInsert, StdVector)->RangeMultiplier(2)->Range(8, 256);
+
+int main(int argc, char** argv) {
+  RegisterReadBenchmarks();
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -10,6 +10,8 @@
 // or implied.  See the License for the specific language governing permissions and limitations
 // under the License.
 
+#include <algorithm>
+
 #include "gtest/gtest.h"
 #include "btree.h"
 
@@ -90,12 +92,12 @@ TEST(BTree, Split) {
   BTree btree(4);
 
   vector<int> keys = {1,2,3,4};
-  Node node(&btree, keys, keys);
+  Node* node = new Node(&btree, keys, keys);
 
-  btree.SetRoot(&node);
+  btree.SetRoot(node);
 
-  node.Split();
-  ASSERT_NE(btree.root_, &node);
+  node->Split();
+  ASSERT_NE(btree.root_, node);
   ASSERT_EQ(1, btree.height());
 
   ASSERT_EQ(false, btree.root_->is_leaf());
@@ -114,19 +116,19 @@ TEST(BTree, Split) {
 TEST(BTree, SplitUpTree) {
   BTree btree(5);
 
-  Node root(&btree, false);
+  Node* root = new Node(&btree, false);
   for (int i = 0; i < 4; ++i) {
     int s = i * 10;
     vector<int> keys = { s + 1, s + 2, s + 3, s + 4 };
     Node* n = new Node(&btree, keys, keys);
 
-    root.keys_.Insert(i, (i + 1) * 10);
-    root.children_.Insert(i, n);
-    n->parent_ = &root;
+    root->keys_.Insert(i, (i + 1) * 10);
+    root->children_.Insert(i, n);
+    n->parent_ = root;
   }
   vector<int> final_keys = { 50, 55, 60 };
-  root.children_.PushBack(new Node(&btree, final_keys, final_keys));
-  btree.SetRoot(&root);
+  root->children_.PushBack(new Node(&btree, final_keys, final_keys));
+  btree.SetRoot(root);
 
   btree.Insert(7, 7);
 
@@ -158,6 +160,29 @@ TEST(BTree, Insert) {
   }
 }
 
+TEST(BTree, Scan) {
+  BTree btree(4);
+  int values[200];
+  ASSERT_EQ(0, btree.Scan(0, 10, values));
+
+  vector<int> keys;
+  for (int i = 0; i < 100; ++i) keys.push_back(i * 2);
+  random_shuffle(keys.begin(), keys.end());
+  for (int key: keys) btree.Insert(key, key + 1);
+
+  // Every leaf is reached, in order.
+  ASSERT_EQ(100, btree.Scan(0, 200, values));
+  for (int i = 0; i < 100; ++i) ASSERT_EQ(i * 2 + 1, values[i]);
+
+  // Scans start at the next key if 'start_key' is missing, and stop at 'max_values'.
+  ASSERT_EQ(10, btree.Scan(51, 10, values));
+  for (int i = 0; i < 10; ++i) ASSERT_EQ(52 + i * 2 + 1, values[i]);
+
+  ASSERT_EQ(1, btree.Scan(198, 10, values));
+  ASSERT_EQ(199, values[0]);
+  ASSERT_EQ(0, btree.Scan(199, 10, values));
+}
+
 void DoBenchmark() {
   using namespace std::chrono;
   BTree btree(100);
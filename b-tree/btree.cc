@@ -23,6 +23,22 @@ using namespace std;
 BTree::BTree(int max_keys) : MAX_KEYS(max_keys), root_(nullptr) {
 }
 
+BTree::~BTree() {
+  if (!root_) return;
+  stack<Node*> to_delete;
+  to_delete.push(root_);
+  while (!to_delete.empty()) {
+    Node* cur = to_delete.top();
+    to_delete.pop();
+    if (!cur->is_leaf()) {
+      for (int i = 0; i < cur->num_children(); ++i) {
+        if (cur->child_at(i)) to_delete.push(cur->child_at(i));
+      }
+    }
+    delete cur;
+  }
+}
+
 int BTree::Find(int key) {
   int idx;
   Node* leaf = FindLeaf(key, &idx);
@@ -30,6 +46,21 @@ int BTree::Find(int key) {
   return leaf->value_at(idx);
 }
 
+int BTree::Scan(int start_key, int max_values, int* values) {
+  if (!root_) return 0;
+  int idx;
+  Node* leaf = FindLeaf(start_key, &idx);
+  int num_values = 0;
+  while (leaf && num_values < max_values) {
+    for (; idx < leaf->num_keys() && num_values < max_values; ++idx) {
+      values[num_values++] = leaf->value_at(idx);
+    }
+    leaf = leaf->next();
+    idx = 0;
+  }
+  return num_values;
+}
+
 Node* BTree::FindLeaf(int key, int* idx) {
   Node* cur = root_;
 
@@ -221,6 +252,9 @@ Node* Node::MakeSplittedNode(int* pivot_key) {
     new_node->values_.Resize(num_keys_rhs);
     memcpy(&new_node->values_[0], &values_[pivot_idx + 1], sizeof(int) * num_keys_rhs);
     values_.Resize(keys_.size());
+
+    new_node->next_ = next_;
+    next_ = new_node;
   }
 
   return new_node;
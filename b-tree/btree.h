@@ -13,7 +13,7 @@
 #pragma once
 
 // TODO:
-// 1. Memory is allocated into raw pointers and never deleted.
+// 1. DONE - Memory is allocated into raw pointers and never deleted.
 // 2. DONE - Figure out whether we need FastVector
 // 3. Implement Delete()
 // 4. Experiment with top-down splitting.
@@ -51,6 +51,9 @@ class Node {
   Node* parent() const { return parent_; }
   bool is_leaf() const { return is_leaf_; }
 
+  // For a leaf, its right-hand sibling, or nullptr if this is the rightmost leaf.
+  Node* next() const { return next_; }
+
   // If num_keys() == MAX_KEYS, splits this node into two along the middle key, and updates parent_
   // to point to both this node and its new right-hand sibling. Recursively splits the parent, if
   // needed. If this is the root node, a new root is created with one key and two links.
@@ -89,6 +92,9 @@ class Node {
   // Only used if is_leaf().
   IntVector values_;
 
+  // Only used if is_leaf(). Set when a leaf is split, so that leaves form a list in key order.
+  Node* next_ = nullptr;
+
   BTree* btree_;
   const bool is_leaf_;
 
@@ -107,19 +113,26 @@ class BTree {
  public:
   BTree(int max_keys);
 
+  // Deletes every node in the tree, including any root passed to SetRoot().
+  ~BTree();
+
   // Returns the value associated with 'key' in the tree, or -1 if the key does not exist.
   int Find(int key);
 
   // Inserts a new (key, value) pair into the tree.
   void Insert(int key, int value);
 
+  // Copies the values of up to 'max_values' keys, in key order starting with the smallest key that
+  // is at least 'start_key', to 'values'. Returns the number of values copied.
+  int Scan(int start_key, int max_values, int* values);
+
   // Not implemented
   void Delete(int key);
 
   // Returns the height of the tree. Only set correctly for the root node.
   int height() const { return height_; }
 
-  // Used only for testing - replace the root node with a new root.
+  // Used only for testing - replace the root node with a new root, which the tree then owns.
   void SetRoot(Node* root) { root_ = root; }
   void CheckSelf();
 
@@ -13,7 +13,8 @@
 #pragma once
 
 // A vector class with a fast-ish insert thanks to knowing its (fixed) capacity.
-// std::vector appears to be about 25% slower. More investigation warranted.
+// std::vector was thought to be about 25% slower, but with its capacity reserved up front it is as
+// fast, to within noise, at every node size from 8 to 256 (see NodeInsert in btree-benchmark.cc).
 template <typename T>
 class FastVector {
  public:
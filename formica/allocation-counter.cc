@@ -0,0 +1,88 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "allocation-counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+namespace formica {
+
+namespace {
+
+struct alignas(64) Counter {
+  std::atomic<int64_t> bytes{0};
+};
+
+static constexpr int NUM_COUNTERS = 64;
+Counter counters[NUM_COUNTERS];
+
+// A thread frees into its own counter too, so one counter may go negative; only the sum means
+// anything.
+Counter* ThreadCounter() {
+  static std::atomic<int> next_thread{0};
+  thread_local int idx = next_thread.fetch_add(1, std::memory_order_relaxed) % NUM_COUNTERS;
+  return &counters[idx];
+}
+
+void* CountedAllocate(size_t size) {
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (ptr != nullptr) {
+    ThreadCounter()->bytes.fetch_add(malloc_usable_size(ptr), std::memory_order_relaxed);
+  }
+  return ptr;
+}
+
+void CountedFree(void* ptr) {
+  if (ptr == nullptr) return;
+  ThreadCounter()->bytes.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+  free(ptr);
+}
+
+}
+
+int64_t AllocatedBytes() {
+  int64_t total = 0;
+  for (int i = 0; i < NUM_COUNTERS; ++i) total += counters[i].bytes.load(std::memory_order_relaxed);
+  return total;
+}
+
+}
+
+void* operator new(size_t size) {
+  void* ptr = formica::CountedAllocate(size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](size_t size) {
+  void* ptr = formica::CountedAllocate(size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return formica::CountedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return formica::CountedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept { formica::CountedFree(ptr); }
+void operator delete[](void* ptr) noexcept { formica::CountedFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { formica::CountedFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { formica::CountedFree(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { formica::CountedFree(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { formica::CountedFree(ptr); }
@@ -0,0 +1,34 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+
+namespace formica {
+
+// Heap accounting for benchmarks. allocation-counter.cc replaces the global operator new and
+// delete with versions that count the bytes they hand out, so it is linked into the benchmark
+// binaries only, not the formica library.
+//
+// Everything allocated with new is counted, including the nodes of standard containers and the
+// buffers of long std::strings, at the size malloc actually reserved for it
+// (malloc_usable_size()). Memory from malloc() or mmap() directly, such as the regions behind logs
+// and indexes, is not; a store's MemoryUsage() reports those.
+//
+// Counts are kept per thread, as Stats are, so that counting doesn't make every allocation write
+// one shared cache line.
+
+// The bytes currently allocated with operator new, by every thread.
+int64_t AllocatedBytes();
+
+}
@@ -11,131 +11,417 @@
 // under the License.
 
 #include "circular-log.h"
+#include "compression.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <iostream>
-#include <sys/mman.h>
 
 using std::string;
 using std::cout;
 using std::endl;
+using std::vector;
 
 namespace formica {
 
+constexpr space_t CircularLog::ENTRY_ALIGNMENT;
+
+// Set in EntryHeader::flags if the value is compressed, and if the header holds an expiry time.
+static constexpr uint8_t COMPRESSED_VALUE = 1;
+static constexpr uint8_t HAS_EXPIRY = 2;
+
+// The first byte of a live entry, of a deleted one, and of the padding that an append skips at the
+// end of the buffer.
+static constexpr char DELIMITER = '!';
+static constexpr char DELETED_DELIMITER = '~';
+static constexpr char PADDING_DELIMITER = '#';
+
+// An entry's header, decoded. In the log, it is laid out as:
+//
+//   delimiter (1 byte) | flags (1) | tag (4) | size / ENTRY_ALIGNMENT | keylen | valuelen | expiry (4)
+//
+// where the sizes are varints, and the expiry is only there if the flags have HAS_EXPIRY. The key
+// and value follow it, and the entry is padded out to 'size'. For the keys and values that the
+// stores mostly see, the header is 9 or 10 bytes, where a struct of 32-bit fields took 24.
 struct EntryHeader {
-  char delimiter = '!';
-  // Size, including this.
-  entrysize_t size;
-  entrysize_t keylen;
-  entrysize_t valuelen;
-  tag_t tag;
+  char delimiter = DELIMITER;
+  uint8_t flags = 0;
+  tag_t tag = 0;
+  // The space that the whole entry takes up, which is a multiple of ENTRY_ALIGNMENT.
+  entrysize_t size = 0;
+  entrysize_t keylen = 0;
+  // The size of the value in the log, which may be compressed.
+  entrysize_t valuelen = 0;
+  // The CoarseClock time at which the entry expires, or 0 if it never does.
+  uint32_t expiry = 0;
+
+  static constexpr int FIXED_SIZE = 2 + sizeof(tag_t);
+
+  // The space that the header takes up in the log.
+  entrysize_t EncodedSize() const {
+    return FIXED_SIZE + VarintSize(size / CircularLog::ENTRY_ALIGNMENT) + VarintSize(keylen) +
+        VarintSize(valuelen) + ((flags & HAS_EXPIRY) != 0 ? sizeof(expiry) : 0);
+  }
+
+  // Sets 'size' for a new entry: the smallest multiple of ENTRY_ALIGNMENT that holds the header,
+  // key and value. The header encodes the size, so it may take a second try.
+  void SetSizeForAppend() {
+    space_t payload = keylen + valuelen;
+    size = 0;
+    do {
+      size = (EncodedSize() + payload + CircularLog::ENTRY_ALIGNMENT - 1) &
+          ~(CircularLog::ENTRY_ALIGNMENT - 1);
+    } while (EncodedSize() + payload > size);
+  }
+};
+
+// Writes 'header' at 'ptr', and returns where the key goes.
+static int8_t* EncodeHeader(const EntryHeader& header, int8_t* ptr) {
+  ptr[0] = header.delimiter;
+  ptr[1] = header.flags;
+  memcpy(ptr + 2, &header.tag, sizeof(header.tag));
+  ptr = PutVarint(ptr + EntryHeader::FIXED_SIZE, header.size / CircularLog::ENTRY_ALIGNMENT);
+  ptr = PutVarint(ptr, header.keylen);
+  ptr = PutVarint(ptr, header.valuelen);
+  if ((header.flags & HAS_EXPIRY) != 0) {
+    memcpy(ptr, &header.expiry, sizeof(header.expiry));
+    ptr += sizeof(header.expiry);
+  }
+  return ptr;
+}
+
+// Reads the header at 'ptr', and returns where the key starts, or nullptr if the header is
+// malformed. Readers may see a header torn by a concurrent append, so the entry is checked to fit
+// before 'end', the end of the buffer.
+static const int8_t* DecodeHeader(const int8_t* ptr, const int8_t* end, EntryHeader* header) {
+  const int8_t* start = ptr;
+  if (end - ptr < EntryHeader::FIXED_SIZE) return nullptr;
+  header->delimiter = ptr[0];
+  header->flags = ptr[1];
+  memcpy(&header->tag, ptr + 2, sizeof(header->tag));
+  uint32_t units, keylen, valuelen;
+  if ((ptr = GetVarint(ptr + EntryHeader::FIXED_SIZE, end, &units)) == nullptr ||
+      (ptr = GetVarint(ptr, end, &keylen)) == nullptr ||
+      (ptr = GetVarint(ptr, end, &valuelen)) == nullptr) {
+    return nullptr;
+  }
+  header->expiry = 0;
+  if ((header->flags & HAS_EXPIRY) != 0) {
+    if (end - ptr < sizeof(header->expiry)) return nullptr;
+    memcpy(&header->expiry, ptr, sizeof(header->expiry));
+    ptr += sizeof(header->expiry);
+  }
+
+  uint64_t size = static_cast<uint64_t>(units) * CircularLog::ENTRY_ALIGNMENT;
+  if (size > end - start || (ptr - start) + static_cast<uint64_t>(keylen) + valuelen > size) {
+    return nullptr;
+  }
+  header->size = size;
+  header->keylen = keylen;
+  header->valuelen = valuelen;
+  return ptr;
+}
+
+// Change whenever the layout of the superblock or of entries changes, so that old files are reset
+// rather than misread.
+static constexpr uint32_t LOG_FORMAT_VERSION = 4;
+static constexpr uint64_t LOG_MAGIC = 0x474f4c41434d524fULL;
+static constexpr space_t SUPERBLOCK_SIZE = 4096;
+
+struct CircularLog::Superblock {
+  uint64_t magic;
+  uint32_t format_version;
+  uint32_t padding;
+  space_t size;
+
+  // The logical tail, i.e. CircularLog::written_.
+  uint64_t tail;
+
+  // The buffer is split into NUM_CHECKPOINTS equal chunks. Each one has the offset of the first
+  // entry to be appended to that chunk since the tail last entered it, or -1. Rebuilding an index
+  // can start scanning from any of these that are still live.
+  offset_t checkpoints[NUM_CHECKPOINTS];
 };
 
-CircularLog::CircularLog(space_t size) : size_(size) {
+CircularLog::CircularLog(space_t size, const MemoryOptions& options)
+    : size_(size - size % ENTRY_ALIGNMENT) {
   assert(size_ > 0);
-  void* map = mmap(0, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
-  if (map == MAP_FAILED) {
+  region_ = AllocateRegion(size_, options);
+  if (region_.ptr == nullptr) {
     cout << "ERRORNO: " << errno << " (enomem: " << ENOMEM << ")" << endl;
     assert(false);  // TODO
   }
-  bufptr_ = reinterpret_cast<int8_t*>(map);
+  bufptr_ = reinterpret_cast<int8_t*>(region_.ptr);
 }
 
-offset_t CircularLog::Insert(const string& key, const string& value, keyhash_t hash) {
-  return Update(-1, key, value, hash);
+CircularLog::CircularLog(const string& path, space_t size)
+    : size_(size - size % ENTRY_ALIGNMENT) {
+  static_assert(sizeof(Superblock) <= SUPERBLOCK_SIZE, "Superblock must fit in a page");
+  assert(size_ >= NUM_CHECKPOINTS);
+  bool existed;
+  region_ = MapFile(path, SUPERBLOCK_SIZE + size_, &existed);
+  CheckMapped(region_, path);
+  superblock_ = reinterpret_cast<Superblock*>(region_.ptr);
+  bufptr_ = reinterpret_cast<int8_t*>(region_.ptr) + SUPERBLOCK_SIZE;
+
+  recovered_ = existed && superblock_->magic == LOG_MAGIC &&
+      superblock_->format_version == LOG_FORMAT_VERSION && superblock_->size == size_;
+  if (recovered_) {
+    claimed_.store(superblock_->tail, std::memory_order_relaxed);
+    written_.store(superblock_->tail, std::memory_order_relaxed);
+    return;
+  }
+
+  // The old contents of the buffer can be left alone, since nothing in the superblock points at
+  // them any more.
+  memset(superblock_, 0, sizeof(Superblock));
+  std::fill_n(superblock_->checkpoints, NUM_CHECKPOINTS, -1);
+  superblock_->size = size_;
+  superblock_->format_version = LOG_FORMAT_VERSION;
+  superblock_->magic = LOG_MAGIC;
 }
 
-offset_t CircularLog::Update(offset_t offset, const string& key, const string& value, keyhash_t hash) {
-  assert(tail_ < size_);
+offset_t CircularLog::Insert(const string& key, const string& value, keyhash_t hash,
+    uint32_t expiry) {
+  return Update(-1, key, value, hash, expiry);
+}
 
-  space_t required = key.size() + value.size() + sizeof(EntryHeader);
-  if (required >= size_) {
-    return -1;
+offset_t CircularLog::Update(offset_t offset, const string& key, const string& value,
+    keyhash_t hash, uint32_t expiry) {
+  // Only keep the compressed value if it's smaller, counting the size prefix.
+  const string* stored = &value;
+  uint8_t flags = 0;
+  if (compression_ && value.size() >= MIN_COMPRESSED_SIZE) {
+    entrysize_t raw_size = value.size();
+    compress_buffer_.resize(value.size());
+    int compressed_size = Compress(value.data(), raw_size, &compress_buffer_[sizeof(raw_size)],
+        raw_size - sizeof(raw_size) - 1);
+    if (compressed_size > 0) {
+      memcpy(&compress_buffer_[0], &raw_size, sizeof(raw_size));
+      compress_buffer_.resize(sizeof(raw_size) + compressed_size);
+      stored = &compress_buffer_;
+      flags |= COMPRESSED_VALUE;
+    }
   }
 
+  return Write(offset, key, *stored, ExtractLogTag(hash), flags, expiry);
+}
+
+offset_t CircularLog::Write(offset_t offset, const string& key, const string& stored, tag_t tag,
+    uint8_t flags, uint32_t expiry) {
+  EntryHeader header;
+  header.flags = expiry == 0 ? flags & ~HAS_EXPIRY : flags | HAS_EXPIRY;
+  header.tag = tag;
+  header.keylen = key.size();
+  header.valuelen = stored.size();
+  header.expiry = expiry;
+
+  uint64_t position = written_.load(std::memory_order_relaxed);
   bool is_append = (offset == -1);
   if (offset > -1) {
-    EntryHeader* header = reinterpret_cast<EntryHeader*>(bufptr_ + offset);
-    is_append = header->delimiter != '!' ||
-        (header->keylen + header->valuelen < key.size() + value.size());
+    // In-place updates keep the original size, so that the log can still be scanned entry by entry.
+    EntryHeader old;
+    is_append = !IsLive(offset, position) ||
+        DecodeHeader(bufptr_ + offset % size_, bufptr_ + size_, &old) == nullptr ||
+        old.delimiter != DELIMITER;
+    if (!is_append) {
+      header.size = old.size;
+      is_append = header.EncodedSize() + header.keylen + header.valuelen > header.size;
+    }
   }
 
-  if (is_append) offset = tail_;
+  if (is_append) {
+    header.SetSizeForAppend();
+    if (header.size >= size_) return -1;
+
+    // Entries never wrap: if this one doesn't fit before the end of the buffer, the rest of the
+    // buffer is skipped, and the entry goes at the start.
+    space_t skip = size_ - position % size_;
+    if (skip >= header.size) skip = 0;
+    if (head_ != -1 && position + skip + header.size > head_ + size_) return -1;
+    offset = position + skip;
+    claimed_.store(offset + header.size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    if (skip > 0) bufptr_[position % size_] = PADDING_DELIMITER;
+  }
 
-  offset_t cursor = offset;
-  EntryHeader* header = reinterpret_cast<EntryHeader*>(bufptr_ + cursor);
-  header->delimiter = '!';
-  header->size = required;
-  header->keylen = key.size();
-  header->valuelen = value.size();
-  header->tag = ExtractLogTag(hash);
-  cursor += sizeof(EntryHeader);
-  cursor %= size_;
-  cursor = PutString(cursor, key);
-  cursor = PutString(cursor, value);
+  int8_t* ptr = EncodeHeader(header, bufptr_ + offset % size_);
+  memcpy(ptr, key.data(), key.size());
+  memcpy(ptr + key.size(), stored.data(), stored.size());
 
   if (is_append) {
-    tail_ = cursor;
-    if (size_ - tail_ < sizeof(EntryHeader)) tail_ = 0L;
+    position = offset + header.size;
+    written_.store(position, std::memory_order_release);
+    if (superblock_ != nullptr) Checkpoint(offset, position);
   }
 
   return offset;
 }
 
-offset_t CircularLog::PutString(offset_t offset, const string& s) {
-  if (size_ - offset > s.size()) {
-    memcpy(reinterpret_cast<void*>(bufptr_ + offset), s.data(), s.size());
-    return offset + s.size();
-  }
+offset_t CircularLog::Move(offset_t offset) {
+  if (!IsLive(offset, written_.load(std::memory_order_relaxed))) return -1;
+  EntryHeader header;
+  const int8_t* ptr = DecodeHeader(bufptr_ + offset % size_, bufptr_ + size_, &header);
+  if (ptr == nullptr) return -1;
+  move_key_.assign(reinterpret_cast<const char*>(ptr), header.keylen);
+  // The value is copied as it is in the log, and stays compressed if it was.
+  compress_buffer_.assign(reinterpret_cast<const char*>(ptr) + header.keylen, header.valuelen);
+  return Write(-1, move_key_, compress_buffer_, header.tag, header.flags, header.expiry);
+}
 
-  // Otherwise split the write
-  space_t to_write = size_ - offset;
-  memcpy(reinterpret_cast<void*>(bufptr_ + offset), s.data(), to_write);
-  memcpy(reinterpret_cast<void*>(bufptr_), s.data() + to_write, s.size() - to_write);
+void CircularLog::Checkpoint(offset_t offset, uint64_t tail) {
+  space_t chunk_size = size_ / NUM_CHECKPOINTS;
+  offset_t chunk = std::min<offset_t>((offset % size_) / chunk_size, NUM_CHECKPOINTS - 1);
+  offset_t chunk_start = offset - (offset % size_) + chunk * chunk_size;
+  if (superblock_->checkpoints[chunk] < chunk_start) superblock_->checkpoints[chunk] = offset;
+  superblock_->tail = tail;
+}
 
-  return s.size() - to_write;
+vector<offset_t> CircularLog::ScanStarts() const {
+  vector<offset_t> starts;
+  if (superblock_ == nullptr) return starts;
+  uint64_t tail = written_.load(std::memory_order_acquire);
+  for (int i = 0; i < NUM_CHECKPOINTS; ++i) {
+    offset_t offset = superblock_->checkpoints[i];
+    if (IsLive(offset, tail) && offset < tail) starts.push_back(offset);
+  }
+  std::sort(starts.begin(), starts.end());
+  return starts;
 }
 
-void CircularLog::ReadString(offset_t offset, entrysize_t len, string* s) {
-  offset %= size_;
-  if (offset + len < size_) {
-    *s = string(reinterpret_cast<char*>(bufptr_ + offset), len);
-    return;
+bool CircularLog::ScanEntry(offset_t offset, ScannedEntry* entry) const {
+  if (!IsLive(offset, written_.load(std::memory_order_acquire))) return false;
+
+  const int8_t* ptr = bufptr_ + offset % size_;
+  if (*ptr == PADDING_DELIMITER) {
+    entry->next = offset + size_ - offset % size_;
+    entry->key = LogSlice();
+    entry->key.entry_offset = offset;
+    entry->tag = 0;
+    entry->deleted = true;
+    entry->expired = false;
+    return true;
+  }
+
+  EntryHeader header;
+  const int8_t* key = DecodeHeader(ptr, bufptr_ + size_, &header);
+  if (key == nullptr ||
+      (header.delimiter != DELIMITER && header.delimiter != DELETED_DELIMITER)) {
+    return false;
   }
 
-  // Otherwise this is a wrapped read.
-  s->reserve(len);
+  entry->next = offset + header.size;
+  MakeSlice(offset + (key - ptr), header.keylen, &entry->key);
+  entry->key.entry_offset = offset;
+  entry->tag = header.tag;
+  entry->deleted = header.delimiter == DELETED_DELIMITER;
+  entry->expired = Expired(header.expiry);
+  return true;
+}
 
-  // Read from offset to size_
-  int8_t* start = bufptr_ + offset;
-  s->append(reinterpret_cast<char*>(start), size_ - offset);
+space_t CircularLog::MarkDeleted(offset_t offset) {
+  if (!IsLive(offset, written_.load(std::memory_order_relaxed))) return 0;
+  int8_t* ptr = bufptr_ + offset % size_;
+  EntryHeader header;
+  if (DecodeHeader(ptr, bufptr_ + size_, &header) == nullptr) return 0;
+  *ptr = DELETED_DELIMITER;
+  return header.size;
+}
 
-  space_t remaining = len - (size_ - offset);
-  s->append(reinterpret_cast<char*>(bufptr_), remaining);
+space_t CircularLog::SpaceAt(offset_t offset) const {
+  if (!IsLive(offset, written_.load(std::memory_order_relaxed))) return 0;
+  EntryHeader header;
+  if (DecodeHeader(bufptr_ + offset % size_, bufptr_ + size_, &header) == nullptr) return 0;
+  return header.size;
 }
 
-bool CircularLog::ReadFrom(offset_t offset, keyhash_t expected, string* key, string* value) {
-  assert(offset < size_);
-  EntryHeader* header = reinterpret_cast<EntryHeader*>(bufptr_ + offset);
-  if (header->tag != ExtractLogTag(expected) || header->delimiter != '!') {
+bool CircularLog::IsExpired(offset_t offset) const {
+  if (!IsLive(offset, written_.load(std::memory_order_relaxed))) return false;
+  EntryHeader header;
+  if (DecodeHeader(bufptr_ + offset % size_, bufptr_ + size_, &header) == nullptr) return false;
+  return Expired(header.expiry);
+}
+
+space_t CircularLog::SpaceFor(const string& key, const string& value) {
+  EntryHeader header;
+  header.flags = HAS_EXPIRY;
+  header.keylen = key.size();
+  header.valuelen = value.size();
+  header.SetSizeForAppend();
+  return header.size;
+}
+
+space_t CircularLog::MaxSpaceFor(const string& key, const string& value) {
+  // The padding skipped at the end of the buffer is always less than the entry.
+  return 2 * SpaceFor(key, value) - ENTRY_ALIGNMENT;
+}
+
+bool CircularLog::ReadSlices(offset_t offset, keyhash_t expected, LogSlice* key,
+    LogSlice* value) {
+  // Entries that have been overwritten are rejected without touching the buffer.
+  if (!IsLive(offset, written_.load(std::memory_order_acquire))) return false;
+
+  // The header is decoded into a copy, so that its fields can't change after they have been
+  // checked.
+  EntryHeader header;
+  const int8_t* ptr = DecodeHeader(bufptr_ + offset % size_, bufptr_ + size_, &header);
+  if (ptr == nullptr || header.tag != ExtractLogTag(expected) || header.delimiter != DELIMITER) {
+    // If this was torn by a concurrent append, the entry is being overwritten, so this is the right
+    // answer anyway.
     return false;
   }
-  offset_t keystart = offset + sizeof(EntryHeader);
-  ReadString(keystart, header->keylen, key);
-  ReadString(keystart + header->keylen, header->valuelen, value);
+  if (Expired(header.expiry)) return false;
+
+  key->data = reinterpret_cast<const char*>(ptr);
+  key->len = header.keylen;
+  value->data = key->data + header.keylen;
+  value->len = header.valuelen;
+  key->entry_offset = value->entry_offset = offset;
+  value->compressed = (header.flags & COMPRESSED_VALUE) != 0;
+  value->expiry = header.expiry;
+  return true;
+}
+
+void LogSlice::DecompressTo(string* s) const {
+  s->clear();
+  entrysize_t raw_size;
+  entrysize_t compressed_len = len - sizeof(raw_size);
+  if (compressed_len < 0) return;
+  memcpy(&raw_size, data, sizeof(raw_size));
+  // Each byte of compressed data produces at most 255 bytes, which bounds what a torn size can make
+  // us allocate.
+  if (raw_size < 0 || raw_size / 255 > compressed_len) return;
+  s->resize(raw_size);
+  if (!Decompress(data + sizeof(raw_size), compressed_len, &(*s)[0], raw_size)) s->clear();
+}
+
+bool CircularLog::IsValid(const LogSlice& slice) const {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return IsLive(slice.entry_offset, claimed_.load(std::memory_order_relaxed));
+}
+
+bool CircularLog::ReadFrom(offset_t offset, keyhash_t expected, string* key, string* value) {
+  LogSlice key_slice, value_slice;
+  do {
+    if (!ReadSlices(offset, expected, &key_slice, &value_slice)) return false;
+    key_slice.CopyTo(key);
+    value_slice.CopyTo(value);
+  } while (!IsValid(value_slice));
   return true;
 }
 
 void CircularLog::DebugDump() {
   for (offset_t i = 0; i < size_; ++i) {
     cout << i << ":" << *(reinterpret_cast<char*>(bufptr_ + i));
-    if (i == tail_) cout << " <-- TAIL ";
+    if (i == tail() % size_) cout << " <-- TAIL ";
     cout << endl;
   }
   cout << endl;
 }
 
 CircularLog::~CircularLog() {
-  if (bufptr_ != nullptr) munmap(bufptr_, size_);
+  FreeRegion(region_);
 }
 
 }
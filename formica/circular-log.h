@@ -12,30 +12,234 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "clock.h"
 #include "common.h"
+#include "memory.h"
 
 namespace formica {
 
+// A view of some bytes in a CircularLog. Entries never wrap around the end of the buffer, so the
+// bytes are always contiguous. They belong to the log, which may overwrite them at any time: check
+// CircularLog::IsValid() once done with them.
+struct LogSlice {
+  const char* data = nullptr;
+  entrysize_t len = 0;
+
+  // The entry that the slice is part of, for IsValid().
+  offset_t entry_offset = -1;
+
+  // True if this is a compressed value, which CopyTo() decompresses. Its bytes are the size of the
+  // value once decompressed, as an entrysize_t, followed by the compressed data.
+  bool compressed = false;
+
+  // For a value, the CoarseClock time at which its entry expires, or 0 if it never does.
+  uint32_t expiry = 0;
+
+  // The size of the bytes in the log, which for a compressed value isn't the size of the value.
+  entrysize_t size() const { return len; }
+
+  bool Equals(const std::string& s) const {
+    return s.size() == len && memcmp(s.data(), data, len) == 0;
+  }
+
+  // Replaces the contents of 's', reusing its storage if it is large enough.
+  void CopyTo(std::string* s) const {
+    if (compressed) {
+      DecompressTo(s);
+      return;
+    }
+    s->assign(data, len);
+  }
+
+ private:
+  // If the bytes are torn by a concurrent write, leaves 's' with some other contents, which the
+  // caller will discard once IsValid() fails.
+  void DecompressTo(std::string* s) const;
+};
+
+// A fixed-size log of (key, value) entries that wraps around and overwrites its oldest entries.
+//
+// Entries are addressed by their logical offset: the number of bytes appended to the log before
+// them, which only ever increases. An entry's bytes start at (offset % size) in the buffer, and it
+// has been overwritten once the tail is more than 'size' bytes past it, so callers can tell if an
+// offset is stale without reading the buffer.
+//
+// Entries start on ENTRY_ALIGNMENT-byte boundaries, and never wrap around the end of the buffer:
+// one that doesn't fit before the end is appended at the start instead, and the space it skips is
+// padding. The header before each key is a few bytes of flags and tag, and varint lengths, so a
+// small entry takes up little more than its key and value.
+//
+// Only one thread may write to the log, but ReadFrom() and ReadSlices() may be called concurrently
+// from other threads. Readers detect appends that overwrite the entry they are copying, and retry;
+// in-place Update()s are not detected here, and must be fenced by the caller (FormicaStore does
+// this with the LossyHash bucket version).
+//
+// The log can also be kept in a file, so that its contents survive a restart. The file starts with
+// a superblock holding the log's size, format version and tail, followed by the buffer itself.
 class CircularLog {
  public:
-  CircularLog(space_t size);
+  // 'size' is rounded down to a multiple of ENTRY_ALIGNMENT.
+  CircularLog(space_t size, const MemoryOptions& options = MemoryOptions());
+
+  // Opens the log in the file at 'path', creating it if necessary. The file is mapped with
+  // MAP_SHARED, so every append is in the page cache as soon as it is made; call Sync() to be sure
+  // that it is on disk. If the file doesn't hold a log of 'size' bytes with the current format
+  // version, it is reset to an empty log.
+  CircularLog(const std::string& path, space_t size);
   ~CircularLog();
 
-  offset_t Insert(const std::string& key, const std::string& value, keyhash_t hash);
-  offset_t Update(offset_t offset, const std::string& key, const std::string& value, keyhash_t hash);
+  // 'expiry' is the CoarseClock time after which reads of the entry fail, or 0 for never. If
+  // compression is on, the value is compressed if that saves space.
+  offset_t Insert(const std::string& key, const std::string& value, keyhash_t hash,
+      uint32_t expiry = 0);
+  offset_t Update(offset_t offset, const std::string& key, const std::string& value,
+      keyhash_t hash, uint32_t expiry = 0);
 
+  // Appends a copy of the live entry at 'offset', with the same expiry, and returns its offset, or
+  // -1 if there's no room. The value isn't decompressed and recompressed.
+  offset_t Move(offset_t offset);
+
+  // Returns false if the entry at 'offset' was overwritten or has expired, or its tag doesn't match
+  // 'expected'.
   bool ReadFrom(offset_t offset, keyhash_t expected, std::string* key, std::string* value);
 
+  // Zero-copy version of ReadFrom(): points 'key' and 'value' at the entry in the log. Returns
+  // false if the entry's tag doesn't match 'expected', or it has expired.
+  bool ReadSlices(offset_t offset, keyhash_t expected, LogSlice* key, LogSlice* value);
+
+  // True if the entry at 'offset' is live, but has expired.
+  bool IsExpired(offset_t offset) const;
+
+  // Returns false if the entry that 'slice' came from has been (or is being) overwritten by an
+  // append since ReadSlices() was called.
+  bool IsValid(const LogSlice& slice) const;
+
+  // Marks the entry at 'offset' as deleted, so that it is no longer returned by reads, and is
+  // skipped when the log is reopened. Like an in-place Update(), must be fenced by the caller.
+  // Returns the space that the entry took up, or 0 if it had already been overwritten.
+  space_t MarkDeleted(offset_t offset);
+
+  // Whether values written from now on are compressed (see compression.h). Off by default. Values
+  // shorter than MIN_COMPRESSED_SIZE are never compressed. Entries record whether their value is
+  // compressed, so this can be changed at any time.
+  void set_compression(bool enabled) { compression_ = enabled; }
+  bool compression() const { return compression_; }
+  static constexpr int MIN_COMPRESSED_SIZE = 32;
+
+  // The space taken up by the entry at 'offset', or 0 if it has been overwritten.
+  space_t SpaceAt(offset_t offset) const;
+
+  // By default, appends overwrite the oldest entries. Once a head is set, appends that would
+  // overwrite the entry at the head, or anything after it, fail instead (returning -1), and it is
+  // up to the caller to move the head forward once it has dealt with the oldest entries.
+  void set_head(offset_t head) { head_ = head; }
+  offset_t head() const { return head_; }
+
+  // The space between the tail and the head, i.e. how much can be appended before an append fails.
+  space_t free_space() const { return size_ - (tail() - head_); }
+
+  // The most space that an entry takes up in the log, which is less if its value is compressed or
+  // it has no expiry, and the most that appending it can use up, including what may be skipped at
+  // the end of the buffer.
+  static space_t SpaceFor(const std::string& key, const std::string& value);
+  static space_t MaxSpaceFor(const std::string& key, const std::string& value);
+
+  static constexpr space_t ENTRY_ALIGNMENT = 8;
+
+  // True if this log was opened from a file that already held one.
+  bool recovered() const { return recovered_; }
+
+  // Flushes a file-backed log to disk. Returns false on failure, or if the log isn't file-backed.
+  bool Sync() { return superblock_ != nullptr && SyncRegion(region_); }
+
+  // For rebuilding an index from a reopened log. Returns the offsets of live entries from which the
+  // log can be scanned with ScanEntry(), in increasing order, roughly one for every
+  // 1 / NUM_CHECKPOINTS of the buffer, so that the ranges between them can be scanned in parallel.
+  // Live entries before the first one (at most one range's worth) can't be found.
+  std::vector<offset_t> ScanStarts() const;
+  static constexpr int NUM_CHECKPOINTS = 256;
+
+  // The padding skipped at the end of the buffer is returned as a deleted entry with an empty key.
+  struct ScannedEntry {
+    // The offset of the entry after this one.
+    offset_t next;
+    LogSlice key;
+    tag_t tag;
+    bool deleted;
+    bool expired;
+  };
+
+  // Reads the entry at 'offset', which must be a ScanStarts() offset, the head, or a 'next' from a
+  // previous call. Returns false if there's no valid entry there. Only safe to call from the thread
+  // that writes to the log.
+  bool ScanEntry(offset_t offset, ScannedEntry* entry) const;
+
+  // The logical offset at which the next entry will be appended.
+  offset_t tail() const { return written_.load(std::memory_order_acquire); }
+  space_t size() const { return size_; }
+  const Region& region() const { return region_; }
+
+  // Issues prefetches for the header and the start of the key of the entry at 'offset'.
+  void Prefetch(offset_t offset) {
+    const int8_t* ptr = bufptr_ + offset % size_;
+    __builtin_prefetch(ptr);
+    __builtin_prefetch(ptr + 64);
+  }
+
   void DebugDump();
 
  private:
-  offset_t PutString(offset_t offset, const std::string& s);
-  void ReadString(offset_t offset, entrysize_t len, std::string* s);
+  // The first page of a file-backed log; defined in circular-log.cc.
+  struct Superblock;
+
+  // Writes an entry whose value is 'stored', which is compressed if 'flags' says so. Appends it if
+  // 'offset' is -1, or the entry at 'offset' is too small or has been overwritten.
+  offset_t Write(offset_t offset, const std::string& key, const std::string& stored, tag_t tag,
+      uint8_t flags, uint32_t expiry);
+
+  // Records where the tail is, and if the entry at 'offset' is the first to be appended to its
+  // part of the buffer since the tail last wrapped, where it starts.
+  void Checkpoint(offset_t offset, uint64_t tail);
+  void MakeSlice(offset_t offset, entrysize_t len, LogSlice* slice) const {
+    slice->data = reinterpret_cast<const char*>(bufptr_ + offset % size_);
+    slice->len = len;
+  }
+
+  static bool Expired(uint32_t expiry) { return expiry != 0 && expiry <= CoarseClock::Now(); }
+
+  // Returns true if the entry at 'offset' hasn't been overwritten by appends up to 'tail'. Since
+  // the first byte of an entry is the first to be overwritten, this is true of the whole entry.
+  bool IsLive(offset_t offset, uint64_t tail) const {
+    return offset >= 0 && static_cast<uint64_t>(offset) <= tail && tail - offset <= size_;
+  }
 
   space_t size_ = 0L;
   int8_t* bufptr_ = nullptr;
+  Region region_;
+
+  // -1 if appends may overwrite anything.
+  offset_t head_ = -1;
+
+  bool compression_ = false;
+  // Hold the key and value of an entry while it is being appended; the value may be compressed.
+  std::string move_key_;
+  std::string compress_buffer_;
+
+  // Only set for file-backed logs.
+  Superblock* superblock_ = nullptr;
+  bool recovered_ = false;
 
-  offset_t tail_ = 0L;
+  // Logical offsets of the tail. 'claimed_' is advanced before an append writes anything, and
+  // 'written_' once it is complete, so a concurrent reader that checks 'claimed_' after reading an
+  // entry finds out if it was being overwritten. Both count the padding skipped at the end of the
+  // buffer when the tail wraps, so that offsets map directly to buffer positions.
+  std::atomic<uint64_t> claimed_{0};
+  std::atomic<uint64_t> written_{0};
 };
 
 }
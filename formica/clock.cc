@@ -0,0 +1,66 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "clock.h"
+
+#include <ctime>
+#include <thread>
+
+namespace formica {
+
+static uint32_t SampleTime() {
+#if defined(CLOCK_REALTIME_COARSE)
+  struct timespec ts;
+  if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0) return ts.tv_sec;
+#endif
+  return time(nullptr);
+}
+
+std::atomic<uint32_t> CoarseClock::now_{SampleTime()};
+std::atomic<bool> CoarseClock::fixed_{false};
+
+void CoarseClock::Tick() {
+  if (fixed_.load(std::memory_order_relaxed)) return;
+  uint32_t now = SampleTime();
+  // Avoids dirtying the cache line, which every reader shares, more than once a second.
+  if (now != now_.load(std::memory_order_relaxed)) now_.store(now, std::memory_order_relaxed);
+}
+
+void CoarseClock::Set(uint32_t now) {
+  fixed_.store(now != 0, std::memory_order_relaxed);
+  if (now != 0) {
+    now_.store(now, std::memory_order_relaxed);
+  } else {
+    Tick();
+  }
+}
+
+static double MeasureNanosPerCycle() {
+#if defined(__x86_64__) || defined(__i386__)
+  auto start = std::chrono::steady_clock::now();
+  uint64_t start_cycles = CycleClock::Now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  uint64_t cycles = CycleClock::Now() - start_cycles;
+  double nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  return cycles == 0 ? 1.0 : nanos / cycles;
+#else
+  return 1.0;
+#endif
+}
+
+double CycleClock::NanosPerCycle() {
+  static const double nanos_per_cycle = MeasureNanosPerCycle();
+  return nanos_per_cycle;
+}
+
+}
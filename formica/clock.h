@@ -0,0 +1,70 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace formica {
+
+// A process-wide clock with a resolution of one second, for entry expiry. Now() is a relaxed load,
+// so it can be called on every read; the time is only sampled by Tick(). The batched paths
+// (FormicaStore::MultiRead() and MultiInsert(), and Dispatcher) call it once per batch, and the
+// unbatched writes (Insert() and Update() on FormicaStore and StdMapStore) once per write, which
+// costs a vDSO call. Unbatched reads don't, so a workload that only reads them should call Tick()
+// itself, e.g. once per request loop.
+//
+// Expiry is measured on this clock, so a TTL is only as accurate as the Tick()s are frequent.
+class CoarseClock {
+ public:
+  // Seconds since the epoch, as of the last Tick().
+  static uint32_t Now() { return now_.load(std::memory_order_relaxed); }
+
+  // Samples the system clock, using the kernel's coarse clock where there is one.
+  static void Tick();
+
+  // Fixes the time at 'now', for tests: Tick() leaves it alone until Set(0), which goes back to the
+  // system clock.
+  static void Set(uint32_t now);
+
+ private:
+  static std::atomic<uint32_t> now_;
+  static std::atomic<bool> fixed_;
+};
+
+// A clock for timing short operations: the CPU's timestamp counter where there is one, which takes
+// a few nanoseconds to read and doesn't enter the kernel, and otherwise std::chrono::steady_clock
+// in nanoseconds. Readings are only comparable on one machine, and are not serializing, so the CPU
+// may overlap them a little with the code being timed.
+class CycleClock {
+ public:
+  static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+  }
+
+  // How long a tick of Now() is. Measured against steady_clock on the first call, which takes
+  // about 10ms; later calls return the same value.
+  static double NanosPerCycle();
+};
+
+}
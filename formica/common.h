@@ -15,12 +15,13 @@
 #include <string>
 #include <unordered_map>
 
+#include "hash.h"
+
 namespace formica {
 
 typedef int64_t offset_t;
 typedef int32_t entrysize_t;
 typedef int64_t space_t;
-typedef size_t keyhash_t;
 typedef uint32_t tag_t;
 
 struct Entry {
@@ -29,8 +30,11 @@ struct Entry {
   const std::string value;
   const keyhash_t hash;
 
-  Entry(const std::string& key, const std::string& value) :
-      key(key), value(value), hash(std::hash<std::string>{}(key)) {
+  // 'Hash' is one of the policies in hash.h. Stores that recompute hashes from stored keys must be
+  // given the same policy.
+  template <typename Hash = DefaultHash>
+  Entry(const std::string& key, const std::string& value, Hash = Hash()) :
+      key(key), value(value), hash(Hash::Hash(key)) {
   }
 };
 
@@ -42,4 +46,39 @@ inline tag_t ExtractHashTag(keyhash_t hash) {
   return static_cast<tag_t>(0x00000000FFFFFFFF & (hash >> 32));
 }
 
+// The tag kept in a LossyHash entry. It's narrower than the log tag so that entries can be packed
+// into 64 bits; the log tag (and then the key) is checked when the entry is read. Never 0, which
+// marks an empty entry.
+inline uint16_t ExtractIndexTag(keyhash_t hash) {
+  uint16_t tag = static_cast<uint16_t>(hash >> 16);
+  return tag == 0 ? 1 : tag;
+}
+
+// Lengths in the log and in traces are encoded as varints: 7 bits per byte, low bits first, with
+// the top bit set on every byte but the last.
+constexpr int MAX_VARINT_SIZE = 5;
+
+inline int VarintSize(uint32_t v) {
+  int n = 1;
+  for (; v >= 0x80; v >>= 7) ++n;
+  return n;
+}
+
+inline int8_t* PutVarint(int8_t* ptr, uint32_t v) {
+  for (; v >= 0x80; v >>= 7) *ptr++ = static_cast<int8_t>(v | 0x80);
+  *ptr++ = static_cast<int8_t>(v);
+  return ptr;
+}
+
+// Returns nullptr if the varint doesn't end within MAX_VARINT_SIZE bytes, or before 'end'.
+inline const int8_t* GetVarint(const int8_t* ptr, const int8_t* end, uint32_t* v) {
+  *v = 0;
+  for (int shift = 0; shift < 7 * MAX_VARINT_SIZE && ptr < end; shift += 7) {
+    uint8_t byte = *ptr++;
+    *v |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return ptr;
+  }
+  return nullptr;
+}
+
 }
@@ -0,0 +1,171 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "compression.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace formica {
+
+// The shortest match that is encoded, and the constraints that LZ4's format puts on the end of a
+// block: the last LAST_LITERALS bytes are always literals, and no match starts in the last
+// MATCH_LIMIT bytes.
+static constexpr int MIN_MATCH = 4;
+static constexpr int LAST_LITERALS = 5;
+static constexpr int MATCH_LIMIT = 12;
+static constexpr int MAX_OFFSET = 65535;
+
+// Up to 4096 positions are remembered, fewer for short inputs, so that the table costs little to
+// clear.
+static constexpr int MAX_HASH_BITS = 12;
+
+static inline uint32_t Read32(const char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline int HashOf(uint32_t v, int bits) {
+  return (v * 2654435761U) >> (32 - bits);
+}
+
+// Lengths that don't fit in a token's 4 bits continue in bytes of 255, ending with one that is less.
+static inline char* PutLength(char* op, int len) {
+  for (; len >= 255; len -= 255) *op++ = static_cast<char>(255);
+  *op++ = static_cast<char>(len);
+  return op;
+}
+
+// The most that a sequence with 'literals' literals and a match can take up.
+static inline int SequenceBound(int literals, int match_len) {
+  return 1 + literals / 255 + 1 + literals + 2 + match_len / 255 + 1;
+}
+
+int Compress(const char* src, int len, char* dst, int capacity) {
+  const char* anchor = src;
+  const char* const end = src + len;
+  char* op = dst;
+  char* const op_end = dst + capacity;
+
+  if (len > MATCH_LIMIT) {
+    int bits = MAX_HASH_BITS;
+    while (bits > 6 && (1 << (bits - 2)) > len) --bits;
+    int32_t table[1 << MAX_HASH_BITS];
+    std::fill_n(table, 1 << bits, -1);
+
+    const char* ip = src;
+    const char* const match_limit = end - MATCH_LIMIT;
+    while (ip < match_limit) {
+      uint32_t seq = Read32(ip);
+      int h = HashOf(seq, bits);
+      int32_t candidate = table[h];
+      table[h] = ip - src;
+      if (candidate < 0 || (ip - src) - candidate > MAX_OFFSET || Read32(src + candidate) != seq) {
+        // Step further the longer it's been since the last match, so that incompressible input is
+        // given up on quickly.
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+
+      const char* match = src + candidate;
+      while (ip > anchor && match > src && ip[-1] == match[-1]) {
+        --ip;
+        --match;
+      }
+      const char* match_end = ip + MIN_MATCH;
+      const char* const last = end - LAST_LITERALS;
+      for (const char* m = match + MIN_MATCH; match_end < last && *match_end == *m; ++m) {
+        ++match_end;
+      }
+
+      int literals = ip - anchor;
+      int match_len = match_end - ip - MIN_MATCH;
+      if (SequenceBound(literals, match_len) > op_end - op) return 0;
+      char* token = op++;
+      *token = static_cast<char>((std::min(literals, 15) << 4) | std::min(match_len, 15));
+      if (literals >= 15) op = PutLength(op, literals - 15);
+      memcpy(op, anchor, literals);
+      op += literals;
+      int offset = ip - match;
+      *op++ = static_cast<char>(offset & 0xff);
+      *op++ = static_cast<char>(offset >> 8);
+      if (match_len >= 15) op = PutLength(op, match_len - 15);
+
+      // Remember a position near the end of the match, which is cheap and finds runs.
+      table[HashOf(Read32(match_end - 2), bits)] = match_end - 2 - src;
+      ip = anchor = match_end;
+    }
+  }
+
+  int literals = end - anchor;
+  if (SequenceBound(literals, 0) - 3 > op_end - op) return 0;
+  *op++ = static_cast<char>(std::min(literals, 15) << 4);
+  if (literals >= 15) op = PutLength(op, literals - 15);
+  memcpy(op, anchor, literals);
+  op += literals;
+  return op - dst;
+}
+
+// Adds the continuation bytes of a length to 'len'. Returns false if they run off the end.
+static inline bool GetLength(const uint8_t** ip, const uint8_t* ip_end, size_t* len) {
+  while (true) {
+    if (*ip == ip_end) return false;
+    uint8_t b = *(*ip)++;
+    *len += b;
+    if (b != 255) return true;
+  }
+}
+
+bool Decompress(const char* src, int len, char* dst, int raw_len) {
+  const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+  const uint8_t* const ip_end = ip + len;
+  char* op = dst;
+  char* const op_end = dst + raw_len;
+
+  while (ip < ip_end) {
+    uint8_t token = *ip++;
+    size_t literals = token >> 4;
+    if (literals == 15 && !GetLength(&ip, ip_end, &literals)) return false;
+    if (literals > static_cast<size_t>(ip_end - ip) || literals > static_cast<size_t>(op_end - op)) {
+      return false;
+    }
+    memcpy(op, ip, literals);
+    op += literals;
+    ip += literals;
+
+    // The last sequence has no match.
+    if (ip == ip_end) break;
+
+    if (ip_end - ip < 2) return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > static_cast<size_t>(op - dst)) return false;
+    size_t match_len = token & 15;
+    if (match_len == 15 && !GetLength(&ip, ip_end, &match_len)) return false;
+    match_len += MIN_MATCH;
+    if (match_len > static_cast<size_t>(op_end - op)) return false;
+
+    const char* match = op - offset;
+    if (offset >= match_len) {
+      memcpy(op, match, match_len);
+    } else {
+      // The match overlaps what it is producing, i.e. repeats the last 'offset' bytes.
+      for (size_t i = 0; i < match_len; ++i) op[i] = match[i];
+    }
+    op += match_len;
+  }
+  return op == op_end;
+}
+
+}
@@ -0,0 +1,31 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+namespace formica {
+
+// A small LZ77 compressor for values, using LZ4's block format: a sequence of (literals, match)
+// pairs, where each match copies at least 4 bytes from up to 64KB earlier in the output. It finds
+// matches with a single-probe hash table, so compresses quickly rather than well, and decompresses
+// with little more than memcpy().
+
+// Compresses the 'len' bytes at 'src' into at most 'capacity' bytes at 'dst'. Returns the
+// compressed size, or 0 if it wouldn't fit.
+int Compress(const char* src, int len, char* dst, int capacity);
+
+// Decompresses the 'len' bytes at 'src', which must decompress to exactly 'raw_len' bytes, into
+// 'dst'. Returns false if they don't. Never reads or writes out of bounds, even if 'src' is garbage,
+// so it is safe to call on bytes that may be overwritten concurrently.
+bool Decompress(const char* src, int len, char* dst, int raw_len);
+
+}
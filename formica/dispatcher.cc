@@ -0,0 +1,108 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "dispatcher.h"
+
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
+namespace formica {
+
+Dispatcher::Dispatcher(PartitionedStore* store, int num_clients, uint32_t ring_size,
+    const std::vector<int>& cpus) : store_(store), num_clients_(num_clients),
+    num_partitions_(store->num_partitions()) {
+  for (int i = 0; i < num_clients_ * num_partitions_; ++i) {
+    submissions_.emplace_back(new SpscRing<DispatchRequest>(ring_size));
+    completions_.emplace_back(new SpscRing<Completion>(ring_size));
+  }
+
+  for (int p = 0; p < num_partitions_; ++p) {
+    threads_.emplace_back([this, p]() { RunPartition(p); });
+#if defined(__linux__)
+    if (p < cpus.size()) {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(cpus[p], &cpu_set);
+      // Not being pinned only costs performance.
+      pthread_setaffinity_np(threads_.back().native_handle(), sizeof(cpu_set), &cpu_set);
+    }
+#endif
+  }
+}
+
+Dispatcher::~Dispatcher() {
+  stopping_.store(true, std::memory_order_relaxed);
+  for (auto& thread: threads_) thread.join();
+}
+
+bool Dispatcher::Submit(int client, const DispatchRequest& request) {
+  int partition = store_->PartitionFor(request.hash);
+  return submissions_[RingIndex(client, partition)]->TryPush(request);
+}
+
+int Dispatcher::Poll(int client, Completion* completions, int max) {
+  int n = 0;
+  for (int p = 0; p < num_partitions_ && n < max; ++p) {
+    n += completions_[RingIndex(client, p)]->PopBatch(completions + n, max - n);
+  }
+  return n;
+}
+
+void Dispatcher::RunPartition(int partition) {
+  FormicaStore* store = store_->partition(partition);
+  DispatchRequest requests[BATCH_SIZE];
+  Completion completions[BATCH_SIZE];
+  while (!stopping_.load(std::memory_order_relaxed)) {
+    bool idle = true;
+    for (int c = 0; c < num_clients_; ++c) {
+      SpscRing<Completion>* completion_ring = completions_[RingIndex(c, partition)].get();
+      // Only take as many requests as can be completed, so that this thread never waits for a
+      // client.
+      uint32_t room = completion_ring->Writable(BATCH_SIZE);
+      int n = submissions_[RingIndex(c, partition)]->PopBatch(requests, room);
+      if (n == 0) continue;
+      idle = false;
+      Process(store, requests, n, completions);
+      completion_ring->PushBatch(completions, n);
+    }
+    if (idle) std::this_thread::yield();
+  }
+}
+
+void Dispatcher::Process(FormicaStore* store, const DispatchRequest* requests, int n,
+    Completion* completions) {
+  // MultiRead() also does this, but a batch may be all PUTs.
+  CoarseClock::Tick();
+  ReadRequest reads[BATCH_SIZE];
+  int i = 0;
+  while (i < n) {
+    if (requests[i].type == DispatchRequest::Type::PUT) {
+      completions[i] = {requests[i].cookie,
+          store->Insert(*requests[i].entry, requests[i].ttl_seconds)};
+      ++i;
+      continue;
+    }
+
+    // Batch up the run of GETs that starts here.
+    int start = i;
+    for (; i < n && requests[i].type == DispatchRequest::Type::GET; ++i) {
+      reads[i - start] = {requests[i].key, requests[i].hash, requests[i].value, false};
+    }
+    store->MultiRead(reads, i - start);
+    for (int j = start; j < i; ++j) completions[j] = {requests[j].cookie, reads[j - start].found};
+  }
+}
+
+}
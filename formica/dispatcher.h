@@ -0,0 +1,109 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "partitioned-store.h"
+#include "spsc-ring.h"
+
+namespace formica {
+
+// A request to a Dispatcher. Everything it points to is owned by the client, and must stay valid
+// until the request's Completion has been polled.
+struct DispatchRequest {
+  enum class Type : uint8_t { GET, PUT };
+  Type type;
+
+  // For PUTs. A 'ttl_seconds' of 0 means the entry doesn't expire.
+  const Entry* entry;
+  uint32_t ttl_seconds;
+
+  // For GETs. The value is written to 'value' by the partition's thread.
+  const std::string* key;
+  keyhash_t hash;
+  std::string* value;
+
+  // Returned in the Completion, so that the client can match it to the request.
+  uint64_t cookie;
+
+  static DispatchRequest Get(const std::string* key, keyhash_t hash, std::string* value,
+      uint64_t cookie) {
+    return {Type::GET, nullptr, 0, key, hash, value, cookie};
+  }
+
+  static DispatchRequest Put(const Entry* entry, uint64_t cookie, uint32_t ttl_seconds = 0) {
+    return {Type::PUT, entry, ttl_seconds, &entry->key, entry->hash, nullptr, cookie};
+  }
+};
+
+struct Completion {
+  uint64_t cookie;
+  // Whether a GET found its key, or a PUT was inserted.
+  bool ok;
+};
+
+// Runs one thread per partition of a PartitionedStore, and lets any number of client threads send
+// them requests without taking locks, so that each partition's index and log are only ever touched
+// by its own thread (MICA's EREW access pattern).
+//
+// Every (client, partition) pair has a submission ring and a completion ring. A client's requests
+// are routed to the partition that owns their hash, and each partition thread takes requests from
+// its rings in batches of up to BATCH_SIZE. Runs of GETs in a batch are done with MultiRead().
+// Requests from one client to one partition complete in the order they were submitted.
+class Dispatcher {
+ public:
+  // 'store' must not be used by anything else while the dispatcher exists. Client ids are
+  // [0, num_clients), and each must only be used by one thread at a time. If 'cpus' is not empty,
+  // the thread for partition i is pinned to cpus[i].
+  Dispatcher(PartitionedStore* store, int num_clients, uint32_t ring_size = 1024,
+      const std::vector<int>& cpus = {});
+
+  // Stops the partition threads. Requests that haven't completed by then are dropped.
+  ~Dispatcher();
+
+  // Returns false, without blocking, if the ring to the request's partition is full. The client
+  // should then Poll() for completions before trying again.
+  bool Submit(int client, const DispatchRequest& request);
+
+  // Collects up to 'max' completions for 'client', from all partitions, into 'completions'.
+  // Returns how many were collected.
+  int Poll(int client, Completion* completions, int max);
+
+  static constexpr int BATCH_SIZE = 32;
+
+ private:
+  void RunPartition(int partition);
+
+  // Does a batch of requests on 'store' in order, filling in a completion for each.
+  void Process(FormicaStore* store, const DispatchRequest* requests, int n,
+      Completion* completions);
+
+  int RingIndex(int client, int partition) const { return client * num_partitions_ + partition; }
+
+  PartitionedStore* const store_;
+  const int num_clients_;
+  const int num_partitions_;
+
+  // Indexed by RingIndex().
+  std::vector<std::unique_ptr<SpscRing<DispatchRequest>>> submissions_;
+  std::vector<std::unique_ptr<SpscRing<Completion>>> completions_;
+
+  std::atomic<bool> stopping_{false};
+  std::vector<std::thread> threads_;
+};
+
+}
@@ -10,10 +10,20 @@
 // or implied.  See the License for the specific language governing permissions and limitations
 // under the License.
 
+#include "allocation-counter.h"
+#include "dispatcher.h"
+#include "latency-histogram.h"
+#include "perf-counters.h"
+#include "partitioned-store.h"
 #include "store.h"
+#include "trace.h"
+#include "workload.h"
 
 #include "benchmark/benchmark.h"
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <random>
 
 using std::cout;
 using std::endl;
@@ -25,6 +35,19 @@ using formica::Entry;
 using formica::StdMapStore;
 using formica::FormicaStore;
 using formica::ChainedLossyHashStore;
+using formica::bucket_count_t;
+using formica::space_t;
+using formica::PartitionedStore;
+using formica::Completion;
+using formica::DispatchRequest;
+using formica::Dispatcher;
+using formica::LatencyHistogram;
+using formica::PerfCounters;
+using formica::Operation;
+using formica::OpType;
+using formica::Workload;
+using formica::TraceOp;
+using formica::TraceOperation;
 
 string RandomString(int l) {
   string ret(l, 'a');
@@ -52,54 +75,512 @@ static vector<Entry> INITIAL_ENTRIES = RandomStrings(NUM_ENTRIES, KEY_SIZE, VALU
 
 static constexpr int64_t LOG_SIZE_BYTES = 1024 * 1024 * (KEY_SIZE + VALUE_SIZE + 100) * 2;
 
+// A FormicaStore whose log and index are allocated on huge pages, if the machine has any.
+class HugePageFormicaStore : public FormicaStore {
+ public:
+  HugePageFormicaStore(space_t size, bucket_count_t num_buckets)
+      : FormicaStore(size, num_buckets, HugePages()) { }
+
+ private:
+  static formica::MemoryOptions HugePages() {
+    formica::MemoryOptions options;
+    options.huge_pages = true;
+    return options;
+  }
+};
+
+// A FormicaStore in lossless STORE mode.
+class StoreModeFormicaStore : public FormicaStore {
+ public:
+  StoreModeFormicaStore(space_t size, bucket_count_t num_buckets)
+      : FormicaStore(size, num_buckets, formica::StoreMode::STORE) { }
+};
+
+// A FormicaStore that keeps small values in its index buckets.
+class InlineFormicaStore : public FormicaStore {
+ public:
+  InlineFormicaStore(space_t size, bucket_count_t num_buckets) : FormicaStore(size, num_buckets) {
+    EnableInlineValues();
+  }
+};
+
+// A FormicaStore and a StdMapStore with a FrontCache of the default size.
+class FrontCachedFormicaStore : public FormicaStore {
+ public:
+  FrontCachedFormicaStore(space_t size, bucket_count_t num_buckets)
+      : FormicaStore(size, num_buckets) {
+    EnableFrontCache();
+  }
+};
+
+class FrontCachedStdMapStore : public StdMapStore {
+ public:
+  FrontCachedStdMapStore(space_t size, bucket_count_t num_buckets)
+      : StdMapStore(size, num_buckets) {
+    EnableFrontCache();
+  }
+};
+
+// A StdMapStore whose log is cleaned by a background thread, rather than by the writes that run out
+// of room.
+class BackgroundCleanedStdMapStore : public StdMapStore {
+ public:
+  BackgroundCleanedStdMapStore(space_t size, bucket_count_t num_buckets)
+      : StdMapStore(size, num_buckets) {
+    StartCleaner();
+  }
+};
+
+// Reports which kind of pages a store got, for stores that allocate with MemoryOptions. 0 is normal
+// pages, 1 transparent huge pages and 2 explicit huge pages.
+template <typename T>
+void ReportPageKind(benchmark::State& state, const T& store) { }
+
+void ReportPageKind(benchmark::State& state, const HugePageFormicaStore& store) {
+  state.counters["Log page kind"] = static_cast<int>(store.log_region().page_kind);
+  state.counters["Index page kind"] = static_cast<int>(store.index_region().page_kind);
+}
+
+// Reports how much cleaning a StdMapStore did.
+template <typename T>
+void ReportCleaning(benchmark::State& state, T& store) { }
+
+void ReportCleaning(benchmark::State& state, StdMapStore& store) {
+  state.counters["Segments cleaned"] = store.segments_cleaned();
+  state.counters["MB relocated"] = store.bytes_relocated() / (1024 * 1024);
+}
+
+void ReportCleaning(benchmark::State& state, BackgroundCleanedStdMapStore& store) {
+  ReportCleaning(state, static_cast<StdMapStore&>(store));
+}
+
+// Reports how full the store's index got, and how many live entries it had to evict, which is
+// what to look at when choosing a bucket count.
+template <typename T>
+void ReportIndexStats(benchmark::State& state, T& store) {
+  formica::StatsSnapshot stats = store.stats();
+  state.counters["Evictions"] = stats[formica::Stat::EVICTIONS];
+  if (stats[formica::Stat::INDEX_CAPACITY] > 0) {
+    state.counters["Index fill"] = static_cast<double>(stats[formica::Stat::INDEX_ENTRIES]) /
+        stats[formica::Stat::INDEX_CAPACITY];
+  }
+}
+
+// Reports the store's memory per live key: in all, and for its index and log, from MemoryUsage();
+// and the heap that the counting allocator saw the store take since 'heap_before', to check
+// MemoryUsage()'s estimates for the stores that live on the heap.
+template <typename T>
+void ReportMemory(benchmark::State& state, T& store, int64_t heap_before) {
+  int64_t live_keys = store.stats()[formica::Stat::INDEX_ENTRIES];
+  if (live_keys == 0) return;
+  formica::MemoryFootprint usage = store.MemoryUsage();
+  state.counters["Bytes/key"] = static_cast<double>(usage.total_bytes()) / live_keys;
+  state.counters["Index bytes/key"] = static_cast<double>(usage.index_bytes) / live_keys;
+  state.counters["Log bytes/key"] = static_cast<double>(usage.log_bytes) / live_keys;
+  state.counters["Heap bytes/key"] =
+      static_cast<double>(formica::AllocatedBytes() - heap_before) / live_keys;
+}
+
+// ChainedLossyHashStore has no Update(), but inserting a key again replaces its value.
+template <typename T>
+void UpdateEntry(T& store, const Entry& entry) { store.Update(entry); }
+
+void UpdateEntry(ChainedLossyHashStore& store, const Entry& entry) { store.Insert(entry); }
+
+// Nor does it have Delete(), so deletes miss.
+template <typename T>
+bool DeleteEntry(T& store, const Entry& entry) { return store.Delete(entry.key, entry.hash); }
+
+bool DeleteEntry(ChainedLossyHashStore& store, const Entry& entry) { return false; }
+
+// The trace in the file named by $FORMICA_TRACE (see trace.h), loaded on first use. Empty if the
+// variable isn't set or the file can't be read.
+const vector<TraceOperation>& ReplayTrace() {
+  static const vector<TraceOperation> ops = []() {
+    vector<TraceOperation> ops;
+    const char* path = getenv("FORMICA_TRACE");
+    if (path == nullptr) return ops;
+    cout << "Loading trace from " << path << endl;
+    if (!formica::LoadTrace(path, &ops)) {
+      cout << "Could not read all of " << path << "; replaying the " << ops.size()
+           << " operations before the error" << endl;
+    }
+    return ops;
+  }();
+  return ops;
+}
+
+// The entry for key number 'idx' of a Workload: the INITIAL_ENTRIES that stores are warmed up
+// with, then the ENTRIES that the workload inserts, wrapping around if they run out.
+const Entry& WorkloadEntry(uint32_t idx) {
+  if (idx < INITIAL_ENTRIES.size()) return INITIAL_ENTRIES[idx];
+  return ENTRIES[(idx - INITIAL_ENTRIES.size()) % ENTRIES.size()];
+}
+
+// The workload for state.range(1)% PUTs, and the rest GETs, with uniformly chosen keys. PUTs are
+// updates of existing keys if 'update' is set, and inserts of new ones otherwise.
+formica::WorkloadSpec MixedWorkload(benchmark::State& state, bool update) {
+  formica::WorkloadSpec spec;
+  spec.read = 1 - state.range(1) / 100.0;
+  (update ? spec.update : spec.insert) = state.range(1) / 100.0;
+  return spec;
+}
+
+// The benchmarks time one in this many operations of each kind, which is enough for a p999 from a
+// few seconds' run, while keeping the clock reads off most operations.
+static constexpr int LATENCY_SAMPLE_INTERVAL = 8;
+
+// Reports the p50, p90, p99, p999 and max of 'histogram' in nanoseconds, as counters named after
+// 'op', if it timed anything.
+void ReportLatency(benchmark::State& state, const string& op, const LatencyHistogram& histogram) {
+  if (histogram.count() == 0) return;
+  double nanos_per_cycle = formica::CycleClock::NanosPerCycle();
+  const pair<const char*, double> percentiles[] = {
+      {"p50", 50}, {"p90", 90}, {"p99", 99}, {"p999", 99.9}};
+  for (const auto& p: percentiles) {
+    state.counters[op + " " + p.first + " (ns)"] = histogram.Percentile(p.second) * nanos_per_cycle;
+  }
+  state.counters[op + " max (ns)"] = histogram.max() * nanos_per_cycle;
+}
+
+// Reports each event that 'counters' counted, per operation of 'num_ops'. If none could be
+// counted, says so in the label instead, so that the results are still comparable by time.
+void ReportPerfCounters(benchmark::State& state, const PerfCounters& counters, int64_t num_ops) {
+  if (!counters.available()) {
+    state.SetLabel("no perf counters");
+    return;
+  }
+  if (num_ops == 0) return;
+  for (int i = 0; i < PerfCounters::NUM_EVENTS; ++i) {
+    auto event = static_cast<PerfCounters::Event>(i);
+    if (!counters.available(event)) continue;
+    state.counters[PerfCounters::Name(event) + " /op"] =
+        static_cast<double>(counters.Read(event)) / num_ops;
+  }
+}
+
 template<typename T>
 class StoreBMFixture : public benchmark::Fixture {
  public:
   // Benchmark a workload with some mixture of GETs and PUTs. The store is warmed up with puts from
   // INITIAL_ENTRIES, and then the benchmark performs NUM_OPS operations. PUTs come from ENTRIES
   // (and wrap around if exhausted), and GETs come from either INITIAL_ENTRIES, or the already
-  // written keys from ENTRIES.
+  // written keys from ENTRIES. The operations are drawn before the timed loop.
   void DoMixedWorkloadBenchmark(benchmark::State& state) {
-    srand(0);
+    constexpr int NUM_OPS = 10 * 1024 * 1024;
+    const vector<Operation> ops =
+        Workload(MixedWorkload(state, false), INITIAL_ENTRIES.size()).Generate(NUM_OPS);
+    int64_t heap_before = formica::AllocatedBytes();
     T store(LOG_SIZE_BYTES, state.range(0));
 
-    constexpr int NUM_OPS = 10 * 1024 * 1024;
     // Warm up the index:
     for (const auto& e: INITIAL_ENTRIES) {
       store.Insert(e);
     }
 
-    int put_cursor = 0;
+    int put_counter = 0;
     int get_counter = 0;
     int misses = 0;
+    string value;
+    LatencyHistogram get_latency(LATENCY_SAMPLE_INTERVAL), put_latency(LATENCY_SAMPLE_INTERVAL);
+    // With a put ratio of 0, the counts per operation are per GET.
+    PerfCounters perf_counters;
+    perf_counters.Start();
     for (auto _: state) {
-      for (int i = 0; i < NUM_OPS; ++i) {
-        // State.range(2) == chance out of 100 that we do a PUT
-        if (rand() % 100 < state.range(1)) {
-          // Do PUT
-          store.Insert(ENTRIES[(put_cursor++) % ENTRIES.size()]);
+      for (const Operation& op: ops) {
+        const Entry& e = WorkloadEntry(op.key);
+        if (op.type == OpType::INSERT) {
+          uint64_t start = put_latency.Begin();
+          store.Insert(e);
+          put_latency.End(start);
+          ++put_counter;
         } else {
-          // Do GET
-          int get_store = rand() % INITIAL_ENTRIES.size();
-          const Entry& e = INITIAL_ENTRIES[get_store];
-          string value;
-          if (!store.Read(e.key, e.hash, &value)) {
+          uint64_t start = get_latency.Begin();
+          bool found = store.Read(e.key, e.hash, &value);
+          get_latency.End(start);
+          if (!found) {
             ++misses;
           }
           ++get_counter;
         }
       }
     }
+    perf_counters.Stop();
 
     state.counters["GETS"] = get_counter;
-    // state.counters["PUTS"] = put_cursor;
     state.counters["Num misses"] = misses;
-    state.counters["Total ops"] = get_counter + put_cursor;
+    state.counters["Total ops"] = get_counter + put_counter;
     state.counters["Overwritten"] = store.log_overwritten();
     state.counters["Index misses"] = store.index_misses();
     // state.counters["Other key"] = store.log_other_key();
     state.counters["Ops. /s"] =
-        benchmark::Counter(get_counter + put_cursor,  benchmark::Counter::kIsRate);
+        benchmark::Counter(get_counter + put_counter,  benchmark::Counter::kIsRate);
+    ReportLatency(state, "GET", get_latency);
+    ReportLatency(state, "PUT", put_latency);
+    ReportPerfCounters(state, perf_counters, get_counter + put_counter);
+    ReportIndexStats(state, store);
+    ReportMemory(state, store, heap_before);
+    ReportPageKind(state, store);
+    ReportCleaning(state, store);
+  }
+
+  // As DoMixedWorkloadBenchmark(), but PUTs overwrite the value of a random key from
+  // INITIAL_ENTRIES with Update(), rather than inserting new keys.
+  void DoUpdateWorkloadBenchmark(benchmark::State& state) {
+    constexpr int NUM_OPS = 10 * 1024 * 1024;
+    const vector<Operation> ops =
+        Workload(MixedWorkload(state, true), INITIAL_ENTRIES.size()).Generate(NUM_OPS);
+    int64_t heap_before = formica::AllocatedBytes();
+    T store(LOG_SIZE_BYTES, state.range(0));
+
+    for (const auto& e: INITIAL_ENTRIES) {
+      store.Insert(e);
+    }
+
+    int put_counter = 0;
+    int get_counter = 0;
+    int misses = 0;
+    string value;
+    LatencyHistogram get_latency(LATENCY_SAMPLE_INTERVAL), put_latency(LATENCY_SAMPLE_INTERVAL);
+    for (auto _: state) {
+      for (const Operation& op: ops) {
+        const Entry& e = INITIAL_ENTRIES[op.key];
+        if (op.type == OpType::UPDATE) {
+          uint64_t start = put_latency.Begin();
+          bool updated = store.Update(e);
+          put_latency.End(start);
+          if (!updated) ++misses;
+          ++put_counter;
+        } else {
+          uint64_t start = get_latency.Begin();
+          bool found = store.Read(e.key, e.hash, &value);
+          get_latency.End(start);
+          if (!found) ++misses;
+          ++get_counter;
+        }
+      }
+    }
+
+    state.counters["GETS"] = get_counter;
+    state.counters["Num misses"] = misses;
+    state.counters["Total ops"] = get_counter + put_counter;
+    state.counters["Overwritten"] = store.log_overwritten();
+    state.counters["Index misses"] = store.index_misses();
+    state.counters["Ops. /s"] =
+        benchmark::Counter(get_counter + put_counter,  benchmark::Counter::kIsRate);
+    ReportLatency(state, "GET", get_latency);
+    ReportLatency(state, "PUT", put_latency);
+    ReportMemory(state, store, heap_before);
+    ReportCleaning(state, store);
+  }
+
+  // As DoMixedWorkloadBenchmark(), but GETs and PUTs are queued up and issued through MultiRead()
+  // and MultiInsert() in batches of state.range(2).
+  void DoBatchedMixedWorkloadBenchmark(benchmark::State& state) {
+    T store(LOG_SIZE_BYTES, state.range(0));
+
+    constexpr int NUM_OPS = 10 * 1024 * 1024;
+    const vector<Operation> ops =
+        Workload(MixedWorkload(state, false), INITIAL_ENTRIES.size()).Generate(NUM_OPS);
+    for (const auto& e: INITIAL_ENTRIES) {
+      store.Insert(e);
+    }
+
+    int batch_size = state.range(2);
+    vector<formica::ReadRequest> gets(batch_size);
+    vector<string> values(batch_size);
+    vector<const Entry*> puts(batch_size);
+    int num_gets = 0;
+    int num_puts = 0;
+
+    int put_counter = 0;
+    int get_counter = 0;
+    int misses = 0;
+    for (auto _: state) {
+      for (const Operation& op: ops) {
+        const Entry& e = WorkloadEntry(op.key);
+        if (op.type == OpType::INSERT) {
+          puts[num_puts++] = &e;
+          ++put_counter;
+          if (num_puts == batch_size) {
+            store.MultiInsert(puts.data(), num_puts);
+            num_puts = 0;
+          }
+        } else {
+          gets[num_gets] = {&e.key, e.hash, &values[num_gets], false};
+          ++num_gets;
+          if (num_gets == batch_size) {
+            store.MultiRead(gets.data(), num_gets);
+            for (int j = 0; j < num_gets; ++j) misses += !gets[j].found;
+            num_gets = 0;
+          }
+          ++get_counter;
+        }
+      }
+      store.MultiInsert(puts.data(), num_puts);
+      store.MultiRead(gets.data(), num_gets);
+      for (int j = 0; j < num_gets; ++j) misses += !gets[j].found;
+      num_puts = num_gets = 0;
+    }
+
+    state.counters["GETS"] = get_counter;
+    state.counters["Num misses"] = misses;
+    state.counters["Total ops"] = get_counter + put_counter;
+    state.counters["Overwritten"] = store.log_overwritten();
+    state.counters["Index misses"] = store.index_misses();
+    state.counters["Ops. /s"] =
+        benchmark::Counter(get_counter + put_counter,  benchmark::Counter::kIsRate);
+  }
+
+  // Runs YCSB workload 'A' + state.range(1) (see WorkloadSpec::Ycsb()) on a store warmed up with
+  // INITIAL_ENTRIES. None of the stores is ordered, so a SCAN reads its keys one at a time, in the
+  // order that they were inserted, and is timed as a whole. A read-modify-write is timed as a GET
+  // and a PUT.
+  void DoYcsbWorkloadBenchmark(benchmark::State& state) {
+    constexpr int NUM_OPS = 1024 * 1024;
+    char name = 'A' + state.range(1);
+    state.SetLabel(string("YCSB-") + name);
+    const vector<Operation> ops =
+        Workload(formica::WorkloadSpec::Ycsb(name), INITIAL_ENTRIES.size()).Generate(NUM_OPS);
+    int64_t heap_before = formica::AllocatedBytes();
+    T store(LOG_SIZE_BYTES, state.range(0));
+
+    for (const auto& e: INITIAL_ENTRIES) {
+      store.Insert(e);
+    }
+
+    int64_t reads = 0;
+    int64_t writes = 0;
+    int misses = 0;
+    string value;
+    LatencyHistogram get_latency(LATENCY_SAMPLE_INTERVAL), put_latency(LATENCY_SAMPLE_INTERVAL),
+        scan_latency(LATENCY_SAMPLE_INTERVAL);
+    for (auto _: state) {
+      for (const Operation& op: ops) {
+        const Entry& e = WorkloadEntry(op.key);
+        uint64_t start;
+        switch (op.type) {
+          case OpType::READ:
+            start = get_latency.Begin();
+            misses += !store.Read(e.key, e.hash, &value);
+            get_latency.End(start);
+            ++reads;
+            break;
+          case OpType::UPDATE:
+          case OpType::INSERT:
+            start = put_latency.Begin();
+            if (op.type == OpType::UPDATE) {
+              UpdateEntry(store, e);
+            } else {
+              store.Insert(e);
+            }
+            put_latency.End(start);
+            ++writes;
+            break;
+          case OpType::SCAN:
+            start = scan_latency.Begin();
+            for (uint32_t key = op.key; key < op.key + op.scan_length; ++key) {
+              const Entry& scanned = WorkloadEntry(key);
+              misses += !store.Read(scanned.key, scanned.hash, &value);
+            }
+            scan_latency.End(start);
+            reads += op.scan_length;
+            break;
+          case OpType::READ_MODIFY_WRITE:
+            start = get_latency.Begin();
+            misses += !store.Read(e.key, e.hash, &value);
+            get_latency.End(start);
+            start = put_latency.Begin();
+            UpdateEntry(store, e);
+            put_latency.End(start);
+            ++reads;
+            ++writes;
+            break;
+        }
+      }
+    }
+
+    state.counters["Reads"] = reads;
+    state.counters["Writes"] = writes;
+    state.counters["Num misses"] = misses;
+    state.counters["Index misses"] = store.index_misses();
+    state.counters["Ops. /s"] =
+        benchmark::Counter(ops.size() * state.iterations(), benchmark::Counter::kIsRate);
+    ReportLatency(state, "GET", get_latency);
+    ReportLatency(state, "PUT", put_latency);
+    ReportLatency(state, "SCAN", scan_latency);
+    ReportMemory(state, store, heap_before);
+  }
+
+  // Replays ReplayTrace() against an empty store, so that hit rates are the trace's own. If
+  // state.range(1) is 1, the trace is first replayed once untimed, to measure a warm store instead.
+  void DoTraceReplayBenchmark(benchmark::State& state) {
+    const vector<TraceOperation>& ops = ReplayTrace();
+    if (ops.empty()) {
+      state.SkipWithError("Set FORMICA_TRACE to a trace file to replay");
+      return;
+    }
+    int64_t heap_before = formica::AllocatedBytes();
+    T store(LOG_SIZE_BYTES, state.range(0));
+
+    int64_t counts[4] = {};
+    int64_t get_hits = 0;
+    int64_t write_failures = 0;
+    string value;
+    LatencyHistogram get_latency(LATENCY_SAMPLE_INTERVAL), put_latency(LATENCY_SAMPLE_INTERVAL);
+    auto replay = [&]() {
+      for (const TraceOperation& op: ops) {
+        const Entry& e = op.entry;
+        uint64_t start;
+        switch (op.op) {
+          case TraceOp::GET:
+            start = get_latency.Begin();
+            get_hits += store.Read(e.key, e.hash, &value);
+            get_latency.End(start);
+            break;
+          case TraceOp::PUT:
+            start = put_latency.Begin();
+            store.Insert(e);
+            put_latency.End(start);
+            break;
+          case TraceOp::UPDATE:
+            start = put_latency.Begin();
+            UpdateEntry(store, e);
+            put_latency.End(start);
+            break;
+          case TraceOp::DELETE:
+            write_failures += !DeleteEntry(store, e);
+            break;
+        }
+        ++counts[static_cast<int>(op.op)];
+      }
+    };
+    if (state.range(1) == 1) {
+      replay();
+      get_latency.Reset();
+      put_latency.Reset();
+    }
+    counts[0] = counts[1] = counts[2] = counts[3] = get_hits = write_failures = 0;
+
+    for (auto _: state) {
+      replay();
+    }
+
+    state.counters["GETS"] = counts[static_cast<int>(TraceOp::GET)];
+    state.counters["PUTS"] = counts[static_cast<int>(TraceOp::PUT)];
+    state.counters["UPDATES"] = counts[static_cast<int>(TraceOp::UPDATE)];
+    state.counters["DELETES"] = counts[static_cast<int>(TraceOp::DELETE)];
+    state.counters["Deletes missed"] = write_failures;
+    if (counts[static_cast<int>(TraceOp::GET)] > 0) {
+      state.counters["Hit rate"] =
+          static_cast<double>(get_hits) / counts[static_cast<int>(TraceOp::GET)];
+    }
+    state.counters["Ops. /s"] =
+        benchmark::Counter(ops.size() * state.iterations(), benchmark::Counter::kIsRate);
+    ReportLatency(state, "GET", get_latency);
+    ReportLatency(state, "PUT", put_latency);
+    ReportIndexStats(state, store);
+    ReportMemory(state, store, heap_before);
   }
 };
 
@@ -107,10 +588,34 @@ BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, FormicaStoreMixedWorkloadThroughput,
   DoMixedWorkloadBenchmark(state);
 }
 
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, FormicaStoreBatchedWorkloadThroughput, FormicaStore)(benchmark::State& state) {
+  DoBatchedMixedWorkloadBenchmark(state);
+}
+
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, HugePageFormicaStoreMixedWorkloadThroughput, HugePageFormicaStore)(benchmark::State& state) {
+  DoMixedWorkloadBenchmark(state);
+}
+
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, StoreModeFormicaStoreMixedWorkloadThroughput, StoreModeFormicaStore)(benchmark::State& state) {
+  DoMixedWorkloadBenchmark(state);
+}
+
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, FormicaStoreUpdateWorkloadThroughput, FormicaStore)(benchmark::State& state) {
+  DoUpdateWorkloadBenchmark(state);
+}
+
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, StdMapStoreUpdateWorkloadThroughput, StdMapStore)(benchmark::State& state) {
+  DoUpdateWorkloadBenchmark(state);
+}
+
 BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, StdMapStoreMixedWorkloadThroughput, StdMapStore)(benchmark::State& state) {
   DoMixedWorkloadBenchmark(state);
 }
 
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, BackgroundCleanedStdMapStoreUpdateWorkloadThroughput, BackgroundCleanedStdMapStore)(benchmark::State& state) {
+  DoUpdateWorkloadBenchmark(state);
+}
+
 BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, ChainedLossyHashStoreMixedWorkloadThroughput, ChainedLossyHashStore)(benchmark::State& state) {
   DoMixedWorkloadBenchmark(state);
 }
@@ -125,6 +630,14 @@ BENCHMARK_REGISTER_F(StoreBMFixture, StdMapStoreMixedWorkloadThroughput)->Thread
 BENCHMARK_REGISTER_F(StoreBMFixture, ChainedLossyHashStoreMixedWorkloadThroughput)->Threads(1)->
     Args({NUM_BUCKETS, 5})->Unit(benchmark::kMillisecond);
 
+// Compare FormicaStore on huge pages with the default, with 5% PUTS
+BENCHMARK_REGISTER_F(StoreBMFixture, HugePageFormicaStoreMixedWorkloadThroughput)->
+    Args({NUM_BUCKETS, 5})->Unit(benchmark::kMillisecond);
+
+// Compare FormicaStore in lossless STORE mode with the default, with 5% PUTS
+BENCHMARK_REGISTER_F(StoreBMFixture, StoreModeFormicaStoreMixedWorkloadThroughput)->
+    Args({NUM_BUCKETS, 5})->Unit(benchmark::kMillisecond);
+
 // Benchmark each store with 50% PUTS
 BENCHMARK_REGISTER_F(StoreBMFixture, FormicaStoreMixedWorkloadThroughput)->
     Args({NUM_BUCKETS, 50})->Unit(benchmark::kMillisecond);
@@ -133,4 +646,442 @@ BENCHMARK_REGISTER_F(StoreBMFixture, StdMapStoreMixedWorkloadThroughput)->
 BENCHMARK_REGISTER_F(StoreBMFixture, ChainedLossyHashStoreMixedWorkloadThroughput)->
     Args({NUM_BUCKETS, 50})->Unit(benchmark::kMillisecond);
 
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, FormicaStoreYcsbThroughput, FormicaStore)(benchmark::State& state) {
+  DoYcsbWorkloadBenchmark(state);
+}
+
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, StdMapStoreYcsbThroughput, StdMapStore)(benchmark::State& state) {
+  DoYcsbWorkloadBenchmark(state);
+}
+
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, ChainedLossyHashStoreYcsbThroughput, ChainedLossyHashStore)(benchmark::State& state) {
+  DoYcsbWorkloadBenchmark(state);
+}
+
+// Benchmark each store with YCSB workloads A to F
+BENCHMARK_REGISTER_F(StoreBMFixture, FormicaStoreYcsbThroughput)->
+    ArgsProduct({{NUM_BUCKETS}, {0, 1, 2, 3, 4, 5}})->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(StoreBMFixture, StdMapStoreYcsbThroughput)->
+    ArgsProduct({{NUM_BUCKETS}, {0, 1, 2, 3, 4, 5}})->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(StoreBMFixture, ChainedLossyHashStoreYcsbThroughput)->
+    ArgsProduct({{NUM_BUCKETS}, {0, 1, 2, 3, 4, 5}})->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, FormicaStoreTraceReplay, FormicaStore)(benchmark::State& state) {
+  DoTraceReplayBenchmark(state);
+}
+
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, StdMapStoreTraceReplay, StdMapStore)(benchmark::State& state) {
+  DoTraceReplayBenchmark(state);
+}
+
+BENCHMARK_TEMPLATE_DEFINE_F(StoreBMFixture, ChainedLossyHashStoreTraceReplay, ChainedLossyHashStore)(benchmark::State& state) {
+  DoTraceReplayBenchmark(state);
+}
+
+// Replay $FORMICA_TRACE against each store, cold and then warm. Each run is a single replay, so
+// that a cold store stays cold.
+BENCHMARK_REGISTER_F(StoreBMFixture, FormicaStoreTraceReplay)->
+    ArgsProduct({{NUM_BUCKETS}, {0, 1}})->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(StoreBMFixture, StdMapStoreTraceReplay)->
+    ArgsProduct({{NUM_BUCKETS}, {0, 1}})->Iterations(1)->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(StoreBMFixture, ChainedLossyHashStoreTraceReplay)->
+    ArgsProduct({{NUM_BUCKETS}, {0, 1}})->Iterations(1)->Unit(benchmark::kMillisecond);
+
+// Benchmarks a PartitionedStore with one partition per benchmark thread. Each thread only writes
+// keys in its own partition. If 'local_reads' is true, it also only reads its own keys (MICA's EREW
+// access pattern); otherwise it reads keys from every partition (CREW).
+class PartitionedStoreBMFixture : public benchmark::Fixture {
+ public:
+  void DoPartitionedWorkloadBenchmark(benchmark::State& state, bool local_reads) {
+    int num_partitions = state.threads();
+    if (state.thread_index() == 0) {
+      // All threads wait for each other at the start of the timed loop, so they'll see this.
+      store_.reset(new PartitionedStore(num_partitions, LOG_SIZE_BYTES / num_partitions,
+          state.range(0) / num_partitions));
+      owned_initial_.assign(num_partitions, {});
+      owned_entries_.assign(num_partitions, {});
+      for (const auto& e: INITIAL_ENTRIES) {
+        store_->Insert(e);
+        owned_initial_[store_->PartitionFor(e.hash)].push_back(&e);
+      }
+      for (const auto& e: ENTRIES) owned_entries_[store_->PartitionFor(e.hash)].push_back(&e);
+    }
+
+    // rand() takes a lock, so each thread has its own generator.
+    std::minstd_rand rng(state.thread_index());
+    constexpr int NUM_OPS = 1024 * 1024;
+    int put_cursor = 0;
+    int get_counter = 0;
+    int misses = 0;
+    for (auto _: state) {
+      const vector<const Entry*>& puts = owned_entries_[state.thread_index()];
+      const vector<const Entry*>& gets = owned_initial_[state.thread_index()];
+      for (int i = 0; i < NUM_OPS; ++i) {
+        if (rng() % 100 < state.range(1)) {
+          store_->Insert(*puts[(put_cursor++) % puts.size()]);
+        } else {
+          const Entry& e = local_reads ? *gets[rng() % gets.size()] :
+              INITIAL_ENTRIES[rng() % INITIAL_ENTRIES.size()];
+          string value;
+          if (!store_->Read(e.key, e.hash, &value)) ++misses;
+          ++get_counter;
+        }
+      }
+    }
+
+    state.counters["GETS"] = get_counter;
+    state.counters["Num misses"] = misses;
+    state.counters["Total ops"] = get_counter + put_cursor;
+    state.counters["Ops. /s"] =
+        benchmark::Counter(get_counter + put_cursor,  benchmark::Counter::kIsRate);
+  }
+
+ private:
+  static std::unique_ptr<PartitionedStore> store_;
+  static vector<vector<const Entry*>> owned_initial_;
+  static vector<vector<const Entry*>> owned_entries_;
+};
+
+std::unique_ptr<PartitionedStore> PartitionedStoreBMFixture::store_;
+vector<vector<const Entry*>> PartitionedStoreBMFixture::owned_initial_;
+vector<vector<const Entry*>> PartitionedStoreBMFixture::owned_entries_;
+
+BENCHMARK_DEFINE_F(PartitionedStoreBMFixture, EREWPartitionedWorkloadThroughput)(benchmark::State& state) {
+  DoPartitionedWorkloadBenchmark(state, true);
+}
+
+BENCHMARK_DEFINE_F(PartitionedStoreBMFixture, CREWPartitionedWorkloadThroughput)(benchmark::State& state) {
+  DoPartitionedWorkloadBenchmark(state, false);
+}
+
+// Benchmarks a Dispatcher in front of a PartitionedStore with state.range(2) partitions, with one
+// client per benchmark thread. Clients send requests for any partition, and each keeps up to
+// PIPELINE_DEPTH of them in flight.
+class DispatcherBMFixture : public benchmark::Fixture {
+ public:
+  void DoDispatcherWorkloadBenchmark(benchmark::State& state) {
+    int num_partitions = state.range(2);
+    if (state.thread_index() == 0) {
+      store_.reset(new PartitionedStore(num_partitions, LOG_SIZE_BYTES / num_partitions,
+          state.range(0) / num_partitions));
+      for (const auto& e: INITIAL_ENTRIES) store_->Insert(e);
+      clients_done_ = 0;
+      dispatcher_.reset(new Dispatcher(store_.get(), state.threads()));
+    }
+
+    constexpr int NUM_OPS = 1024 * 1024;
+    constexpr int PIPELINE_DEPTH = 64;
+    std::minstd_rand rng(state.thread_index());
+    // Each request in flight uses one of PIPELINE_DEPTH slots, which is its cookie.
+    vector<string> values(PIPELINE_DEPTH);
+    vector<bool> is_get(PIPELINE_DEPTH);
+    vector<int> free_slots;
+    for (int i = 0; i < PIPELINE_DEPTH; ++i) free_slots.push_back(i);
+    Completion completions[PIPELINE_DEPTH];
+
+    int put_cursor = state.thread_index() * (ENTRIES.size() / state.threads());
+    int get_counter = 0;
+    int put_counter = 0;
+    int misses = 0;
+    for (auto _: state) {
+      int submitted = 0;
+      int completed = 0;
+      while (completed < NUM_OPS) {
+        if (submitted < NUM_OPS && !free_slots.empty()) {
+          int slot = free_slots.back();
+          is_get[slot] = rng() % 100 >= state.range(1);
+          const Entry& e = is_get[slot] ? INITIAL_ENTRIES[rng() % INITIAL_ENTRIES.size()] :
+              ENTRIES[(put_cursor++) % ENTRIES.size()];
+          DispatchRequest request = is_get[slot] ?
+              DispatchRequest::Get(&e.key, e.hash, &values[slot], slot) :
+              DispatchRequest::Put(&e, slot);
+          if (dispatcher_->Submit(state.thread_index(), request)) {
+            free_slots.pop_back();
+            ++submitted;
+            continue;
+          }
+        }
+
+        int n = dispatcher_->Poll(state.thread_index(), completions, PIPELINE_DEPTH);
+        for (int i = 0; i < n; ++i) {
+          int slot = completions[i].cookie;
+          if (is_get[slot]) {
+            ++get_counter;
+            misses += !completions[i].ok;
+          } else {
+            ++put_counter;
+          }
+          free_slots.push_back(slot);
+        }
+        completed += n;
+      }
+    }
+
+    // The partition threads spin until the dispatcher is destroyed, so don't leave it running into
+    // the next benchmark.
+    ++clients_done_;
+    if (state.thread_index() == 0) {
+      while (clients_done_ < state.threads()) std::this_thread::yield();
+      dispatcher_.reset();
+      store_.reset();
+    }
+
+    state.counters["GETS"] = get_counter;
+    state.counters["Num misses"] = misses;
+    state.counters["Total ops"] = get_counter + put_counter;
+    state.counters["Ops. /s"] =
+        benchmark::Counter(get_counter + put_counter,  benchmark::Counter::kIsRate);
+  }
+
+ private:
+  static std::unique_ptr<PartitionedStore> store_;
+  static std::unique_ptr<Dispatcher> dispatcher_;
+  static std::atomic<int> clients_done_;
+};
+
+std::unique_ptr<PartitionedStore> DispatcherBMFixture::store_;
+std::unique_ptr<Dispatcher> DispatcherBMFixture::dispatcher_;
+std::atomic<int> DispatcherBMFixture::clients_done_;
+
+BENCHMARK_DEFINE_F(DispatcherBMFixture, DispatcherWorkloadThroughput)(benchmark::State& state) {
+  DoDispatcherWorkloadBenchmark(state);
+}
+
+// Benchmark overwriting existing keys with 50% PUTS
+BENCHMARK_REGISTER_F(StoreBMFixture, FormicaStoreUpdateWorkloadThroughput)->
+    Args({NUM_BUCKETS, 50})->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(StoreBMFixture, StdMapStoreUpdateWorkloadThroughput)->
+    Args({NUM_BUCKETS, 50})->Unit(benchmark::kMillisecond);
+// The log fills up with overwritten values, so the cleaner runs, on the writing thread or in the
+// background.
+BENCHMARK_REGISTER_F(StoreBMFixture, BackgroundCleanedStdMapStoreUpdateWorkloadThroughput)->
+    Args({NUM_BUCKETS, 50})->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Benchmark batched GETs and PUTs with 5% PUTS, for a range of batch sizes.
+BENCHMARK_REGISTER_F(StoreBMFixture, FormicaStoreBatchedWorkloadThroughput)->
+    Args({NUM_BUCKETS, 5, 1})->Args({NUM_BUCKETS, 5, 4})->Args({NUM_BUCKETS, 5, 8})->
+    Args({NUM_BUCKETS, 5, 16})->Args({NUM_BUCKETS, 5, 32})->Unit(benchmark::kMillisecond);
+
+// Benchmark partitioned stores with 5% PUTS, scaling the number of cores.
+BENCHMARK_REGISTER_F(PartitionedStoreBMFixture, EREWPartitionedWorkloadThroughput)->
+    ThreadRange(1, 8)->Args({NUM_BUCKETS, 5})->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(PartitionedStoreBMFixture, CREWPartitionedWorkloadThroughput)->
+    ThreadRange(1, 8)->Args({NUM_BUCKETS, 5})->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Benchmark clients on several threads sending requests through a Dispatcher to 2 and 4 partitions,
+// with 5% PUTS.
+BENCHMARK_REGISTER_F(DispatcherBMFixture, DispatcherWorkloadThroughput)->ThreadRange(1, 4)->
+    Args({NUM_BUCKETS, 5, 2})->Args({NUM_BUCKETS, 5, 4})->UseRealTime()->
+    Unit(benchmark::kMillisecond);
+
+// Measures the throughput of a hash policy over keys of state.range(0) bytes. At the 64-byte keys
+// used above, hashing is a noticeable share of each GET.
+template <typename Hash>
+void HashThroughput(benchmark::State& state) {
+  vector<string> keys;
+  for (int i = 0; i < 1024; ++i) keys.push_back(RandomString(state.range(0)));
+  for (auto _: state) {
+    for (const auto& key: keys) benchmark::DoNotOptimize(Hash::Hash(key));
+  }
+  state.SetBytesProcessed(state.iterations() * keys.size() * state.range(0));
+  state.counters["Hashes /s"] =
+      benchmark::Counter(state.iterations() * keys.size(), benchmark::Counter::kIsRate);
+}
+
+BENCHMARK_TEMPLATE(HashThroughput, formica::StdHash)->RangeMultiplier(4)->Range(8, 1024);
+BENCHMARK_TEMPLATE(HashThroughput, formica::WyHash)->RangeMultiplier(4)->Range(8, 1024);
+BENCHMARK_TEMPLATE(HashThroughput, formica::Crc32cHash)->RangeMultiplier(4)->Range(8, 1024);
+
+// Measures what counting costs on every GET: the READS that each one adds, on state.threads()
+// threads. state.range(0) picks the counter: 0 is Stats::Add(), 1 is a release fetch_add() on a
+// cache line per thread, and 2 is a fetch_add() on a single counter that every thread shares.
+void StatsAddThroughput(benchmark::State& state) {
+  struct alignas(64) Line { std::atomic<int64_t> value{0}; };
+  static formica::Stats stats;
+  static Line lines[64];
+  static std::atomic<int64_t> shared{0};
+  constexpr int NUM_OPS = 1024 * 1024;
+  for (auto _: state) {
+    for (int i = 0; i < NUM_OPS; ++i) {
+      if (state.range(0) == 0) {
+        stats.Add(formica::Stat::READS);
+      } else if (state.range(0) == 1) {
+        lines[state.thread_index()].value.fetch_add(1, std::memory_order_release);
+      } else {
+        shared.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+  state.counters["Adds /s"] = benchmark::Counter(state.iterations() * NUM_OPS,
+      benchmark::Counter::kIsRate);
+}
+
+BENCHMARK(StatsAddThroughput)->DenseRange(0, 2)->ThreadRange(1, 8)->UseRealTime()->
+    Unit(benchmark::kMillisecond);
+
+// JSON-like values of about 1KB, which compress about 3x: a user record with a list of orders,
+// whose field names repeat, and whose values come from small vocabularies.
+vector<Entry> JsonEntries(int n) {
+  static const char* WORDS[] = {"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf",
+      "hotel", "india", "juliet", "kilo", "lima"};
+  static const char* STATUSES[] = {"pending", "shipped", "delivered", "returned"};
+  std::minstd_rand rng(0);
+  vector<Entry> ret;
+  for (int i = 0; i < n; ++i) {
+    string value = "{\"id\": " + std::to_string(rng()) + ", \"name\": \"" + WORDS[rng() % 12] +
+        " " + WORDS[rng() % 12] + "\", \"email\": \"" + WORDS[rng() % 12] +
+        std::to_string(rng() % 1000) + "@example.com\", \"active\": " +
+        (rng() % 2 ? "true" : "false") + ", \"orders\": [";
+    for (int o = 0; o < 8; ++o) {
+      value += string("{\"sku\": \"") + WORDS[rng() % 12] + "-" + std::to_string(rng() % 100) +
+          "\", \"quantity\": " + std::to_string(1 + rng() % 5) + ", \"price_cents\": " +
+          std::to_string(rng() % 10000) + ", \"status\": \"" + STATUSES[rng() % 4] +
+          "\", \"gift\": false}, ";
+    }
+    value += "{}]}";
+    ret.push_back(Entry("user:" + std::to_string(i), value));
+  }
+  return ret;
+}
+
+// Compares a FormicaStore with and without compressed values (state.range(0) is 1 for
+// compression), on a workload whose values don't all fit in the log uncompressed. Reports the
+// number of keys that are still readable once every entry has been inserted, and the throughput of
+// 5% PUTs and 95% GETs over all of the keys.
+void CompressedStoreThroughput(benchmark::State& state) {
+  static const vector<Entry> entries = JsonEntries(128 * 1024);
+  constexpr space_t LOG_SIZE = 32 * 1024 * 1024;
+  FormicaStore store(LOG_SIZE, NUM_BUCKETS);
+  store.set_compression(state.range(0) != 0);
+
+  space_t raw_bytes = 0;
+  for (const auto& e: entries) {
+    store.Insert(e);
+    raw_bytes += e.key.size() + e.value.size();
+  }
+  int live_keys = 0;
+  string value;
+  for (const auto& e: entries) live_keys += store.Read(e.key, e.hash, &value);
+
+  std::minstd_rand rng(0);
+  constexpr int NUM_OPS = 1024 * 1024;
+  int misses = 0;
+  int64_t ops = 0;
+  for (auto _: state) {
+    for (int i = 0; i < NUM_OPS; ++i) {
+      const Entry& e = entries[rng() % entries.size()];
+      if (rng() % 100 < 5) {
+        store.Insert(e);
+      } else {
+        misses += !store.Read(e.key, e.hash, &value);
+      }
+    }
+    ops += NUM_OPS;
+  }
+
+  state.counters["Live keys"] = live_keys;
+  state.counters["Log bytes per key"] = static_cast<double>(LOG_SIZE) / live_keys;
+  state.counters["Raw bytes per key"] = static_cast<double>(raw_bytes) / entries.size();
+  state.counters["Num misses"] = misses;
+  state.counters["Ops. /s"] = benchmark::Counter(ops, benchmark::Counter::kIsRate);
+}
+
+BENCHMARK(CompressedStoreThroughput)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// Counter-like entries: 12-byte keys with 8-byte values, which InlineFormicaStore keeps in its
+// index buckets.
+vector<Entry> SmallEntries(int n) {
+  std::minstd_rand rng(0);
+  vector<Entry> ret;
+  for (int i = 0; i < n; ++i) {
+    string value(8, '\0');
+    for (auto& c: value) c = rng();
+    ret.push_back(Entry(RandomString(12), value));
+  }
+  return ret;
+}
+
+// Measures state.range(0)% PUTs and the rest GETs of random keys, on a workload of small values
+// that all fit in the store.
+template <typename T>
+void SmallValueThroughput(benchmark::State& state) {
+  static const vector<Entry> entries = SmallEntries(NUM_ENTRIES / 4);
+  T store(LOG_SIZE_BYTES / 8, NUM_BUCKETS);
+  for (const auto& e: entries) store.Insert(e);
+
+  std::minstd_rand rng(0);
+  constexpr int NUM_OPS = 10 * 1024 * 1024;
+  string value;
+  int misses = 0;
+  int64_t ops = 0;
+  for (auto _: state) {
+    for (int i = 0; i < NUM_OPS; ++i) {
+      const Entry& e = entries[rng() % entries.size()];
+      if (rng() % 100 < state.range(0)) {
+        store.Insert(e);
+      } else {
+        misses += !store.Read(e.key, e.hash, &value);
+      }
+    }
+    ops += NUM_OPS;
+  }
+
+  state.counters["Num misses"] = misses;
+  state.counters["Index misses"] = store.index_misses();
+  state.counters["Ops. /s"] = benchmark::Counter(ops, benchmark::Counter::kIsRate);
+}
+
+BENCHMARK_TEMPLATE(SmallValueThroughput, FormicaStore)->Arg(5)->Arg(50)->
+    Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(SmallValueThroughput, InlineFormicaStore)->Arg(5)->Arg(50)->
+    Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(SmallValueThroughput, StdMapStore)->Arg(5)->Arg(50)->
+    Unit(benchmark::kMillisecond);
+
+// Measures state.range(0)% PUTs and the rest GETs, of keys from INITIAL_ENTRIES drawn from a
+// Zipfian distribution with theta = 0.99, as in YCSB. PUTs update the key with its own value,
+// so that they invalidate any front cache without changing what GETs should return.
+template <typename T>
+void SkewedReadThroughput(benchmark::State& state) {
+  formica::WorkloadSpec spec;
+  spec.read = 1 - state.range(0) / 100.0;
+  spec.update = state.range(0) / 100.0;
+  spec.distribution = formica::KeyDistribution::ZIPFIAN;
+  constexpr int NUM_OPS = 10 * 1024 * 1024;
+  const vector<Operation> ops = Workload(spec, INITIAL_ENTRIES.size()).Generate(NUM_OPS);
+  T store(LOG_SIZE_BYTES, NUM_BUCKETS);
+  for (const auto& e: INITIAL_ENTRIES) store.Insert(e);
+
+  string value;
+  int misses = 0;
+  int64_t num_ops = 0;
+  for (auto _: state) {
+    for (const Operation& op: ops) {
+      const Entry& e = INITIAL_ENTRIES[op.key];
+      if (op.type == OpType::UPDATE) {
+        store.Update(e);
+      } else {
+        misses += !store.Read(e.key, e.hash, &value);
+      }
+    }
+    num_ops += ops.size();
+  }
+
+  state.counters["Num misses"] = misses;
+  state.counters["Index misses"] = store.index_misses();
+  int64_t front_reads = store.front_cache_hits() + store.front_cache_misses();
+  if (front_reads > 0) {
+    state.counters["Front cache hit rate"] =
+        static_cast<double>(store.front_cache_hits()) / front_reads;
+  }
+  state.counters["Ops. /s"] = benchmark::Counter(num_ops, benchmark::Counter::kIsRate);
+}
+
+BENCHMARK_TEMPLATE(SkewedReadThroughput, FormicaStore)->Arg(0)->Arg(5)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(SkewedReadThroughput, FrontCachedFormicaStore)->Arg(0)->Arg(5)->
+    Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(SkewedReadThroughput, StdMapStore)->Arg(5)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(SkewedReadThroughput, FrontCachedStdMapStore)->Arg(5)->
+    Unit(benchmark::kMillisecond);
+
 BENCHMARK_MAIN();
@@ -10,17 +10,100 @@
 // or implied.  See the License for the specific language governing permissions and limitations
 // under the License.
 
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+#include "compression.h"
+#include "dispatcher.h"
+#include "latency-histogram.h"
+#include "partitioned-store.h"
+#include "perf-counters.h"
+#include "stats.h"
+#include "trace.h"
 #include "store.h"
+#include "workload.h"
 #include "gtest/gtest.h"
 
 using std::string;
 using std::hash;
+using std::thread;
+using std::to_string;
+using std::vector;
 using formica::CircularLog;
 using formica::Entry;
 using formica::StdMapStore;
 using formica::LossyHash;
+using formica::MemoryFootprint;
 using formica::FormicaStore;
+using formica::FrontCache;
 using formica::offset_t;
+using formica::space_t;
+using formica::PartitionedStore;
+using formica::StoreMode;
+using formica::Completion;
+using formica::DispatchRequest;
+using formica::Dispatcher;
+using formica::SpscRing;
+using formica::Crc32cHash;
+using formica::WyHash;
+using formica::CoarseClock;
+using formica::KeyDistribution;
+using formica::LatencyHistogram;
+using formica::CycleClock;
+using formica::PerfCounters;
+using formica::ChainedLossyHashStore;
+using formica::Stat;
+using formica::Stats;
+using formica::StatsSnapshot;
+using formica::TraceOp;
+using formica::TraceOperation;
+using formica::TraceReader;
+using formica::TraceRecord;
+using formica::TraceWriter;
+using formica::TracingStore;
+using formica::Operation;
+using formica::OpType;
+using formica::Workload;
+using formica::WorkloadSpec;
+using formica::ZipfianGenerator;
+
+// Checks that 'hash' gives distinct values, in both halves, for keys of every length up to 100.
+template <typename Hash>
+void CheckHashPolicy() {
+  std::unordered_set<uint64_t> hashes;
+  std::unordered_set<uint32_t> low_halves, high_halves;
+  for (int i = 0; i < 10000; ++i) {
+    string key = string(i % 100, 'k') + to_string(i);
+    formica::keyhash_t h = Hash::Hash(key);
+    ASSERT_EQ(h, Entry(key, "", Hash()).hash);
+    hashes.insert(h);
+    low_halves.insert(formica::ExtractLogTag(h));
+    high_halves.insert(formica::ExtractHashTag(h));
+  }
+  ASSERT_EQ(10000, hashes.size());
+  // Allow a handful of 32-bit collisions.
+  ASSERT_GT(low_halves.size(), 9990);
+  ASSERT_GT(high_halves.size(), 9990);
+  ASSERT_NE(Hash::Hash(""), Hash::Hash(string(1, '\0')));
+}
+
+TEST(Hash, WyHash) {
+  CheckHashPolicy<WyHash>();
+}
+
+TEST(Hash, Crc32cHash) {
+  CheckHashPolicy<Crc32cHash>();
+  for (int len = 0; len < 100; ++len) {
+    string key(len, 'c');
+    for (int i = 0; i < len; ++i) key[i] += i;
+    ASSERT_EQ(Crc32cHash::HashPortable(key), Crc32cHash::Hash(key)) << len;
+  }
+}
 
 TEST(CircularLog, SmokeTest) {
   CircularLog log(1024 * 1024);
@@ -58,6 +141,36 @@ TEST(CircularLog, Wrapped) {
   ASSERT_EQ("WORLD", value);
 }
 
+// Entries are aligned, and rather than wrap around the end of the buffer, the rest of it is skipped.
+TEST(CircularLog, Padding) {
+  CircularLog log(100);
+  ASSERT_EQ(96, log.size());
+  Entry small("k", "v");
+  ASSERT_EQ(16, CircularLog::SpaceFor(small.key, small.value));
+
+  vector<offset_t> offsets;
+  for (int i = 0; i < 3; ++i) {
+    Entry entry("key" + to_string(i), string(20, 'v'));
+    offsets.push_back(log.Insert(entry.key, entry.value, entry.hash));
+    ASSERT_EQ(0, offsets.back() % CircularLog::ENTRY_ALIGNMENT);
+  }
+  // The third entry doesn't fit in the 32 bytes left, so it starts the next lap.
+  ASSERT_EQ(96, offsets[2]);
+
+  CircularLog::ScannedEntry scanned;
+  ASSERT_TRUE(log.ScanEntry(offsets[1], &scanned));
+  ASSERT_FALSE(scanned.deleted);
+  ASSERT_TRUE(log.ScanEntry(scanned.next, &scanned)) << "Scans the padding";
+  ASSERT_TRUE(scanned.deleted);
+  ASSERT_EQ(0, scanned.key.size());
+  ASSERT_EQ(offsets[2], scanned.next);
+
+  string key, value;
+  Entry third("key2", string(20, 'v'));
+  ASSERT_TRUE(log.ReadFrom(offsets[2], third.hash, &key, &value));
+  ASSERT_EQ(third.value, value);
+}
+
 TEST(CircularLog, Update) {
   CircularLog log(256);
 
@@ -75,7 +188,11 @@ TEST(CircularLog, Update) {
   offset_t newoffset = log.Update(offset, shorter.key, shorter.value, shorter.hash);
   ASSERT_EQ(offset, newoffset) << "Update with shorter string should have been in-place";
 
+  // Growing back to the original size still fits in the entry's padding.
   newoffset = log.Update(offset, hello.key, hello.value, hello.hash);
+  ASSERT_EQ(offset, newoffset);
+  Entry longer("hello", "world, again");
+  newoffset = log.Update(offset, longer.key, longer.value, longer.hash);
   ASSERT_LT(0, newoffset) << "Update with longer string should have been an append";
 
   // Check that updating hasn't screwed up the write cursor.
@@ -87,6 +204,116 @@ TEST(CircularLog, Update) {
   ASSERT_EQ("tuesday", value);
 }
 
+TEST(CircularLog, Expiry) {
+  CircularLog log(1024);
+  Entry entry("hello", "world");
+  uint32_t now = CoarseClock::Now();
+  offset_t expired = log.Insert(entry.key, entry.value, entry.hash, now);
+  offset_t live = log.Insert(entry.key, entry.value, entry.hash, now + 1000);
+  offset_t forever = log.Insert(entry.key, entry.value, entry.hash);
+
+  string key, value;
+  ASSERT_FALSE(log.ReadFrom(expired, entry.hash, &key, &value));
+  ASSERT_TRUE(log.IsExpired(expired));
+  ASSERT_TRUE(log.ReadFrom(live, entry.hash, &key, &value));
+  ASSERT_FALSE(log.IsExpired(live));
+  ASSERT_TRUE(log.ReadFrom(forever, entry.hash, &key, &value));
+
+  // An in-place update replaces the expiry.
+  ASSERT_EQ(expired, log.Update(expired, entry.key, "w", entry.hash));
+  ASSERT_TRUE(log.ReadFrom(expired, entry.hash, &key, &value));
+  ASSERT_EQ("w", value);
+}
+
+// Incompressible bytes, from a linear congruential generator.
+string RandomBytes(int n) {
+  string ret(n, '\0');
+  uint32_t x = 1;
+  for (int i = 0; i < n; ++i) {
+    x = x * 1103515245 + 12345;
+    ret[i] = x >> 24;
+  }
+  return ret;
+}
+
+TEST(Compression, RoundTrip) {
+  string json;
+  for (int i = 0; i < 100; ++i) {
+    json += "{\"id\": " + to_string(i * 7919) + ", \"name\": \"user" + to_string(i) +
+        "\", \"active\": true},";
+  }
+  string random = RandomBytes(5000);
+  vector<string> inputs = {"", "a", "hello", string(13, 'x'), string(100000, 'y'), json, random,
+      json + random + json};
+
+  for (const string& input: inputs) {
+    string compressed(input.size() + input.size() / 255 + 16, '\0');
+    int len = formica::Compress(input.data(), input.size(), &compressed[0], compressed.size());
+    ASSERT_LT(0, len) << input.size();
+    string output(input.size(), '\0');
+    ASSERT_TRUE(formica::Decompress(compressed.data(), len, &output[0], output.size()));
+    ASSERT_EQ(input, output);
+
+    // A buffer that's too small is reported, rather than overrun.
+    if (len > 1) {
+      ASSERT_EQ(0, formica::Compress(input.data(), input.size(), &compressed[0], len - 1));
+    }
+  }
+
+  string compressed(json.size(), '\0');
+  int len = formica::Compress(json.data(), json.size(), &compressed[0], compressed.size());
+  ASSERT_LT(len * 3, json.size()) << "Repetitive input should compress well";
+}
+
+TEST(Compression, GarbageInput) {
+  string input(2000, 'a');
+  for (int i = 0; i < input.size(); i += 7) input[i] = 'b' + i % 5;
+  string compressed(input.size(), '\0');
+  int len = formica::Compress(input.data(), input.size(), &compressed[0], compressed.size());
+  ASSERT_LT(0, len);
+
+  // Whatever the damage, decompression must stay in bounds, and fail if the size is wrong.
+  string output(input.size(), '\0');
+  ASSERT_FALSE(formica::Decompress(compressed.data(), len - 1, &output[0], output.size()));
+  ASSERT_FALSE(formica::Decompress(compressed.data(), len, &output[0], output.size() - 1));
+  for (int i = 0; i < len; ++i) {
+    string damaged = compressed.substr(0, len);
+    damaged[i] ^= 0x5a;
+    formica::Decompress(damaged.data(), len, &output[0], output.size());
+  }
+}
+
+TEST(CircularLog, Compression) {
+  CircularLog log(64 * 1024);
+  log.set_compression(true);
+  string random = RandomBytes(1000);
+  Entry compressible("hello", string(1000, 'w'));
+  Entry incompressible("goodbye", random);
+  Entry small("small", "world");
+
+  offset_t first = log.Insert(compressible.key, compressible.value, compressible.hash);
+  ASSERT_GT(100, log.tail()) << "Value should have been compressed";
+  offset_t second = log.Insert(incompressible.key, incompressible.value, incompressible.hash);
+  offset_t third = log.Insert(small.key, small.value, small.hash);
+
+  for (auto& e: vector<std::pair<offset_t, Entry*>>{{first, &compressible},
+      {second, &incompressible}, {third, &small}}) {
+    string key, value;
+    ASSERT_TRUE(log.ReadFrom(e.first, e.second->hash, &key, &value));
+    ASSERT_EQ(e.second->key, key);
+    ASSERT_EQ(e.second->value, value);
+  }
+
+  // Moving a compressed entry keeps it compressed.
+  offset_t tail = log.tail();
+  offset_t moved = log.Move(first);
+  ASSERT_EQ(tail, moved);
+  ASSERT_EQ(log.SpaceAt(first), log.SpaceAt(moved));
+  string key, value;
+  ASSERT_TRUE(log.ReadFrom(moved, compressible.hash, &key, &value));
+  ASSERT_EQ(compressible.value, value);
+}
+
 TEST(CircularLog, WorkloadTest) {
   CircularLog log(1024 * 1024 * 256);
 
@@ -101,6 +328,43 @@ TEST(CircularLog, WorkloadTest) {
   }
 }
 
+TEST(CircularLog, FileBacked) {
+  string path = testing::TempDir() + "formica-test-log";
+  std::remove(path.c_str());
+  Entry entry("hello", "world");
+  offset_t offset;
+  {
+    CircularLog log(path, 4096);
+    ASSERT_FALSE(log.recovered());
+    offset = log.Insert(entry.key, entry.value, entry.hash);
+    ASSERT_TRUE(log.Sync());
+  }
+
+  {
+    CircularLog log(path, 4096);
+    ASSERT_TRUE(log.recovered());
+    ASSERT_LT(offset, log.tail());
+    string key, value;
+    ASSERT_TRUE(log.ReadFrom(offset, entry.hash, &key, &value));
+    ASSERT_EQ("world", value);
+
+    vector<offset_t> starts = log.ScanStarts();
+    ASSERT_EQ(1, starts.size());
+    CircularLog::ScannedEntry scanned;
+    ASSERT_TRUE(log.ScanEntry(starts[0], &scanned));
+    ASSERT_TRUE(scanned.key.Equals("hello"));
+    ASSERT_EQ(log.tail(), scanned.next);
+  }
+
+  // A log of a different size isn't recovered.
+  {
+    CircularLog log(path, 8192);
+    ASSERT_FALSE(log.recovered());
+    ASSERT_EQ(0, log.tail());
+  }
+  std::remove(path.c_str());
+}
+
 TEST(StdMapStore, ReadAndWrite) {
   StdMapStore idx(1024);
   Entry entry("hello", "world");
@@ -114,13 +378,264 @@ TEST(StdMapStore, ReadAndWrite) {
   ASSERT_FALSE(idx.Read(entry.key, 0, &value));
 }
 
+TEST(SegmentedLog, Liveness) {
+  formica::SegmentedLog log(4 * 1024, 1024);
+  ASSERT_EQ(4, log.num_segments());
+  Entry entry("hello", string(300, 'w'));
+  space_t space = formica::SegmentedLog::SpaceFor(entry.key, entry.value);
+
+  // Three entries fit in each segment.
+  vector<offset_t> offsets;
+  for (int i = 0; i < 6; ++i) offsets.push_back(log.Append(entry.key, entry.value, entry.hash));
+  ASSERT_EQ(2, log.free_segments());
+  ASSERT_EQ(1024, offsets[3]);
+  ASSERT_EQ(6 * space, log.live_bytes());
+
+  // The second segment is still open, so only the first can be cleaned, once it has dead space.
+  ASSERT_EQ(-1, log.PickVictim());
+  log.Append(entry.key, entry.value, entry.hash);
+  ASSERT_EQ(-1, log.PickVictim());
+  log.MarkDead(offsets[4]);
+  log.MarkDead(offsets[1]);
+  log.MarkDead(offsets[2]);
+  ASSERT_EQ(0, log.PickVictim());
+
+  formica::SegmentedLog::ScannedEntry scanned;
+  log.Scan(log.SegmentStart(0), &scanned);
+  ASSERT_TRUE(scanned.key.Equals(entry.key));
+  ASSERT_EQ(offsets[1], scanned.next);
+  log.Free(0);
+  ASSERT_EQ(2, log.free_segments());
+  ASSERT_EQ(3 * space, log.live_bytes());
+
+  // Reserved segments are left alone.
+  ASSERT_EQ(-1, log.Append(entry.key, string(900, 'x'), entry.hash,
+      formica::SegmentedLog::Stream::WRITE, 2));
+  ASSERT_EQ(-1, log.Append(entry.key, string(2000, 'x'), entry.hash));
+}
+
+// Overwrites randomly chosen keys many times over in a small store, so that it must clean to keep
+// going. Each value starts with its key, so readers can check they got the right one.
+void OverwriteWorkload(StdMapStore* store, int num_keys, int num_writes) {
+  std::minstd_rand rng(0);
+  for (int i = 0; i < num_writes; ++i) {
+    string key = "key" + to_string(rng() % num_keys);
+    ASSERT_TRUE(store->Insert(Entry(key, key + string(100 + i % 200, 'v')))) << i;
+  }
+}
+
+TEST(StdMapStore, Cleaning) {
+  StdMapStore store(64 * 1024);
+  // Keys that are never overwritten have to be moved by the cleaner.
+  vector<Entry> cold;
+  for (int i = 0; i < 20; ++i) cold.emplace_back("cold" + to_string(i), string(100, 'c'));
+  for (const Entry& e: cold) ASSERT_TRUE(store.Insert(e));
+  // The live keys take up about half the store, so most segments still hold some when cleaned.
+  OverwriteWorkload(&store, 120, 10000);
+  ASSERT_LT(0, store.segments_cleaned());
+  ASSERT_LT(0, store.bytes_relocated());
+
+  string value;
+  for (const Entry& e: cold) {
+    ASSERT_TRUE(store.Read(e.key, e.hash, &value));
+    ASSERT_EQ(e.value, value);
+  }
+  for (int i = 0; i < 120; ++i) {
+    string key = "key" + to_string(i);
+    ASSERT_TRUE(store.Read(key, hash<string>()(key), &value));
+    ASSERT_EQ(0, value.find(key));
+  }
+  ASSERT_EQ(0, store.log_overwritten());
+}
+
+TEST(StdMapStore, Ttl) {
+  StdMapStore store(64 * 1024);
+  Entry expiring("hello", "world");
+  ASSERT_TRUE(store.Insert(expiring, 5));
+  string value;
+  ASSERT_TRUE(store.Read(expiring.key, expiring.hash, &value));
+  CoarseClock::Set(CoarseClock::Now() + 5);
+  ASSERT_FALSE(store.Read(expiring.key, expiring.hash, &value));
+  // An expired entry counts as gone from the log, not as another key's.
+  ASSERT_EQ(1, store.log_overwritten());
+  ASSERT_EQ(0, store.log_other_key());
+  CoarseClock::Set(0);
+}
+
+TEST(StdMapStore, Full) {
+  StdMapStore store(16 * 1024);
+  vector<Entry> entries;
+  for (int i = 0; i < 1000; ++i) entries.emplace_back("key" + to_string(i), string(100, 'v'));
+
+  // Nothing is ever overwritten, so the store fills up, and stays readable.
+  int inserted = 0;
+  while (inserted < entries.size() && store.Insert(entries[inserted])) ++inserted;
+  ASSERT_LT(0, inserted);
+  ASSERT_GT(entries.size(), inserted);
+  string value;
+  for (int i = 0; i < inserted; ++i) {
+    ASSERT_TRUE(store.Read(entries[i].key, entries[i].hash, &value)) << i;
+  }
+
+  // Deleting makes room again.
+  for (int i = 0; i < inserted; i += 2) ASSERT_TRUE(store.Delete(entries[i].key, entries[i].hash));
+  ASSERT_TRUE(store.Insert(entries[inserted]));
+  ASSERT_TRUE(store.Read(entries[inserted].key, entries[inserted].hash, &value));
+}
+
+TEST(StdMapStore, BackgroundCleaner) {
+  StdMapStore store(64 * 1024);
+  store.StartCleaner();
+
+  std::atomic<bool> done{false};
+  thread reader([&]() {
+    string value;
+    while (!done.load()) {
+      for (int i = 0; i < 50; ++i) {
+        string key = "key" + to_string(i);
+        if (store.Read(key, hash<string>()(key), &value)) ASSERT_EQ(0, value.find(key));
+      }
+    }
+  });
+  OverwriteWorkload(&store, 50, 10000);
+  done.store(true);
+  reader.join();
+  ASSERT_LT(0, store.segments_cleaned());
+}
+
+TEST(StdMapStore, FrontCache) {
+  StdMapStore store(64 * 1024);
+  store.EnableFrontCache(64 * 1024);
+  Entry entry("hello", "world");
+  store.Insert(entry);
+
+  string value;
+  for (int i = 0; i < 3; ++i) ASSERT_TRUE(store.Read(entry.key, entry.hash, &value));
+  ASSERT_EQ(1, store.front_cache_hits());
+
+  Entry updated("hello", "everyone");
+  ASSERT_TRUE(store.Update(updated));
+  ASSERT_TRUE(store.Read(entry.key, entry.hash, &value));
+  ASSERT_EQ(updated.value, value);
+  ASSERT_TRUE(store.Delete(entry.key, entry.hash));
+  ASSERT_FALSE(store.Read(entry.key, entry.hash, &value));
+}
+
 TEST(LossyHash, ReadAndWrite) {
-  LossyHash lossy_hash(256);
-  ASSERT_EQ(-1, lossy_hash.Lookup(123456));
+  LossyHash lossy_hash(256, 1024);
+  ASSERT_EQ(-1, lossy_hash.Lookup(123456, 1000));
+
+  lossy_hash.Insert(123456, 789, 1000);
+  ASSERT_EQ(789, lossy_hash.Lookup(123456, 1000));
+  ASSERT_EQ(-1, lossy_hash.Lookup(654321, 1000));
+}
+
+TEST(LossyHash, StaleOffsets) {
+  LossyHash lossy_hash(256, 1024);
+  lossy_hash.Insert(123456, 789, 800);
+
+  // Still live while the tail is within a log's length of the offset, even if the tail was read
+  // before the entry was appended.
+  ASSERT_EQ(789, lossy_hash.Lookup(123456, 789 + 1024));
+  ASSERT_EQ(789, lossy_hash.Lookup(123456, 700));
+  ASSERT_EQ(-1, lossy_hash.Lookup(123456, 789 + 1025));
+
+  // Offsets are stored modulo 2^47, but are still recovered exactly.
+  offset_t large = (1LL << 50) + 12345;
+  lossy_hash.Insert(654321, large, large + 10);
+  ASSERT_EQ(large, lossy_hash.Lookup(654321, large + 1000));
+}
+
+// Every key lands in the single bucket, with a distinct index tag.
+TEST(LossyHash, FullBucket) {
+  LossyHash lossy_hash(1, 1024 * 1024);
+  constexpr offset_t TAIL = 2000;
+  for (int i = 1; i <= 15; ++i) lossy_hash.Insert(static_cast<uint64_t>(i) << 16, i * 100, TAIL);
+  for (int i = 1; i <= 15; ++i) {
+    ASSERT_EQ(i * 100, lossy_hash.Lookup(static_cast<uint64_t>(i) << 16, TAIL));
+  }
+
+  // A duplicate tag overwrites the existing entry.
+  lossy_hash.Insert(static_cast<uint64_t>(7) << 16, 1700, TAIL);
+  ASSERT_EQ(1700, lossy_hash.Lookup(static_cast<uint64_t>(7) << 16, TAIL));
+
+  // A new tag in a full bucket evicts the entry with the oldest offset.
+  lossy_hash.Insert(static_cast<uint64_t>(16) << 16, 1600, TAIL);
+  ASSERT_EQ(1600, lossy_hash.Lookup(static_cast<uint64_t>(16) << 16, TAIL));
+  ASSERT_EQ(-1, lossy_hash.Lookup(static_cast<uint64_t>(1) << 16, TAIL));
+  for (int i = 2; i <= 15; ++i) {
+    ASSERT_NE(-1, lossy_hash.Lookup(static_cast<uint64_t>(i) << 16, TAIL));
+  }
+}
+
+TEST(LossyHash, OverflowBuckets) {
+  LossyHash lossless_hash(1, 1024 * 1024, formica::MemoryOptions(), 2);
+  ASSERT_TRUE(lossless_hash.lossless());
+  constexpr offset_t TAIL = 5000;
+  for (int i = 1; i <= 45; ++i) {
+    ASSERT_TRUE(lossless_hash.Insert(static_cast<uint64_t>(i) << 16, i * 100, TAIL));
+  }
+  ASSERT_EQ(2, lossless_hash.overflow_buckets_used());
+  ASSERT_FALSE(lossless_hash.Insert(static_cast<uint64_t>(46) << 16, 4600, TAIL));
+  for (int i = 1; i <= 45; ++i) {
+    ASSERT_EQ(i * 100, lossless_hash.Lookup(static_cast<uint64_t>(i) << 16, TAIL));
+  }
+
+  // Duplicate tags are kept, and found one after another.
+  lossless_hash.Delete(static_cast<uint64_t>(1) << 16, TAIL);
+  ASSERT_TRUE(lossless_hash.Insert(static_cast<uint64_t>(7) << 16, 4700, TAIL));
+  LossyHash::Slot slot;
+  ASSERT_TRUE(lossless_hash.Find(static_cast<uint64_t>(7) << 16, TAIL, &slot));
+  ASSERT_EQ(4700, slot.offset);
+  ASSERT_TRUE(lossless_hash.FindNext(static_cast<uint64_t>(7) << 16, TAIL, &slot));
+  ASSERT_EQ(700, slot.offset);
+  ASSERT_FALSE(lossless_hash.FindNext(static_cast<uint64_t>(7) << 16, TAIL, &slot));
+}
+
+// Every key lands in the single bucket. Inline records take up several entries, which may hold
+// any bytes, including ones that look like another key's index tag.
+TEST(LossyHash, InlineRecords) {
+  LossyHash lossy_hash(1, 1024 * 1024);
+  lossy_hash.EnableInline();
+  constexpr offset_t TAIL = 2000;
+  ASSERT_TRUE(LossyHash::CanInline("counter:1", "12345678"));
+  ASSERT_FALSE(LossyHash::CanInline("counter:1", "123456789"));
+  ASSERT_FALSE(LossyHash::CanInline(string(20, 'k'), "12345678"));
+
+  // Key bytes that match the tag of the offset entry inserted below.
+  string key("\x00\x00\x00\x00\x00\x00\x09\x00", 8);
+  lossy_hash.InsertInline(static_cast<uint64_t>(1) << 16, key, "v1", TAIL);
+  lossy_hash.Insert(static_cast<uint64_t>(9) << 16, 900, TAIL);
+  ASSERT_EQ(LossyHash::INLINE, lossy_hash.Lookup(static_cast<uint64_t>(1) << 16, TAIL));
+  ASSERT_EQ(900, lossy_hash.Lookup(static_cast<uint64_t>(9) << 16, TAIL));
 
-  lossy_hash.Insert(123456, 789, -1);
-  ASSERT_EQ(789, lossy_hash.Lookup(123456));
-  ASSERT_EQ(-1, lossy_hash.Lookup(654321));
+  LossyHash::Slot slot;
+  formica::LogSlice stored_key, stored_value;
+  ASSERT_TRUE(lossy_hash.Find(static_cast<uint64_t>(1) << 16, TAIL, &slot));
+  ASSERT_TRUE(lossy_hash.ReadInline(slot, &stored_key, &stored_value));
+  ASSERT_TRUE(stored_key.Equals(key));
+  ASSERT_TRUE(stored_value.Equals("v1"));
+
+  // An offset entry with the same tag replaces the whole record.
+  lossy_hash.Insert(static_cast<uint64_t>(1) << 16, 100, TAIL);
+  ASSERT_EQ(100, lossy_hash.Lookup(static_cast<uint64_t>(1) << 16, TAIL));
+
+  // Filling the bucket with records of three entries evicts the oldest, offsets included, until
+  // only inline records are left.
+  for (int i = 2; i <= 7; ++i) {
+    lossy_hash.InsertInline(static_cast<uint64_t>(i) << 16, "key" + to_string(i), "value",
+        TAIL + i);
+  }
+  for (int i: {1, 2, 3, 9}) {
+    ASSERT_EQ(-1, lossy_hash.Lookup(static_cast<uint64_t>(i) << 16, TAIL + 10)) << i;
+  }
+  for (int i = 4; i <= 7; ++i) {
+    ASSERT_EQ(LossyHash::INLINE, lossy_hash.Lookup(static_cast<uint64_t>(i) << 16, TAIL + 10));
+  }
+
+  lossy_hash.Delete(static_cast<uint64_t>(5) << 16, TAIL + 10);
+  ASSERT_EQ(-1, lossy_hash.Lookup(static_cast<uint64_t>(5) << 16, TAIL + 10));
+  ASSERT_EQ(LossyHash::INLINE, lossy_hash.Lookup(static_cast<uint64_t>(6) << 16, TAIL + 10));
 }
 
 TEST(FormicaStore, ReadAndWrite) {
@@ -136,6 +651,1156 @@ TEST(FormicaStore, ReadAndWrite) {
   ASSERT_FALSE(idx.Read(entry.key, 0, &value));
 }
 
+TEST(FormicaStore, HugePages) {
+  formica::MemoryOptions options;
+  options.huge_pages = true;
+  options.numa_node = 0;
+  FormicaStore store(3 * 1024 * 1024, 256, options);
+
+  // Whichever kind of pages the machine could give us, the store must work the same way.
+  ASSERT_LE(3 * 1024 * 1024, store.log_region().mapped_size);
+  if (store.log_region().page_kind != formica::PageKind::NORMAL) {
+    ASSERT_EQ(0, store.log_region().mapped_size % (2 * 1024 * 1024));
+    ASSERT_EQ(0, reinterpret_cast<uintptr_t>(store.log_region().ptr) % (2 * 1024 * 1024));
+  }
+
+  Entry entry("hello", "world");
+  store.Insert(entry);
+  string value;
+  ASSERT_TRUE(store.Read(entry.key, entry.hash, &value));
+  ASSERT_EQ(entry.value, value);
+}
+
+TEST(FormicaStore, Update) {
+  FormicaStore store(1024, 256);
+  Entry entry("hello", "world");
+  ASSERT_FALSE(store.Update(entry));
+  store.Insert(entry);
+
+  formica::ValueView before, after;
+  ASSERT_TRUE(store.ReadView(entry.key, entry.hash, &before));
+
+  Entry shorter("hello", "wor");
+  ASSERT_TRUE(store.Update(shorter));
+  ASSERT_TRUE(store.ReadView(entry.key, entry.hash, &after));
+  ASSERT_EQ(before.value.data, after.value.data) << "Shorter value should be updated in place";
+  ASSERT_FALSE(store.IsValid(before));
+
+  Entry longer("hello", "everyone in the world");
+  ASSERT_TRUE(store.Update(longer));
+  string value;
+  ASSERT_TRUE(store.Read(entry.key, entry.hash, &value));
+  ASSERT_EQ(longer.value, value);
+}
+
+TEST(FormicaStore, Delete) {
+  FormicaStore store(1024, 256);
+  Entry entry("hello", "world");
+  ASSERT_FALSE(store.Delete(entry.key, entry.hash));
+  store.Insert(entry);
+
+  // Same hash as 'entry', but the key doesn't match what's in the log.
+  ASSERT_FALSE(store.Delete("goodbye", entry.hash));
+  string value;
+  ASSERT_TRUE(store.Read(entry.key, entry.hash, &value));
+
+  ASSERT_TRUE(store.Delete(entry.key, entry.hash));
+  ASSERT_FALSE(store.Read(entry.key, entry.hash, &value));
+  ASSERT_EQ(1, store.index_misses());
+}
+
+// A Delete() leaves a hole in the bucket, which a later insert of another key may fill. The key's
+// older entry further along the bucket mustn't survive a Delete() of the newer one.
+TEST(FormicaStore, DeleteAfterReinsertIntoHole) {
+  for (bool inline_values: {false, true}) {
+    for (int value_size: {3, 20}) {
+      FormicaStore store(1 << 20, 1);
+      if (inline_values) store.EnableInlineValues();
+      string old_value(value_size, 'o'), new_value(value_size, 'n');
+      Entry key1("key1", "value"), key2_old("key2", old_value), key2_new("key2", new_value);
+      ASSERT_TRUE(store.Insert(key1));
+      ASSERT_TRUE(store.Insert(key2_old));
+      ASSERT_TRUE(store.Delete(key1.key, key1.hash));
+      ASSERT_TRUE(store.Insert(key2_new));
+
+      string value;
+      ASSERT_TRUE(store.Read(key2_new.key, key2_new.hash, &value));
+      ASSERT_EQ(new_value, value);
+      ASSERT_TRUE(store.Delete(key2_new.key, key2_new.hash));
+      ASSERT_FALSE(store.Read(key2_new.key, key2_new.hash, &value))
+          << "inline: " << inline_values << ", value size: " << value_size << ", read " << value;
+      ASSERT_EQ(0, store.stats()[Stat::INDEX_ENTRIES]);
+    }
+  }
+}
+
+TEST(FormicaStore, Ttl) {
+  for (StoreMode mode: {StoreMode::CACHE, StoreMode::STORE}) {
+    FormicaStore store(64 * 1024, 16, mode);
+    Entry expiring("hello", "world"), forever("goodbye", "world");
+    ASSERT_TRUE(store.Insert(expiring, 5));
+    ASSERT_TRUE(store.Insert(forever));
+
+    string value;
+    ASSERT_TRUE(store.Read(expiring.key, expiring.hash, &value));
+    CoarseClock::Set(CoarseClock::Now() + 5);
+    ASSERT_FALSE(store.Read(expiring.key, expiring.hash, &value));
+    ASSERT_TRUE(store.Read(forever.key, forever.hash, &value));
+    ASSERT_FALSE(store.Update(expiring));
+
+    // Inserting the key again brings it back.
+    ASSERT_TRUE(store.Insert(expiring));
+    ASSERT_TRUE(store.Read(expiring.key, expiring.hash, &value));
+    CoarseClock::Set(0);
+  }
+}
+
+// Unbatched writes keep the clock going, so entries expire without anyone calling Tick().
+TEST(FormicaStore, WritesTickTheClock) {
+  Entry expiring("hello", "world"), other("goodbye", "world");
+  string value;
+  FormicaStore formica(64 * 1024, 16);
+  ASSERT_TRUE(formica.Insert(expiring, 1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  ASSERT_TRUE(formica.Insert(other));
+  ASSERT_FALSE(formica.Read(expiring.key, expiring.hash, &value));
+
+  StdMapStore map(64 * 1024);
+  ASSERT_TRUE(map.Insert(expiring, 1));
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  ASSERT_TRUE(map.Insert(other));
+  ASSERT_FALSE(map.Read(expiring.key, expiring.hash, &value));
+}
+
+TEST(FormicaStore, ExpiredEntriesAreEvictedFirst) {
+  // Every key goes in the same bucket, which holds 15 entries.
+  FormicaStore store(64 * 1024, 1);
+  vector<Entry> entries;
+  for (int i = 0; i < 16; ++i) entries.emplace_back("key" + to_string(i), "value");
+  for (int i = 0; i < 15; ++i) store.Insert(entries[i], i == 7 ? 1 : 0);
+
+  CoarseClock::Set(CoarseClock::Now() + 1);
+  store.Insert(entries[15]);
+
+  // Without the expired entry, the oldest one would have been evicted.
+  string value;
+  for (int i = 0; i < 16; ++i) {
+    ASSERT_EQ(i != 7, store.Read(entries[i].key, entries[i].hash, &value)) << i;
+  }
+  CoarseClock::Set(0);
+}
+
+TEST(FormicaStore, InlineValues) {
+  FormicaStore store(64 * 1024, 256);
+  store.EnableInlineValues();
+  Entry small("counter", "42");
+  Entry large("user", string(100, 'u'));
+  ASSERT_TRUE(store.Insert(small));
+  ASSERT_TRUE(store.Insert(large));
+  string value;
+  ASSERT_TRUE(store.Read(small.key, small.hash, &value));
+  ASSERT_EQ("42", value);
+  ASSERT_TRUE(store.Read(large.key, large.hash, &value));
+  ASSERT_EQ(large.value, value);
+  ASSERT_FALSE(store.Read("counter2", small.hash, &value));
+
+  formica::ValueView view;
+  ASSERT_TRUE(store.ReadView(small.key, small.hash, &view));
+  ASSERT_TRUE(view.value.Equals("42"));
+  ASSERT_TRUE(store.IsValid(view));
+
+  // Updates move an entry between the bucket and the log as its value changes size.
+  ASSERT_TRUE(store.Update(Entry("counter", "43")));
+  ASSERT_FALSE(store.IsValid(view));
+  ASSERT_TRUE(store.Read(small.key, small.hash, &value));
+  ASSERT_EQ("43", value);
+  ASSERT_TRUE(store.Update(Entry("counter", string(50, 'c'))));
+  ASSERT_TRUE(store.Read(small.key, small.hash, &value));
+  ASSERT_EQ(string(50, 'c'), value);
+  ASSERT_TRUE(store.Insert(Entry("counter", "44")));
+  ASSERT_TRUE(store.Read(small.key, small.hash, &value));
+  ASSERT_EQ("44", value);
+
+  // Entries with a TTL go to the log.
+  ASSERT_TRUE(store.Insert(Entry("flag", "1"), 100));
+  ASSERT_TRUE(store.Read("flag", Entry("flag", "").hash, &value));
+  ASSERT_EQ("1", value);
+
+  vector<formica::ReadRequest> requests = {{&small.key, small.hash, &value, false}};
+  store.MultiRead(requests.data(), 1);
+  ASSERT_TRUE(requests[0].found);
+  ASSERT_EQ("44", value);
+
+  ASSERT_TRUE(store.Delete(small.key, small.hash));
+  ASSERT_FALSE(store.Read(small.key, small.hash, &value));
+  ASSERT_FALSE(store.Delete(small.key, small.hash));
+  ASSERT_TRUE(store.Read(large.key, large.hash, &value));
+}
+
+TEST(FormicaStore, Compression) {
+  for (StoreMode mode: {StoreMode::CACHE, StoreMode::STORE}) {
+    // Without compression, only about a quarter of the entries would fit.
+    FormicaStore store(256 * 1024, 1024, mode);
+    store.set_compression(true);
+    vector<Entry> entries;
+    for (int i = 0; i < 1000; ++i) {
+      string value = "{\"id\": " + to_string(i) + ", \"tags\": [";
+      while (value.size() < 1000) value += "\"tag\", ";
+      entries.emplace_back("key" + to_string(i), value + "]}");
+    }
+    for (const Entry& e: entries) ASSERT_TRUE(store.Insert(e));
+
+    string value;
+    for (const Entry& e: entries) {
+      ASSERT_TRUE(store.Read(e.key, e.hash, &value)) << e.key;
+      ASSERT_EQ(e.value, value);
+    }
+  }
+}
+
+TEST(FormicaStore, StoreMode) {
+  FormicaStore store(64 * 1024, 16, StoreMode::STORE);
+  vector<Entry> entries;
+  for (int i = 0; i < 200; ++i) entries.emplace_back(to_string(i), "value" + string(i % 50, 'v'));
+  for (const auto& e: entries) ASSERT_TRUE(store.Insert(e));
+
+  // Rewriting every key many times over means the log is cleaned repeatedly, but nothing is lost,
+  // even though there are far more keys than the 16 buckets hold.
+  string value;
+  for (int round = 0; round < 20; ++round) {
+    for (int i = 0; i < entries.size(); ++i) {
+      string new_value = to_string(round) + string((i + round) % 60, 'w');
+      ASSERT_TRUE(store.Update(Entry(entries[i].key, new_value)));
+    }
+  }
+  for (int i = 0; i < entries.size(); ++i) {
+    ASSERT_TRUE(store.Read(entries[i].key, entries[i].hash, &value)) << i;
+    ASSERT_EQ("19" + string((i + 19) % 60, 'w'), value);
+  }
+  ASSERT_EQ(0, store.index_misses());
+
+  // Fill the store until it refuses more, then check that everything it accepted is still there.
+  int num_inserted = 0;
+  while (store.Insert(Entry("extra" + to_string(num_inserted), string(100, 'x')))) {
+    ++num_inserted;
+  }
+  ASSERT_GT(num_inserted, 0);
+  ASSERT_LE(store.live_bytes(), 64 * 1024);
+  for (int i = 0; i < num_inserted; ++i) {
+    string key = "extra" + to_string(i);
+    ASSERT_TRUE(store.Read(key, hash<string>{}(key), &value)) << i;
+  }
+  for (const auto& e: entries) ASSERT_TRUE(store.Read(e.key, e.hash, &value));
+
+  // Deleting frees up room again.
+  for (const auto& e: entries) ASSERT_TRUE(store.Delete(e.key, e.hash));
+  ASSERT_TRUE(store.Insert(Entry("one more", string(100, 'x'))));
+}
+
+TEST(FormicaStore, StoreModeWithOtherHash) {
+  // The cleaner must rehash keys with the same function as the entries were hashed with.
+  FormicaStore store(16 * 1024, 16, StoreMode::STORE, formica::MemoryOptions(), WyHash::Hash);
+  for (int round = 0; round < 50; ++round) {
+    for (int i = 0; i < 50; ++i) {
+      string value = string((round + i) % 7, 'v') + to_string(round);
+      ASSERT_TRUE(store.Insert(Entry(to_string(i), value, WyHash())));
+    }
+  }
+  string value;
+  for (int i = 0; i < 50; ++i) {
+    ASSERT_TRUE(store.Read(to_string(i), store.Hash(to_string(i)), &value));
+    ASSERT_EQ(string((49 + i) % 7, 'v') + "49", value);
+  }
+}
+
+TEST(FormicaStore, MultiReadAndMultiInsert) {
+  FormicaStore store(1024 * 1024, 256);
+  vector<Entry> entries;
+  for (int i = 0; i < 100; ++i) entries.emplace_back("key" + to_string(i), "value" + to_string(i));
+
+  vector<const Entry*> batch;
+  for (const auto& e: entries) batch.push_back(&e);
+  store.MultiInsert(batch.data(), batch.size());
+
+  // Larger than MAX_BATCH_SIZE, and includes keys that were never inserted.
+  vector<Entry> missing;
+  for (int i = 0; i < 10; ++i) missing.emplace_back("missing" + to_string(i), "");
+  vector<formica::ReadRequest> requests;
+  vector<string> values(entries.size() + missing.size());
+  for (int i = 0; i < entries.size(); ++i) {
+    requests.push_back({&entries[i].key, entries[i].hash, &values[i], false});
+  }
+  for (int i = 0; i < missing.size(); ++i) {
+    requests.push_back({&missing[i].key, missing[i].hash, &values[entries.size() + i], true});
+  }
+
+  store.MultiRead(requests.data(), requests.size());
+  for (int i = 0; i < entries.size(); ++i) {
+    ASSERT_TRUE(requests[i].found);
+    ASSERT_EQ(entries[i].value, values[i]);
+  }
+  for (int i = entries.size(); i < requests.size(); ++i) ASSERT_FALSE(requests[i].found);
+}
+
+TEST(FormicaStore, ReadView) {
+  FormicaStore store(128, 16);
+  Entry first("key", "value");
+  store.Insert(first);
+
+  formica::ValueView view;
+  ASSERT_TRUE(store.ReadView(first.key, first.hash, &view));
+  ASSERT_TRUE(view.value.Equals(first.value));
+  ASSERT_TRUE(store.IsValid(view));
+  ASSERT_FALSE(store.ReadView("other", first.hash, &view));
+
+  // Keep appending until entries wrap around the end of the log, which overwrites 'first'. Entries
+  // are padded rather than split at the end, so every view is contiguous and aligned.
+  for (int i = 0; i < 10; ++i) {
+    Entry entry("key" + to_string(i), "value" + string(i * 3, 'v'));
+    store.Insert(entry);
+    formica::ValueView wrapped;
+    ASSERT_TRUE(store.ReadView(entry.key, entry.hash, &wrapped));
+    string value;
+    wrapped.value.CopyTo(&value);
+    ASSERT_EQ(entry.value, value);
+    ASSERT_TRUE(store.IsValid(wrapped));
+    ASSERT_EQ(0, wrapped.value.entry_offset % CircularLog::ENTRY_ALIGNMENT);
+  }
+  ASSERT_FALSE(store.IsValid(view));
+}
+
+// Readers race a writer that wraps a small log many times. Reads may miss, but must never return a
+// torn or mismatched value.
+TEST(FrontCache, AdmitsOnSecondMiss) {
+  FrontCache cache(16 * 1024, 128);
+  ASSERT_EQ(128, cache.num_slots());
+  Entry entry("hello", "world");
+
+  string value;
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_FALSE(cache.Read(entry.key, entry.hash, &value));
+    cache.Fill(cache.BeginFill(entry.hash), entry.key, entry.hash, entry.value, 0);
+  }
+  ASSERT_TRUE(cache.Read(entry.key, entry.hash, &value));
+  ASSERT_EQ(entry.value, value);
+  ASSERT_FALSE(cache.Read("other", entry.hash, &value));
+  ASSERT_EQ(1, cache.hits());
+  ASSERT_EQ(3, cache.misses());
+
+  // A fill that started before an invalidation is dropped, since it may have read the old value.
+  uint32_t ticket = cache.BeginFill(entry.hash);
+  cache.Invalidate(entry.hash);
+  ASSERT_FALSE(cache.Read(entry.key, entry.hash, &value));
+  cache.Fill(ticket, entry.key, entry.hash, entry.value, 0);
+  ASSERT_FALSE(cache.Read(entry.key, entry.hash, &value));
+
+  // Entries that don't fit in a slot are never cached.
+  Entry large("large", string(128, 'v'));
+  for (int i = 0; i < 2; ++i) {
+    cache.Fill(cache.BeginFill(large.hash), large.key, large.hash, large.value, 0);
+  }
+  ASSERT_FALSE(cache.Read(large.key, large.hash, &value));
+}
+
+TEST(FormicaStore, FrontCache) {
+  for (StoreMode mode: {StoreMode::CACHE, StoreMode::STORE}) {
+    FormicaStore store(64 * 1024, 16, mode);
+    store.EnableFrontCache(64 * 1024);
+    Entry entry("hello", "world"), expiring("goodbye", "world");
+    store.Insert(entry);
+    store.Insert(expiring, 5);
+
+    string value;
+    for (int i = 0; i < 3; ++i) {
+      ASSERT_TRUE(store.Read(entry.key, entry.hash, &value));
+      ASSERT_TRUE(store.Read(expiring.key, expiring.hash, &value));
+    }
+    ASSERT_EQ(2, store.front_cache_hits());
+    ASSERT_EQ(4, store.front_cache_misses());
+
+    // Writes invalidate the cache, and the expiry time is cached along with the value.
+    Entry updated("hello", "everyone");
+    ASSERT_TRUE(store.Update(updated));
+    ASSERT_TRUE(store.Read(entry.key, entry.hash, &value));
+    ASSERT_EQ(updated.value, value);
+    ASSERT_TRUE(store.Delete(entry.key, entry.hash));
+    ASSERT_FALSE(store.Read(entry.key, entry.hash, &value));
+    CoarseClock::Set(CoarseClock::Now() + 5);
+    ASSERT_FALSE(store.Read(expiring.key, expiring.hash, &value));
+    CoarseClock::Set(0);
+  }
+}
+
+TEST(FormicaStore, ConcurrentReadsWithOneWriter) {
+  FormicaStore store(4096, 16);
+  vector<Entry> entries;
+  for (int i = 0; i < 64; ++i) {
+    string key = "key" + to_string(i);
+    entries.emplace_back(key, string(i, 'a' + (i % 26)) + key);
+  }
+  for (const auto& e: entries) store.Insert(e);
+
+  std::atomic<bool> done{false};
+  thread writer([&]() {
+    for (int i = 0; i < 200000; ++i) store.Insert(entries[i % entries.size()]);
+    done = true;
+  });
+
+  vector<int> bad_reads(4, 0);
+  vector<thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&, t]() {
+      int i = t;
+      while (!done) {
+        const Entry& e = entries[(i++) % entries.size()];
+        string value;
+        if (store.Read(e.key, e.hash, &value) && value != e.value) ++bad_reads[t];
+      }
+    });
+  }
+  writer.join();
+  for (auto& t: readers) t.join();
+
+  for (int bad: bad_reads) ASSERT_EQ(0, bad);
+}
+
+// As above, with a mix of inline records and log entries evicting each other from the buckets.
+TEST(FormicaStore, ConcurrentReadsWithInlineValues) {
+  FormicaStore store(4096, 16);
+  store.EnableInlineValues();
+  vector<Entry> entries;
+  for (int i = 0; i < 64; ++i) {
+    string key = "key" + to_string(i);
+    entries.emplace_back(key, i % 2 == 0 ? to_string(i * 1000) : string(i, 'a' + (i % 26)) + key);
+  }
+  for (const auto& e: entries) store.Insert(e);
+
+  std::atomic<bool> done{false};
+  thread writer([&]() {
+    for (int i = 0; i < 200000; ++i) store.Insert(entries[(i * 7) % entries.size()]);
+    done = true;
+  });
+
+  vector<int> bad_reads(4, 0);
+  vector<thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&, t]() {
+      int i = t;
+      while (!done) {
+        const Entry& e = entries[(i++) % entries.size()];
+        string value;
+        if (store.Read(e.key, e.hash, &value) && value != e.value) ++bad_reads[t];
+      }
+    });
+  }
+  writer.join();
+  for (auto& t: readers) t.join();
+
+  for (int bad: bad_reads) ASSERT_EQ(0, bad);
+}
+
+TEST(FormicaStore, ConcurrentReadsInStoreMode) {
+  FormicaStore store(16 * 1024, 4, StoreMode::STORE);
+  vector<Entry> entries;
+  vector<Entry> longer_entries;
+  for (int i = 0; i < 64; ++i) {
+    string key = "key" + to_string(i);
+    entries.emplace_back(key, string(i, 'a' + (i % 26)) + key);
+    longer_entries.emplace_back(key, string(i + 10, 'a' + (i % 26)) + key);
+  }
+  for (const auto& e: entries) ASSERT_TRUE(store.Insert(e));
+
+  // Alternating value sizes forces appends, and so cleaning, which moves entries that readers may be
+  // looking at. Every read must still find its key.
+  std::atomic<bool> done{false};
+  int failed_updates = 0;
+  thread writer([&]() {
+    for (int i = 0; i < 200000; ++i) {
+      const vector<Entry>& source = (i / entries.size()) % 2 == 0 ? longer_entries : entries;
+      failed_updates += !store.Update(source[i % entries.size()]);
+    }
+    done = true;
+  });
+
+  vector<int> bad_reads(4, 0);
+  vector<thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&, t]() {
+      int i = t;
+      while (!done) {
+        int idx = (i++) % entries.size();
+        string value;
+        if (!store.Read(entries[idx].key, entries[idx].hash, &value) ||
+            (value != entries[idx].value && value != longer_entries[idx].value)) {
+          ++bad_reads[t];
+        }
+      }
+    });
+  }
+  writer.join();
+  for (auto& t: readers) t.join();
+
+  ASSERT_EQ(0, failed_updates);
+  for (int bad: bad_reads) ASSERT_EQ(0, bad);
+}
+
+// Readers race a writer that keeps updating a few hot keys. Once the writer is done, the front cache
+// must not still hold any value but the last one written.
+TEST(FormicaStore, ConcurrentReadsWithFrontCache) {
+  FormicaStore store(64 * 1024, 16);
+  store.EnableFrontCache(64 * 1024);
+  vector<string> keys;
+  for (int i = 0; i < 8; ++i) {
+    keys.push_back("key" + to_string(i));
+    store.Insert(Entry(keys.back(), keys.back() + ":0"));
+  }
+
+  constexpr int NUM_WRITES = 100000;
+  std::atomic<bool> done{false};
+  thread writer([&]() {
+    for (int i = 1; i <= NUM_WRITES; ++i) {
+      const string& key = keys[i % keys.size()];
+      store.Update(Entry(key, key + ":" + to_string(i)));
+    }
+    done = true;
+  });
+
+  vector<int> bad_reads(4, 0);
+  vector<thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&, t]() {
+      int i = t;
+      while (!done) {
+        const string& key = keys[(i++) % keys.size()];
+        string value;
+        if (store.Read(key, Entry(key, "").hash, &value) && value.find(key + ":") != 0) {
+          ++bad_reads[t];
+        }
+      }
+    });
+  }
+  writer.join();
+  for (auto& t: readers) t.join();
+  for (int bad: bad_reads) ASSERT_EQ(0, bad);
+
+  ASSERT_LT(0, store.front_cache_hits());
+  for (int i = NUM_WRITES - keys.size() + 1; i <= NUM_WRITES; ++i) {
+    const string& key = keys[i % keys.size()];
+    string value;
+    ASSERT_TRUE(store.Read(key, Entry(key, "").hash, &value));
+    ASSERT_EQ(key + ":" + to_string(i), value);
+  }
+}
+
+TEST(FormicaStore, WarmRestart) {
+  string path = testing::TempDir() + "formica-test-store";
+  std::remove(path.c_str());
+  constexpr int NUM_ENTRIES = 5000;
+  vector<bool> readable(NUM_ENTRIES);
+  int num_readable = 0;
+  {
+    // Small enough that the log wraps several times.
+    FormicaStore store(path, 64 * 1024, 1024);
+    for (int i = 0; i < NUM_ENTRIES; ++i) {
+      store.Insert(Entry(to_string(i), "value" + string(i % 17, 'v')));
+    }
+    store.Update(Entry(to_string(NUM_ENTRIES - 2), "updated value"));
+    store.Delete(to_string(NUM_ENTRIES - 1), hash<string>{}(to_string(NUM_ENTRIES - 1)));
+
+    string value;
+    for (int i = 0; i < NUM_ENTRIES; ++i) {
+      readable[i] = store.Read(to_string(i), hash<string>{}(to_string(i)), &value);
+      num_readable += readable[i];
+    }
+  }
+
+  FormicaStore store(path, 64 * 1024, 1024, 4);
+  string value;
+  int num_recovered = 0;
+  for (int i = 0; i < NUM_ENTRIES; ++i) {
+    bool found = store.Read(to_string(i), hash<string>{}(to_string(i)), &value);
+    // Nothing comes back that wasn't there before.
+    ASSERT_TRUE(readable[i] || !found) << i;
+    if (found && i != NUM_ENTRIES - 2) ASSERT_EQ("value" + string(i % 17, 'v'), value);
+    num_recovered += found;
+  }
+
+  // Only the oldest part of the log, before the first checkpoint, may be lost.
+  ASSERT_GT(num_readable, 0);
+  ASSERT_GE(num_recovered, num_readable - num_readable / 50);
+  ASSERT_TRUE(store.Read(to_string(NUM_ENTRIES - 2), hash<string>{}(to_string(NUM_ENTRIES - 2)),
+      &value));
+  ASSERT_EQ("updated value", value);
+  std::remove(path.c_str());
+}
+
+TEST(PartitionedStore, Routing) {
+  PartitionedStore store(4, 1024 * 1024, 256);
+  vector<int> per_partition(4, 0);
+  for (int i = 0; i < 1000; ++i) {
+    Entry entry("key" + to_string(i), "value" + to_string(i));
+    int p = store.PartitionFor(entry.hash);
+    ASSERT_LE(0, p);
+    ASSERT_GT(4, p);
+    ++per_partition[p];
+
+    store.Insert(entry);
+    string value;
+    ASSERT_TRUE(store.partition(p)->Read(entry.key, entry.hash, &value));
+    ASSERT_EQ(entry.value, value);
+  }
+
+  for (int count: per_partition) ASSERT_LT(0, count) << "Keys should spread over all partitions";
+}
+
+// With more than 2^16 buckets, the bits that pick a bucket reach into the top of the hash tag.
+// Keys in one partition must still use (nearly) all of its buckets.
+TEST(PartitionedStore, BucketSpread) {
+  constexpr int NUM_PARTITIONS = 4;
+  constexpr int NUM_BUCKETS = 1 << 17;
+  PartitionedStore store(NUM_PARTITIONS, 64 * 1024, NUM_BUCKETS);
+  vector<bool> used(NUM_BUCKETS, false);
+  int num_used = 0, num_keys = 0;
+  for (int i = 0; i < 2 * NUM_PARTITIONS * NUM_BUCKETS; ++i) {
+    formica::keyhash_t hash = WyHash::Hash("key" + to_string(i));
+    if (store.PartitionFor(hash) != 0) continue;
+    ++num_keys;
+    int bucket = formica::ExtractHashTag(hash) % NUM_BUCKETS;
+    if (!used[bucket]) ++num_used;
+    used[bucket] = true;
+  }
+  // Two keys per bucket leave about 1 / e^2 of them empty.
+  ASSERT_LT(NUM_BUCKETS, num_keys * 1.1);
+  ASSERT_LT(NUM_BUCKETS * 0.8, num_used);
+}
+
+// Each thread owns one partition, and only touches keys in that partition.
+TEST(PartitionedStore, ExclusiveReadWrite) {
+  constexpr int NUM_THREADS = 4;
+  PartitionedStore store(NUM_THREADS, 1024 * 1024, 256);
+  vector<Entry> entries;
+  for (int i = 0; i < 2000; ++i) entries.emplace_back("key" + to_string(i), to_string(i));
+
+  vector<int> hits(NUM_THREADS, 0);
+  vector<thread> threads;
+  for (int t = 0; t < NUM_THREADS; ++t) {
+    threads.emplace_back([&, t]() {
+      for (const auto& e: entries) {
+        if (store.PartitionFor(e.hash) == t) store.Insert(e);
+      }
+      for (const auto& e: entries) {
+        if (store.PartitionFor(e.hash) != t) continue;
+        string value;
+        if (store.Read(e.key, e.hash, &value) && value == e.value) ++hits[t];
+      }
+    });
+  }
+  for (auto& t: threads) t.join();
+
+  int total = 0;
+  for (int h: hits) total += h;
+  ASSERT_EQ(entries.size(), total);
+}
+
+// Readers on every thread read keys from all partitions while the owners write new keys.
+TEST(PartitionedStore, ConcurrentReadExclusiveWrite) {
+  constexpr int NUM_PARTITIONS = 4;
+  PartitionedStore store(NUM_PARTITIONS, 1024 * 1024, 1024);
+  vector<Entry> initial, updates;
+  for (int i = 0; i < 1000; ++i) {
+    initial.emplace_back("key" + to_string(i), to_string(i));
+    updates.emplace_back("other-key" + to_string(i), to_string(i));
+  }
+  for (const auto& e: initial) store.Insert(e);
+
+  vector<thread> threads;
+  for (int t = 0; t < NUM_PARTITIONS; ++t) {
+    threads.emplace_back([&, t]() {
+      for (const auto& e: updates) {
+        if (store.PartitionFor(e.hash) == t) store.Insert(e);
+      }
+    });
+  }
+
+  vector<int> misses(2, 0);
+  for (int t = 0; t < 2; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < 10; ++i) {
+        for (const auto& e: initial) {
+          string value;
+          if (!store.Read(e.key, e.hash, &value) || value != e.value) ++misses[t];
+        }
+      }
+    });
+  }
+  for (auto& t: threads) t.join();
+
+  ASSERT_EQ(0, misses[0]);
+  ASSERT_EQ(0, misses[1]);
+}
+
+TEST(SpscRing, PushAndPop) {
+  SpscRing<int> ring(4);
+  for (int i = 0; i < 4; ++i) ASSERT_TRUE(ring.TryPush(i));
+  ASSERT_FALSE(ring.TryPush(4));
+  ASSERT_EQ(0, ring.Writable(2));
+
+  int items[8];
+  ASSERT_EQ(3, ring.PopBatch(items, 3));
+  ASSERT_EQ(2, items[2]);
+  ASSERT_EQ(3, ring.Writable(8));
+  int more[] = {4, 5, 6};
+  ring.PushBatch(more, 3);
+  ASSERT_EQ(4, ring.PopBatch(items, 8));
+  for (int i = 0; i < 4; ++i) ASSERT_EQ(i + 3, items[i]);
+  ASSERT_FALSE(ring.TryPop(items));
+}
+
+// Rings on the heap must keep their indexes on separate cache lines.
+TEST(SpscRing, HeapAlignment) {
+  vector<std::unique_ptr<SpscRing<int>>> rings;
+  for (int i = 0; i < 16; ++i) {
+    rings.emplace_back(new SpscRing<int>(4));
+    ASSERT_EQ(0, reinterpret_cast<uintptr_t>(rings.back().get()) % 64);
+  }
+}
+
+TEST(SpscRing, AcrossThreads) {
+  SpscRing<int> ring(64);
+  constexpr int NUM_ITEMS = 100000;
+  thread producer([&]() {
+    for (int i = 0; i < NUM_ITEMS; ++i) {
+      while (!ring.TryPush(i)) std::this_thread::yield();
+    }
+  });
+
+  int expected = 0;
+  int items[16];
+  while (expected < NUM_ITEMS) {
+    int n = ring.PopBatch(items, 16);
+    for (int i = 0; i < n; ++i) ASSERT_EQ(expected++, items[i]);
+    if (n == 0) std::this_thread::yield();
+  }
+  producer.join();
+}
+
+TEST(Dispatcher, ManyClients) {
+  PartitionedStore store(3, 1024 * 1024, 1024);
+  constexpr int NUM_CLIENTS = 3;
+  constexpr int NUM_KEYS = 500;
+  vector<int> failures(NUM_CLIENTS, 0);
+  {
+    // A small ring, so that clients have to deal with it being full.
+    Dispatcher dispatcher(&store, NUM_CLIENTS, 16);
+    vector<thread> clients;
+    for (int c = 0; c < NUM_CLIENTS; ++c) {
+      clients.emplace_back([&, c]() {
+        vector<Entry> entries;
+        for (int i = 0; i < NUM_KEYS; ++i) {
+          entries.emplace_back("client" + to_string(c) + "-" + to_string(i), to_string(i));
+        }
+        vector<string> values(NUM_KEYS);
+        Completion completions[32];
+        int completed = 0;
+        auto poll = [&]() {
+          int n = dispatcher.Poll(c, completions, 32);
+          for (int j = 0; j < n; ++j) failures[c] += !completions[j].ok;
+          completed += n;
+          if (n == 0) std::this_thread::yield();
+        };
+
+        // PUT every key, then GET each one back. Requests from a client to a partition complete in
+        // order, so the GETs can't overtake the PUTs.
+        for (int i = 0; i < 2 * NUM_KEYS; ++i) {
+          const Entry& e = entries[i % NUM_KEYS];
+          DispatchRequest request = i < NUM_KEYS ? DispatchRequest::Put(&e, i) :
+              DispatchRequest::Get(&e.key, e.hash, &values[i - NUM_KEYS], i);
+          while (!dispatcher.Submit(c, request)) poll();
+        }
+        while (completed < 2 * NUM_KEYS) poll();
+        for (int i = 0; i < NUM_KEYS; ++i) failures[c] += values[i] != to_string(i);
+      });
+    }
+    for (auto& t: clients) t.join();
+  }
+
+  for (int f: failures) ASSERT_EQ(0, f);
+  // The dispatcher has stopped, so the store can be used directly again.
+  string value;
+  ASSERT_TRUE(store.Read("client2-7", hash<string>{}("client2-7"), &value));
+  ASSERT_EQ("7", value);
+}
+
+TEST(Workload, Zipfian) {
+  formica::Random rng(0);
+  ZipfianGenerator zipf(1000, 0.99);
+  vector<int> counts(1000, 0);
+  for (int i = 0; i < 100000; ++i) ++counts[zipf.Next(&rng)];
+  // With theta = 0.99, rank 0 gets about 13% of draws, and the top 10 about 39%.
+  ASSERT_NEAR(0.13, counts[0] / 100000.0, 0.02);
+  int top10 = 0;
+  for (int i = 0; i < 10; ++i) top10 += counts[i];
+  ASSERT_NEAR(0.39, top10 / 100000.0, 0.03);
+  ASSERT_GT(counts[0], counts[1]);
+  ASSERT_GT(counts[1], counts[100]);
+
+  // Theta 0 is uniform.
+  ZipfianGenerator uniform(10, 0);
+  vector<int> uniform_counts(10, 0);
+  for (int i = 0; i < 100000; ++i) ++uniform_counts[uniform.Next(&rng)];
+  for (int count: uniform_counts) ASSERT_NEAR(0.1, count / 100000.0, 0.01);
+}
+
+TEST(Workload, YcsbMixes) {
+  for (char name: string("ABCDEF")) {
+    Workload workload(WorkloadSpec::Ycsb(name), 1000);
+    vector<int> counts(5, 0);
+    for (const Operation& op: workload.Generate(10000)) {
+      ++counts[static_cast<int>(op.type)];
+      ASSERT_LT(op.key, workload.num_keys());
+      if (op.type == OpType::SCAN) {
+        ASSERT_LE(1, op.scan_length);
+        ASSERT_LE(op.key + op.scan_length, workload.num_keys());
+      }
+    }
+    int reads = counts[static_cast<int>(OpType::READ)];
+    int inserts = counts[static_cast<int>(OpType::INSERT)];
+    ASSERT_EQ(1000 + inserts, workload.num_keys()) << name;
+    switch (name) {
+      case 'A': ASSERT_NEAR(5000, reads, 300); break;
+      case 'B': ASSERT_NEAR(9500, reads, 200); break;
+      case 'C': ASSERT_EQ(10000, reads); break;
+      case 'D': ASSERT_NEAR(500, inserts, 100); break;
+      case 'E': ASSERT_NEAR(9500, counts[static_cast<int>(OpType::SCAN)], 200); break;
+      case 'F': ASSERT_NEAR(5000, counts[static_cast<int>(OpType::READ_MODIFY_WRITE)], 300); break;
+    }
+  }
+}
+
+TEST(Workload, LatestAndHotspot) {
+  // Reads in workload D favour the keys inserted most recently.
+  Workload latest(WorkloadSpec::Ycsb('D'), 1000);
+  int recent = 0, reads = 0;
+  for (int i = 0; i < 10000; ++i) {
+    Operation op = latest.Next();
+    if (op.type != OpType::READ) continue;
+    ++reads;
+    if (op.key + 10 >= latest.num_keys()) ++recent;
+  }
+  ASSERT_LT(reads / 4, recent);
+
+  WorkloadSpec spec;
+  spec.distribution = KeyDistribution::HOTSPOT;
+  spec.hot_set_fraction = 0.1;
+  spec.hot_op_fraction = 0.9;
+  Workload hotspot(spec, 1000);
+  int hot = 0;
+  for (const Operation& op: hotspot.Generate(10000)) hot += op.key < 100;
+  ASSERT_NEAR(9000, hot, 300);
+}
+
+TEST(LatencyHistogram, Percentiles) {
+  LatencyHistogram histogram;
+  ASSERT_EQ(0, histogram.Percentile(50));
+  for (uint64_t i = 1; i <= 100000; ++i) histogram.Record(i);
+  ASSERT_EQ(100000, histogram.count());
+  ASSERT_EQ(100000, histogram.max());
+  // Each percentile is within a bucket's width, 1 / 2^SUB_BUCKET_BITS, of the true value.
+  double precision = 1.0 / (1 << LatencyHistogram::SUB_BUCKET_BITS);
+  for (double p: {1.0, 50.0, 90.0, 99.0, 99.9}) {
+    double expected = p * 1000;
+    ASSERT_NEAR(expected, histogram.Percentile(p), expected * precision) << p;
+    ASSERT_LE(expected, histogram.Percentile(p)) << p;
+  }
+  ASSERT_EQ(100000, histogram.Percentile(100));
+
+  // Small values are exact.
+  LatencyHistogram small;
+  for (uint64_t i = 0; i < 10; ++i) small.Record(i);
+  ASSERT_EQ(4, small.Percentile(50));
+  ASSERT_EQ(9, small.Percentile(100));
+
+  // Huge values don't overflow the buckets.
+  small.Record(UINT64_MAX);
+  ASSERT_EQ(UINT64_MAX, small.Percentile(100));
+}
+
+TEST(LatencyHistogram, MergeAndReset) {
+  LatencyHistogram low, high;
+  for (int i = 0; i < 100; ++i) {
+    low.Record(10);
+    high.Record(1000);
+  }
+  low.Merge(high);
+  ASSERT_EQ(200, low.count());
+  ASSERT_EQ(1000, low.max());
+  ASSERT_EQ(10, low.Percentile(50));
+  ASSERT_NEAR(1000, low.Percentile(51), 1000 >> LatencyHistogram::SUB_BUCKET_BITS);
+
+  low.Reset();
+  ASSERT_EQ(0, low.count());
+  ASSERT_EQ(0, low.max());
+  ASSERT_EQ(0, low.Percentile(99));
+}
+
+TEST(LatencyHistogram, Sampling) {
+  // Rounded down to 8.
+  LatencyHistogram histogram(10);
+  for (int i = 0; i < 800; ++i) {
+    uint64_t start = histogram.Begin();
+    histogram.End(start);
+  }
+  ASSERT_EQ(100, histogram.count());
+
+  uint64_t before = CycleClock::Now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  ASSERT_LT(before, CycleClock::Now());
+  ASSERT_GT(CycleClock::NanosPerCycle(), 0);
+}
+
+TEST(PerfCounters, CountsOrDegrades) {
+  // Whether there are counters depends on the machine, but either way they are safe to use.
+  PerfCounters counters;
+  counters.Start();
+  volatile uint64_t sum = 0;
+  for (int i = 0; i < 100000; ++i) sum += i;
+  counters.Stop();
+  for (int i = 0; i < PerfCounters::NUM_EVENTS; ++i) {
+    auto event = static_cast<PerfCounters::Event>(i);
+    ASSERT_FALSE(PerfCounters::Name(event).empty());
+    if (!counters.available(event)) ASSERT_EQ(0, counters.Read(event));
+  }
+  if (counters.available(PerfCounters::INSTRUCTIONS)) {
+    ASSERT_LT(100000, counters.Read(PerfCounters::INSTRUCTIONS));
+  }
+}
+
+TEST(Stats, ConcurrentSnapshots) {
+  // More threads than shards, so that some share one.
+  constexpr int NUM_THREADS = Stats::NUM_SHARDS + 16;
+  constexpr int NUM_OPS = 1000;
+  Stats stats;
+  std::atomic<bool> done{false};
+  thread reader([&]() {
+    while (!done.load()) {
+      StatsSnapshot snapshot = stats.Snapshot();
+      // Every thread counts a read before the miss.
+      ASSERT_LE(snapshot[Stat::INDEX_MISSES], snapshot[Stat::READS]);
+      ASSERT_LE(0, snapshot[Stat::INDEX_ENTRIES]);
+    }
+  });
+  vector<thread> threads;
+  for (int t = 0; t < NUM_THREADS; ++t) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < NUM_OPS; ++i) {
+        stats.Add(Stat::READS);
+        stats.Add(Stat::INDEX_MISSES);
+        stats.Add(Stat::INDEX_ENTRIES, 2);
+        stats.Add(Stat::INDEX_ENTRIES, -1);
+      }
+    });
+  }
+  for (auto& t: threads) t.join();
+  done = true;
+  reader.join();
+
+  StatsSnapshot snapshot = stats.Snapshot();
+  ASSERT_EQ(NUM_THREADS * NUM_OPS, snapshot[Stat::READS]);
+  ASSERT_EQ(NUM_THREADS * NUM_OPS, snapshot[Stat::INDEX_MISSES]);
+  ASSERT_EQ(NUM_THREADS * NUM_OPS, snapshot[Stat::INDEX_ENTRIES]);
+  ASSERT_EQ(NUM_THREADS * NUM_OPS, stats.Get(Stat::READS));
+}
+
+// Threads give their shards back when they exit, and the next owner carries on from their totals.
+TEST(Stats, ShortLivedThreads) {
+  constexpr int NUM_ROUNDS = 3 * Stats::NUM_SHARDS;
+  Stats stats;
+  for (int r = 0; r < NUM_ROUNDS; ++r) {
+    vector<thread> threads;
+    for (int t = 0; t < 2; ++t) {
+      threads.emplace_back([&]() {
+        for (int i = 0; i < 100; ++i) stats.Add(Stat::READS);
+      });
+    }
+    for (auto& t: threads) t.join();
+  }
+  ASSERT_EQ(NUM_ROUNDS * 2 * 100, stats.Get(Stat::READS));
+}
+
+TEST(Stats, Export) {
+  StatsSnapshot snapshot;
+  snapshot.Set(Stat::READS, 3);
+  snapshot.Set(Stat::LOG_CAPACITY, 1024);
+  StatsSnapshot other;
+  other.Set(Stat::READS, 2);
+  snapshot.Merge(other);
+  ASSERT_EQ(5, snapshot[Stat::READS]);
+
+  string json = snapshot.ToJson();
+  ASSERT_EQ('{', json.front());
+  ASSERT_EQ('}', json.back());
+  ASSERT_NE(string::npos, json.find("\"reads\": 5, \"index_misses\": 0"));
+  ASSERT_NE(string::npos, json.find("\"log_capacity\": 1024}"));
+
+  string text = snapshot.ToText();
+  ASSERT_EQ(0, text.find("reads 5\n"));
+  ASSERT_NE(string::npos, text.find("\nlog_capacity 1024\n"));
+  ASSERT_TRUE(StatsSnapshot::IsGauge(Stat::LIVE_BYTES));
+  ASSERT_FALSE(StatsSnapshot::IsGauge(Stat::EVICTIONS));
+}
+
+TEST(Stats, Stores) {
+  // One bucket, so the 16th key evicts.
+  vector<Entry> entries;
+  for (int i = 0; i < 20; ++i) entries.emplace_back("key" + to_string(i), "value");
+  string value;
+
+  FormicaStore formica(64 * 1024, 1);
+  for (const auto& e: entries) ASSERT_TRUE(formica.Insert(e));
+  ASSERT_TRUE(formica.Read(entries.back().key, entries.back().hash, &value));
+  ASSERT_FALSE(formica.Read("missing", Entry("missing", "").hash, &value));
+  ASSERT_TRUE(formica.Update(entries.back()));
+  ASSERT_TRUE(formica.Delete(entries.back().key, entries.back().hash));
+  StatsSnapshot stats = formica.stats();
+  ASSERT_EQ(20, stats[Stat::INSERTS]);
+  ASSERT_EQ(1, stats[Stat::UPDATES]);
+  ASSERT_EQ(1, stats[Stat::DELETES]);
+  ASSERT_EQ(2, stats[Stat::READS]);
+  ASSERT_EQ(1, stats[Stat::INDEX_MISSES] + stats[Stat::LOG_OTHER_KEY]);
+  ASSERT_EQ(5, stats[Stat::EVICTIONS]);
+  ASSERT_EQ(14, stats[Stat::INDEX_ENTRIES]);
+  ASSERT_EQ(15, stats[Stat::INDEX_CAPACITY]);
+  ASSERT_LT(0, stats[Stat::BYTES_WRITTEN]);
+  ASSERT_EQ(0, stats[Stat::LOG_WRAPS]);
+  ASSERT_EQ(64 * 1024, stats[Stat::LOG_CAPACITY]);
+
+  // In STORE mode, the bucket overflows instead.
+  FormicaStore lossless(64 * 1024, 1, StoreMode::STORE);
+  for (const auto& e: entries) ASSERT_TRUE(lossless.Insert(e));
+  stats = lossless.stats();
+  ASSERT_EQ(0, stats[Stat::EVICTIONS]);
+  ASSERT_EQ(20, stats[Stat::INDEX_ENTRIES]);
+  ASSERT_EQ(1, stats[Stat::OVERFLOW_BUCKETS]);
+  ASSERT_EQ(lossless.live_bytes(), stats[Stat::LIVE_BYTES]);
+
+  StdMapStore map(64 * 1024);
+  for (const auto& e: entries) ASSERT_TRUE(map.Insert(e));
+  ASSERT_FALSE(map.Read("missing", Entry("missing", "").hash, &value));
+  stats = map.stats();
+  ASSERT_EQ(20, stats[Stat::INSERTS]);
+  ASSERT_EQ(20, stats[Stat::INDEX_ENTRIES]);
+  ASSERT_EQ(1, stats[Stat::INDEX_MISSES]);
+  ASSERT_LT(0, stats[Stat::LIVE_BYTES]);
+  ASSERT_LE(stats[Stat::LIVE_BYTES], stats[Stat::BYTES_WRITTEN]);
+
+  ChainedLossyHashStore chained(1);
+  for (int i = 0; i < 30; ++i) chained.Insert(Entry("key" + to_string(i), "value"));
+  stats = chained.stats();
+  ASSERT_EQ(30, stats[Stat::INSERTS]);
+  ASSERT_EQ(6, stats[Stat::EVICTIONS]);
+  ASSERT_EQ(stats[Stat::INDEX_CAPACITY], stats[Stat::INDEX_ENTRIES]);
+}
+
+TEST(Trace, RecordAndReplay) {
+  string path = testing::TempDir() + "formica-test-trace";
+  string long_value(1000, 'v');
+  {
+    TraceWriter writer(path);
+    ASSERT_TRUE(writer.ok());
+    StdMapStore store(64 * 1024);
+    TracingStore<StdMapStore> traced(&store, &writer);
+    Entry entry("hello", "world"), big("big", long_value);
+    ASSERT_TRUE(traced.Insert(entry));
+    ASSERT_TRUE(traced.Insert(big, 10));
+    string value;
+    ASSERT_TRUE(traced.Read(entry.key, entry.hash, &value));
+    ASSERT_EQ("world", value);
+    ASSERT_TRUE(traced.Update(Entry("hello", "again")));
+    ASSERT_TRUE(traced.Delete(entry.key, entry.hash));
+    ASSERT_FALSE(traced.Read(entry.key, entry.hash, &value));
+    ASSERT_EQ(6, writer.records());
+    ASSERT_TRUE(writer.Flush());
+  }
+
+  TraceReader reader(path);
+  ASSERT_TRUE(reader.ok());
+  TraceRecord record;
+  vector<std::pair<TraceOp, string>> expected = {{TraceOp::PUT, "hello"}, {TraceOp::PUT, "big"},
+      {TraceOp::GET, "hello"}, {TraceOp::UPDATE, "hello"}, {TraceOp::DELETE, "hello"},
+      {TraceOp::GET, "hello"}};
+  for (const auto& e: expected) {
+    ASSERT_TRUE(reader.Next(&record));
+    ASSERT_EQ(e.first, record.op);
+    ASSERT_EQ(e.second, string(record.key, record.keylen));
+  }
+  ASSERT_FALSE(reader.Next(&record));
+  ASSERT_FALSE(reader.truncated());
+
+  vector<TraceOperation> ops;
+  ASSERT_TRUE(formica::LoadTrace(path, &ops));
+  ASSERT_EQ(6, ops.size());
+  ASSERT_EQ(long_value, ops[1].entry.value);
+  ASSERT_EQ("again", ops[3].entry.value);
+  ASSERT_EQ("", ops[4].entry.value);
+  ASSERT_EQ(Entry("hello", "").hash, ops[5].entry.hash);
+
+  ops.clear();
+  ASSERT_TRUE(formica::LoadTrace(path, &ops, 2));
+  ASSERT_EQ(2, ops.size());
+
+  // Cut off in the middle of the big value.
+  ASSERT_EQ(0, truncate(path.c_str(), 100));
+  ops.clear();
+  ASSERT_FALSE(formica::LoadTrace(path, &ops));
+  ASSERT_EQ(1, ops.size());
+
+  // Not a trace.
+  FILE* file = fopen(path.c_str(), "w");
+  fputs("hello, world", file);
+  fclose(file);
+  ASSERT_FALSE(TraceReader(path).ok());
+  ASSERT_FALSE(TraceReader("/nonexistent/trace").ok());
+  ASSERT_FALSE(TraceWriter("/nonexistent/trace").ok());
+  std::remove(path.c_str());
+}
+
+TEST(MemoryUsage, Stores) {
+  // Regions count in full, however little of them is used.
+  FormicaStore formica(64 * 1024, 16);
+  MemoryFootprint usage = formica.MemoryUsage();
+  ASSERT_EQ(formica.index_region().mapped_size, usage.index_bytes);
+  ASSERT_LE(16 * 128, usage.index_bytes);
+  ASSERT_LE(64 * 1024, usage.log_bytes);
+  ASSERT_LE(sizeof(FormicaStore), usage.overhead_bytes);
+  formica.EnableFrontCache(64 * 1024);
+  ASSERT_LE(usage.overhead_bytes + 64 * 1024, formica.MemoryUsage().overhead_bytes);
+
+  PartitionedStore partitioned(4, 64 * 1024, 16);
+  ASSERT_LE(4 * usage.total_bytes(), partitioned.MemoryUsage().total_bytes());
+
+  // The index grows with the keys, and long keys take more than short ones.
+  StdMapStore map(64 * 1024);
+  usage = map.MemoryUsage();
+  ASSERT_LE(64 * 1024, usage.log_bytes);
+  int64_t empty_index = usage.index_bytes;
+  for (int i = 0; i < 100; ++i) ASSERT_TRUE(map.Insert(Entry("k" + to_string(i), "value")));
+  int64_t short_keys = map.MemoryUsage().index_bytes - empty_index;
+  ASSERT_LE(100 * sizeof(string), short_keys);
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(map.Insert(Entry(string(100, 'k') + to_string(i), "value")));
+  }
+  ASSERT_LE(2 * short_keys + 100 * 100, map.MemoryUsage().index_bytes - empty_index);
+
+  // Chained stores keep keys and values on the heap, which is their log.
+  ChainedLossyHashStore chained(4);
+  usage = chained.MemoryUsage();
+  ASSERT_EQ(0, usage.log_bytes);
+  for (int i = 0; i < 10; ++i) chained.Insert(Entry("key" + to_string(i), string(1000, 'v')));
+  MemoryFootprint full = chained.MemoryUsage();
+  ASSERT_LT(usage.index_bytes, full.index_bytes);
+  ASSERT_LE(10 * 1000, full.log_bytes);
+  ASSERT_EQ(full.index_bytes + full.log_bytes + full.overhead_bytes, full.total_bytes());
+}
 
 int main(int argv, char** argc) {
   testing::InitGoogleTest(&argv, argc);
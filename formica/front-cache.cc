@@ -0,0 +1,154 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "front-cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "clock.h"
+
+namespace formica {
+
+using std::string;
+
+constexpr space_t FrontCache::DEFAULT_CAPACITY;
+constexpr int FrontCache::DEFAULT_SLOT_SIZE;
+
+// The doorkeeper has this many bits per slot, and is cleared after this many misses per slot.
+static constexpr int DOORKEEPER_BITS_PER_SLOT = 32;
+static constexpr int DOORKEEPER_RESET_PER_SLOT = 4;
+
+FrontCache::FrontCache(space_t capacity, int slot_size)
+    : slot_size_(slot_size), max_entry_size_(slot_size - sizeof(Slot)) {
+  assert(slot_size % 64 == 0 && max_entry_size_ > 0 && max_entry_size_ <= UINT16_MAX);
+  uint64_t num_slots = 1;
+  while (num_slots * 2 * slot_size <= capacity) num_slots *= 2;
+  mask_ = num_slots - 1;
+  doorkeeper_bits_ = num_slots * DOORKEEPER_BITS_PER_SLOT;
+
+  // The counters and doorkeeper are whole cache lines, so the slots stay aligned.
+  space_t counters_size = NUM_COUNTERS * sizeof(Counters);
+  space_t doorkeeper_size = std::max<space_t>(doorkeeper_bits_ / 8, 64);
+  region_ = AllocateRegion(counters_size + doorkeeper_size + num_slots * slot_size,
+      MemoryOptions());
+  CheckMapped(region_, "the front cache");
+
+  // The region is zeroed, which is what the atomics and every slot start as.
+  char* ptr = static_cast<char*>(region_.ptr);
+  counters_ = reinterpret_cast<Counters*>(ptr);
+  doorkeeper_ = reinterpret_cast<std::atomic<uint64_t>*>(ptr + counters_size);
+  slots_ = ptr + counters_size + doorkeeper_size;
+}
+
+FrontCache::~FrontCache() { FreeRegion(region_); }
+
+FrontCache::Counters* FrontCache::ThreadCounters() const {
+  static std::atomic<int> next_thread{0};
+  thread_local int idx = next_thread.fetch_add(1, std::memory_order_relaxed) % NUM_COUNTERS;
+  return &counters_[idx];
+}
+
+bool FrontCache::Read(const string& key, keyhash_t hash, string* value) {
+  Slot* slot = SlotFor(hash);
+  uint32_t version = slot->version.load(std::memory_order_acquire);
+
+  // The lengths may be changed by a concurrent write, so each is loaded once, and only the loaded
+  // copies, checked against the slot's size, are used to copy.
+  uint16_t keylen = __atomic_load_n(&slot->keylen, __ATOMIC_RELAXED);
+  uint16_t valuelen = __atomic_load_n(&slot->valuelen, __ATOMIC_RELAXED);
+  bool hit = (version & 1) == 0 && slot->used && slot->hash == hash &&
+      keylen == key.size() && keylen + valuelen <= max_entry_size_ &&
+      (slot->expiry == 0 || slot->expiry > CoarseClock::Now()) &&
+      memcmp(SlotData(slot), key.data(), key.size()) == 0;
+  if (hit) value->assign(SlotData(slot) + keylen, valuelen);
+  std::atomic_thread_fence(std::memory_order_acquire);
+  hit = hit && slot->version.load(std::memory_order_relaxed) == version;
+
+  Counters* counters = ThreadCounters();
+  (hit ? counters->hits : counters->misses).fetch_add(1, std::memory_order_relaxed);
+  return hit;
+}
+
+bool FrontCache::Admit(keyhash_t hash) {
+  if (doorkeeper_adds_.fetch_add(1, std::memory_order_relaxed) % (num_slots() *
+      DOORKEEPER_RESET_PER_SLOT) == 0) {
+    for (uint64_t i = 0; i < (doorkeeper_bits_ + 63) / 64; ++i) {
+      doorkeeper_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Uses other bits of the hash than SlotFor(), so that keys that share a slot don't also share a
+  // bit.
+  uint64_t bit = (hash >> 32) % doorkeeper_bits_;
+  uint64_t mask = 1ULL << (bit % 64);
+  std::atomic<uint64_t>* word = &doorkeeper_[bit / 64];
+  if ((word->load(std::memory_order_relaxed) & mask) != 0) return true;
+  word->fetch_or(mask, std::memory_order_relaxed);
+  return false;
+}
+
+void FrontCache::Fill(uint32_t ticket, const string& key, keyhash_t hash, const string& value,
+    uint32_t expiry) {
+  if ((ticket & 1) != 0 || key.size() + value.size() > max_entry_size_ || !Admit(hash)) return;
+  Slot* slot = SlotFor(hash);
+  // Fails if a write, or another fill, has come in since BeginFill().
+  if (!slot->version.compare_exchange_strong(ticket, ticket + 1, std::memory_order_relaxed)) {
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot->used = true;
+  slot->hash = hash;
+  slot->expiry = expiry;
+  slot->keylen = key.size();
+  slot->valuelen = value.size();
+  memcpy(SlotData(slot), key.data(), key.size());
+  memcpy(SlotData(slot) + key.size(), value.data(), value.size());
+  slot->version.store(ticket + 2, std::memory_order_release);
+}
+
+uint32_t FrontCache::Lock(Slot* slot) {
+  uint32_t version = slot->version.load(std::memory_order_relaxed);
+  while ((version & 1) != 0 ||
+      !slot->version.compare_exchange_weak(version, version + 1, std::memory_order_relaxed)) {
+    version = slot->version.load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  return version;
+}
+
+void FrontCache::Invalidate(keyhash_t hash) {
+  // The version changes even if the slot holds some other key, so that a reader that looked 'hash'
+  // up in the store before the write can't fill the slot with the old value.
+  Slot* slot = SlotFor(hash);
+  uint32_t version = Lock(slot);
+  if (slot->hash == hash) slot->used = false;
+  slot->version.store(version + 2, std::memory_order_release);
+}
+
+int64_t FrontCache::hits() const {
+  int64_t total = 0;
+  for (int i = 0; i < NUM_COUNTERS; ++i) total += counters_[i].hits.load(std::memory_order_relaxed);
+  return total;
+}
+
+int64_t FrontCache::misses() const {
+  int64_t total = 0;
+  for (int i = 0; i < NUM_COUNTERS; ++i) {
+    total += counters_[i].misses.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+}
@@ -0,0 +1,118 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "common.h"
+#include "memory.h"
+
+namespace formica {
+
+// A small, direct-mapped cache of hot (key, value) pairs, which a store checks before its own index
+// and log. With a skewed workload, most reads are for a few thousand keys, and a cache small enough
+// to stay in L2 serves them with one or two cache lines, rather than a bucket and a log entry that
+// are usually in DRAM.
+//
+// Each slot holds one key and its value, and has its own version, used as a seqlock as in
+// LossyHash: Read() never blocks, and misses if the slot is being written. Any number of threads may
+// call Read() and Fill() while the store's writer calls Invalidate().
+//
+// A key is only admitted the second time that it misses within a while, so that keys that are read
+// once don't evict hot ones. The record of recent misses is a bitmap (a "doorkeeper", as in
+// TinyLFU), which is cleared every few times the cache's size in misses.
+class FrontCache {
+ public:
+  // Entries whose key and value don't fit in a slot of 'slot_size' bytes, less a small header, are
+  // never cached. 'capacity' is rounded down to a power of two number of slots.
+  FrontCache(space_t capacity = DEFAULT_CAPACITY, int slot_size = DEFAULT_SLOT_SIZE);
+  ~FrontCache();
+
+  // Half of a typical L2, leaving the rest for the index and log lines that the misses touch.
+  static constexpr space_t DEFAULT_CAPACITY = 512 * 1024;
+  static constexpr int DEFAULT_SLOT_SIZE = 256;
+
+  // Returns false if 'key' isn't cached, or has expired.
+  bool Read(const std::string& key, keyhash_t hash, std::string* value);
+
+  // A reader that missed fills the cache from the store by calling BeginFill() before reading the
+  // store, and Fill() with what it read after. Fill() does nothing if the slot has been filled or
+  // invalidated since BeginFill(), so a value that a concurrent write has replaced is never cached.
+  uint32_t BeginFill(keyhash_t hash) {
+    return SlotFor(hash)->version.load(std::memory_order_acquire);
+  }
+  void Fill(uint32_t ticket, const std::string& key, keyhash_t hash, const std::string& value,
+      uint32_t expiry);
+
+  // Must be called after every write to 'hash' in the store, whether or not the key is cached.
+  void Invalidate(keyhash_t hash);
+
+  // Counted per thread, and summed when asked for, so that hits don't all write one cache line.
+  int64_t hits() const;
+  int64_t misses() const;
+
+  int64_t num_slots() const { return mask_ + 1; }
+  int slot_size() const { return slot_size_; }
+
+  const Region& region() const { return region_; }
+
+ private:
+  // The header at the start of each slot. The key follows it, and then the value.
+  struct Slot {
+    // Odd while the slot is being written.
+    std::atomic<uint32_t> version;
+    uint32_t expiry;
+    keyhash_t hash;
+    uint16_t keylen;
+    uint16_t valuelen;
+    bool used;
+  };
+
+  struct alignas(64) Counters {
+    std::atomic<int64_t> hits;
+    std::atomic<int64_t> misses;
+  };
+  static constexpr int NUM_COUNTERS = 16;
+
+  Slot* SlotFor(keyhash_t hash) const {
+    return reinterpret_cast<Slot*>(slots_ + (ExtractLogTag(hash) & mask_) * slot_size_);
+  }
+  static char* SlotData(Slot* slot) { return reinterpret_cast<char*>(slot + 1); }
+
+  // The Counters for the calling thread, which may share them with others if there are more than
+  // NUM_COUNTERS threads.
+  Counters* ThreadCounters() const;
+
+  // Records a miss for 'hash', and returns true if it had missed recently enough to be admitted.
+  bool Admit(keyhash_t hash);
+
+  // Spins until the slot's version is even, and makes it odd.
+  static uint32_t Lock(Slot* slot);
+
+  const int slot_size_;
+  // The most that a slot's key and value may take up.
+  const int max_entry_size_;
+  uint64_t mask_ = 0;
+
+  // One region holds the counters, the doorkeeper and then the slots.
+  Region region_;
+  Counters* counters_;
+  std::atomic<uint64_t>* doorkeeper_;
+  uint64_t doorkeeper_bits_;
+  std::atomic<uint64_t> doorkeeper_adds_{0};
+  char* slots_;
+};
+
+}
@@ -0,0 +1,179 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "hash.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace formica {
+
+using std::string;
+
+static inline uint64_t Read64(const char* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t Read32(const char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t Mix(uint64_t a, uint64_t b) {
+  __uint128_t r = static_cast<__uint128_t>(a) * b;
+  return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+}
+
+static constexpr uint64_t WY_SECRET[4] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+    0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+
+keyhash_t WyHash::Hash(const string& key) {
+  const char* p = key.data();
+  size_t len = key.size();
+  uint64_t seed = Mix(WY_SECRET[0], WY_SECRET[1]);
+  uint64_t a, b;
+  if (len <= 16) {
+    if (len >= 4) {
+      // Two overlapping reads from each end cover every byte.
+      a = (Read32(p) << 32) | Read32(p + ((len >> 3) << 2));
+      b = (Read32(p + len - 4) << 32) | Read32(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = (static_cast<uint64_t>(static_cast<uint8_t>(p[0])) << 16) |
+          (static_cast<uint64_t>(static_cast<uint8_t>(p[len >> 1])) << 8) |
+          static_cast<uint8_t>(p[len - 1]);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      // Three independent lanes, so the multiplies overlap.
+      uint64_t seed1 = seed, seed2 = seed;
+      do {
+        seed = Mix(Read64(p) ^ WY_SECRET[1], Read64(p + 8) ^ seed);
+        seed1 = Mix(Read64(p + 16) ^ WY_SECRET[2], Read64(p + 24) ^ seed1);
+        seed2 = Mix(Read64(p + 32) ^ WY_SECRET[3], Read64(p + 40) ^ seed2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (i > 16) {
+      seed = Mix(Read64(p) ^ WY_SECRET[1], Read64(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = Read64(p + i - 16);
+    b = Read64(p + i - 8);
+  }
+  return Mix(WY_SECRET[1] ^ len, Mix(a ^ WY_SECRET[1], b ^ seed) ^ WY_SECRET[0]);
+}
+
+// Multiplies words for the second CRC lane.
+static constexpr uint64_t CRC_LANE_MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+
+// The 64-bit finalizer from MurmurHash3. A bijection, so no information from either lane is lost.
+static inline uint64_t Finalize(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Both versions of Crc32cHash::Hash() start both lanes at this, and pad the last word with zeroes.
+static constexpr uint64_t CRC_INIT = 0xffffffff;
+
+static inline keyhash_t CombineLanes(uint64_t low, uint64_t high, size_t len) {
+  return Finalize(((high << 32) | low) ^ len);
+}
+
+// CRC32C (Castagnoli) with the reflected polynomial, one byte at a time.
+struct Crc32cTable {
+  uint32_t entries[256];
+
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+      entries[i] = crc;
+    }
+  }
+};
+static const Crc32cTable CRC32C_TABLE;
+
+static inline uint64_t Crc32cPortable(uint64_t crc, uint64_t word) {
+  for (int i = 0; i < 8; ++i, word >>= 8) {
+    crc = CRC32C_TABLE.entries[(crc ^ word) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+keyhash_t Crc32cHash::HashPortable(const string& key) {
+  const char* p = key.data();
+  size_t len = key.size();
+  uint64_t low = CRC_INIT, high = CRC_INIT;
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t word = Read64(p);
+    low = Crc32cPortable(low, word);
+    high = Crc32cPortable(high, word * CRC_LANE_MULTIPLIER);
+  }
+  if (len > 0) {
+    uint64_t word = 0;
+    memcpy(&word, p, len);
+    low = Crc32cPortable(low, word);
+    high = Crc32cPortable(high, word * CRC_LANE_MULTIPLIER);
+  }
+  return CombineLanes(low, high, key.size());
+}
+
+#if defined(__x86_64__)
+// The same as HashPortable(), but with the crc32 instruction, which the rest of the file can't be
+// compiled to use since not every x86-64 CPU has it.
+__attribute__((target("sse4.2")))
+static keyhash_t HashSse42(const string& key) {
+  const char* p = key.data();
+  size_t len = key.size();
+  uint64_t low = CRC_INIT, high = CRC_INIT;
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t word = Read64(p);
+    low = _mm_crc32_u64(low, word);
+    high = _mm_crc32_u64(high, word * CRC_LANE_MULTIPLIER);
+  }
+  if (len > 0) {
+    uint64_t word = 0;
+    memcpy(&word, p, len);
+    low = _mm_crc32_u64(low, word);
+    high = _mm_crc32_u64(high, word * CRC_LANE_MULTIPLIER);
+  }
+  return CombineLanes(low, high, key.size());
+}
+
+static const bool HAS_SSE42 = __builtin_cpu_supports("sse4.2");
+#endif
+
+keyhash_t Crc32cHash::Hash(const string& key) {
+#if defined(__x86_64__)
+  if (HAS_SSE42) return HashSse42(key);
+#endif
+  return HashPortable(key);
+}
+
+}
@@ -0,0 +1,52 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace formica {
+
+typedef size_t keyhash_t;
+
+// Hash policies for keys, to be passed to Entry and the stores. The stores use the low 32 bits of
+// a hash (see ExtractLogTag()) and the high 32 bits (see ExtractHashTag()) for different purposes,
+// so both halves must be well mixed.
+
+// std::hash, whose speed and quality depend on the standard library. The default, so that existing
+// file-backed logs can still be read.
+struct StdHash {
+  static keyhash_t Hash(const std::string& key) { return std::hash<std::string>{}(key); }
+};
+
+// In the style of wyhash: mixes 16 bytes at a time with 64x64->128-bit multiplies. Fast at every key
+// size.
+struct WyHash {
+  static keyhash_t Hash(const std::string& key);
+};
+
+// Two CRC32C lanes over the key's 8-byte words, the second over each word multiplied by an odd
+// constant so that the lanes aren't linearly related, combined by a 64-bit finalizer. Uses the
+// SSE4.2 crc32 instruction if the CPU has it, and a table otherwise; both give the same hashes.
+struct Crc32cHash {
+  static keyhash_t Hash(const std::string& key);
+
+  // The table-driven version, for testing.
+  static keyhash_t HashPortable(const std::string& key);
+};
+
+typedef keyhash_t (*HashFunction)(const std::string& key);
+typedef StdHash DefaultHash;
+
+}
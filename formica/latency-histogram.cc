@@ -0,0 +1,57 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "latency-histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace formica {
+
+LatencyHistogram::LatencyHistogram(int sample_interval) {
+  uint64_t interval = 1;
+  while (interval * 2 <= static_cast<uint64_t>(std::max(sample_interval, 1))) interval *= 2;
+  sample_mask_ = interval - 1;
+}
+
+uint64_t LatencyHistogram::BucketMax(int bucket) {
+  if (bucket < 2 * SUB_BUCKETS) return bucket;
+  int shift = (bucket >> SUB_BUCKET_BITS) - 1;
+  uint64_t sub_bucket = (bucket & (SUB_BUCKETS - 1)) | SUB_BUCKETS;
+  // For the very last bucket, this wraps around to the largest uint64_t, as it should.
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::Percentile(double percentile) const {
+  if (count_ == 0) return 0;
+  uint64_t rank = std::ceil(count_ * std::min(percentile, 100.0) / 100.0);
+  rank = std::max<uint64_t>(rank, 1);
+  uint64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) return std::min(BucketMax(i), max_);
+  }
+  return max_;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  for (int i = 0; i < NUM_BUCKETS; ++i) buckets_[i] += other.buckets_[i];
+  count_ += other.count_;
+  max_ = std::max(max_, other.max_);
+}
+
+void LatencyHistogram::Reset() {
+  std::fill(buckets_, buckets_ + NUM_BUCKETS, 0);
+  count_ = max_ = sampled_ops_ = 0;
+}
+
+}
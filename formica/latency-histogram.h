@@ -0,0 +1,87 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+
+#include "clock.h"
+
+namespace formica {
+
+// A histogram of latencies, laid out as in HdrHistogram: values are bucketed by their highest set
+// bit, and each power of two is split into 2^SUB_BUCKET_BITS linear sub-buckets, so every value is
+// recorded to within 1 / 2^SUB_BUCKET_BITS (about 3%) of itself, from a single cycle up to 2^64.
+// The buckets are a fixed array, so recording never allocates, and is a few instructions.
+//
+// A histogram belongs to one thread. Merge() the histograms of several threads to report on them
+// together.
+//
+// Operations are timed with CycleClock, and Begin() and End() can time only one in every
+// 'sample_interval' of them, to keep the cost of reading the clock out of the rest:
+//
+//   uint64_t start = histogram.Begin();
+//   DoOperation();
+//   histogram.End(start);
+class LatencyHistogram {
+ public:
+  // 'sample_interval' is rounded down to a power of two.
+  explicit LatencyHistogram(int sample_interval = 1);
+
+  // Returns the time if this operation should be timed, or 0 if not.
+  uint64_t Begin() {
+    return (sampled_ops_++ & sample_mask_) == 0 ? CycleClock::Now() : 0;
+  }
+  void End(uint64_t start) {
+    if (start != 0) Record(CycleClock::Now() - start);
+  }
+
+  void Record(uint64_t value) {
+    ++buckets_[BucketFor(value)];
+    ++count_;
+    if (value > max_) max_ = value;
+  }
+
+  // Returns the smallest value that at least 'percentile'% of the recorded values are no greater
+  // than, to within the precision of its bucket, or 0 if nothing has been recorded.
+  uint64_t Percentile(double percentile) const;
+
+  uint64_t count() const { return count_; }
+  uint64_t max() const { return max_; }
+
+  void Merge(const LatencyHistogram& other);
+  void Reset();
+
+  static constexpr int SUB_BUCKET_BITS = 5;
+
+ private:
+  static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  // Values below 2 * SUB_BUCKETS have a bucket each; every higher power of two has SUB_BUCKETS.
+  static constexpr int NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  static int BucketFor(uint64_t value) {
+    if (value < 2 * SUB_BUCKETS) return value;
+    int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+    return ((shift + 1) << SUB_BUCKET_BITS) + ((value >> shift) & (SUB_BUCKETS - 1));
+  }
+
+  // The largest value that goes in 'bucket'.
+  static uint64_t BucketMax(int bucket);
+
+  uint64_t sample_mask_;
+  uint64_t sampled_ops_ = 0;
+  uint64_t count_ = 0;
+  uint64_t max_ = 0;
+  uint64_t buckets_[NUM_BUCKETS] = {};
+};
+
+}
@@ -0,0 +1,152 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "memory.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+namespace formica {
+
+static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static size_t RoundUp(size_t size, size_t multiple) {
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+// Maps 'size' bytes aligned to a huge page boundary, so that transparent huge pages can back all of
+// it. Over-allocates by a huge page and trims the unaligned ends.
+static void* MapHugeAligned(size_t size) {
+  size_t padded = size + HUGE_PAGE_SIZE;
+  void* map = mmap(0, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (map == MAP_FAILED) return nullptr;
+
+  uintptr_t start = reinterpret_cast<uintptr_t>(map);
+  uintptr_t aligned = RoundUp(start, HUGE_PAGE_SIZE);
+  if (aligned > start) munmap(map, aligned - start);
+  size_t tail = (start + padded) - (aligned + size);
+  if (tail > 0) munmap(reinterpret_cast<void*>(aligned + size), tail);
+  return reinterpret_cast<void*>(aligned);
+}
+
+// Binds [ptr, ptr + size) to 'node'. Must be called before the memory is first touched.
+static bool BindToNode(void* ptr, size_t size, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  // Called directly rather than through libnuma, to avoid the dependency.
+  constexpr int MPOL_BIND_MODE = 2;
+  constexpr int MAX_NODES = 1024;
+  if (node < 0 || node >= MAX_NODES) return false;
+  unsigned long nodemask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+  nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+  return syscall(SYS_mbind, ptr, size, MPOL_BIND_MODE, nodemask, MAX_NODES + 1, 0) == 0;
+#else
+  return false;
+#endif
+}
+
+Region AllocateRegion(size_t size, const MemoryOptions& options) {
+  Region region;
+  if (options.huge_pages) {
+#if defined(MAP_HUGETLB)
+    size_t huge_size = RoundUp(size, HUGE_PAGE_SIZE);
+    void* map = mmap(0, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_HUGETLB,
+        -1, 0);
+    if (map != MAP_FAILED) {
+      region = {map, huge_size, PageKind::EXPLICIT_HUGE};
+    }
+#endif
+#if defined(MADV_HUGEPAGE)
+    if (region.ptr == nullptr) {
+      size_t huge_size = RoundUp(size, HUGE_PAGE_SIZE);
+      void* map = MapHugeAligned(huge_size);
+      if (map != nullptr) {
+        bool advised = madvise(map, huge_size, MADV_HUGEPAGE) == 0;
+        region = {map, huge_size, advised ? PageKind::TRANSPARENT_HUGE : PageKind::NORMAL};
+      }
+    }
+#endif
+  }
+
+  if (region.ptr == nullptr) {
+    void* map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (map == MAP_FAILED) return region;
+    region = {map, size, PageKind::NORMAL};
+  }
+
+  if (options.numa_node != -1) {
+    region.numa_bound = BindToNode(region.ptr, region.mapped_size, options.numa_node);
+  }
+  return region;
+}
+
+void FreeRegion(const Region& region) {
+  if (region.ptr != nullptr) munmap(region.ptr, region.mapped_size);
+}
+
+void CheckMapped(const Region& region, const std::string& what) {
+  if (region.ptr != nullptr) return;
+  std::cerr << "Could not map " << what << ": " << strerror(errno) << std::endl;
+  throw std::bad_alloc();
+}
+
+Region MapFile(const std::string& path, size_t size, bool* existed) {
+  Region region;
+  int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd == -1) return region;
+
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  *existed = ok && st.st_size >= size;
+  if (ok && !*existed) ok = ftruncate(fd, size) == 0;
+  if (ok) {
+    void* map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED) region = {map, size, PageKind::NORMAL};
+  }
+
+  // The mapping keeps the file open.
+  close(fd);
+  return region;
+}
+
+Region MapFileForRead(const std::string& path) {
+  Region region;
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) return region;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      region = {map, static_cast<size_t>(st.st_size), PageKind::NORMAL};
+    }
+  }
+  close(fd);
+  return region;
+}
+
+bool SyncRegion(const Region& region) {
+  return region.ptr != nullptr && msync(region.ptr, region.mapped_size, MS_SYNC) == 0;
+}
+
+}
@@ -0,0 +1,93 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace formica {
+
+// How the large regions behind logs and indexes are allocated.
+struct MemoryOptions {
+  // With multi-GB logs and random access, TLB misses dominate. If set, try explicit huge pages
+  // (MAP_HUGETLB) first, which need to be reserved by the administrator, then transparent huge
+  // pages, then fall back to normal pages.
+  bool huge_pages = false;
+
+  // If not -1, bind the memory to this NUMA node, e.g. the node of the core that will use it.
+  int numa_node = -1;
+};
+
+// What kind of pages a region actually got.
+enum class PageKind {
+  NORMAL,
+  TRANSPARENT_HUGE,
+  EXPLICIT_HUGE
+};
+
+// A zeroed (or file-backed), page-aligned region of memory.
+struct Region {
+  void* ptr = nullptr;
+  // May be larger than requested, e.g. rounded up to a whole number of huge pages.
+  size_t mapped_size = 0;
+  PageKind page_kind = PageKind::NORMAL;
+  // Whether the NUMA binding in MemoryOptions succeeded.
+  bool numa_bound = false;
+};
+
+// Where a store's memory goes, in bytes. Regions count in full, since they are sized up front,
+// whether or not all of their pages have been touched yet. Heap allocations are counted from the
+// sizes of the objects in them, so don't include malloc's own overhead.
+struct MemoryFootprint {
+  // What finds entries: hash buckets, or map nodes and their keys.
+  int64_t index_bytes = 0;
+  // Where keys and values are kept.
+  int64_t log_bytes = 0;
+  // Everything else: the store itself, its front cache, and other bookkeeping.
+  int64_t overhead_bytes = 0;
+
+  int64_t total_bytes() const { return index_bytes + log_bytes + overhead_bytes; }
+
+  void Merge(const MemoryFootprint& other) {
+    index_bytes += other.index_bytes;
+    log_bytes += other.log_bytes;
+    overhead_bytes += other.overhead_bytes;
+  }
+};
+
+// Returns a region with ptr == nullptr if no memory could be mapped at all. Failing to get huge
+// pages, or to bind to a NUMA node, is not an error; check the returned Region to see what
+// happened.
+Region AllocateRegion(size_t size, const MemoryOptions& options);
+void FreeRegion(const Region& region);
+
+// For owners that can't work without their region: if 'region' wasn't mapped, prints 'what' and
+// errno to stderr and throws std::bad_alloc.
+void CheckMapped(const Region& region, const std::string& what);
+
+// Maps the first 'size' bytes of the file at 'path' with MAP_SHARED, so that writes to the region
+// outlive the process. The file is created, or extended with zeroes, if it is shorter than 'size'.
+// Sets 'existed' to whether it already held 'size' bytes. Returns a region with ptr == nullptr if
+// the file couldn't be opened or mapped. Freed with FreeRegion().
+Region MapFile(const std::string& path, size_t size, bool* existed);
+
+// Maps all of the existing file at 'path', read-only, for reading through once. Returns a region
+// with ptr == nullptr if the file couldn't be opened or mapped, or is empty. Freed with
+// FreeRegion().
+Region MapFileForRead(const std::string& path);
+
+// Writes a file-backed region's dirty pages to disk. Returns false on failure.
+bool SyncRegion(const Region& region);
+
+}
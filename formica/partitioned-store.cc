@@ -0,0 +1,71 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "partitioned-store.h"
+
+#include <cassert>
+
+namespace formica {
+
+using std::string;
+using std::vector;
+
+PartitionedStore::PartitionedStore(int num_partitions, space_t size, bucket_count_t num_buckets,
+    const vector<MemoryOptions>& partition_memory)
+    : num_partitions_(num_partitions) {
+  assert(num_partitions_ > 0);
+  for (int i = 0; i < num_partitions_; ++i) {
+    MemoryOptions options = i < partition_memory.size() ? partition_memory[i] : MemoryOptions();
+    partitions_.emplace_back(new FormicaStore(size, num_buckets, options));
+  }
+}
+
+bool PartitionedStore::Insert(const Entry& entry, uint32_t ttl_seconds) {
+  return partitions_[PartitionFor(entry.hash)]->Insert(entry, ttl_seconds);
+}
+
+bool PartitionedStore::Read(const string& key, keyhash_t hash, string* value) {
+  return partitions_[PartitionFor(hash)]->Read(key, hash, value);
+}
+
+int64_t PartitionedStore::index_misses() const {
+  int64_t total = 0;
+  for (auto& p: partitions_) total += p->index_misses();
+  return total;
+}
+
+int64_t PartitionedStore::log_overwritten() const {
+  int64_t total = 0;
+  for (auto& p: partitions_) total += p->log_overwritten();
+  return total;
+}
+
+int64_t PartitionedStore::log_other_key() const {
+  int64_t total = 0;
+  for (auto& p: partitions_) total += p->log_other_key();
+  return total;
+}
+
+StatsSnapshot PartitionedStore::stats() const {
+  StatsSnapshot total;
+  for (auto& p: partitions_) total.Merge(p->stats());
+  return total;
+}
+
+MemoryFootprint PartitionedStore::MemoryUsage() const {
+  MemoryFootprint total;
+  for (auto& p: partitions_) total.Merge(p->MemoryUsage());
+  total.overhead_bytes += sizeof(*this);
+  return total;
+}
+
+}
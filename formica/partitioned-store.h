@@ -0,0 +1,72 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "store.h"
+
+namespace formica {
+
+// PartitionedStore splits the keyspace into a number of independent FormicaStores, each with its
+// own LossyHash and CircularLog, so that each one can be owned by a single core. The store doesn't
+// start any threads of its own: callers route each request to the thread that owns
+// PartitionFor(hash). Ownership is a convention, not something that is checked.
+//
+// Only the owning thread may write to a partition, but any thread may read from it, as in MICA's
+// CREW (Concurrent Read, Exclusive Write) mode. There is no separate EREW mode: FormicaStore's
+// readers already validate against a single concurrent writer, and a read path that skipped that
+// would save little, so callers that keep reads on the owning thread (as Dispatcher does) just get
+// EREW's access pattern with the same code.
+class PartitionedStore {
+ public:
+  // 'size' and 'num_buckets' are per-partition. 'partition_memory' optionally gives the
+  // MemoryOptions for each partition, e.g. to put each one on the NUMA node of its owning core.
+  PartitionedStore(int num_partitions, space_t size, bucket_count_t num_buckets,
+      const std::vector<MemoryOptions>& partition_memory = {});
+
+  // Returns the partition that owns 'hash'. Every bit of the hash already picks a bucket or makes
+  // up a tag, so a partition taken straight from some of them would leave those bits the same for
+  // all of its keys, and it would only ever use a fraction of its buckets (or front cache slots).
+  // Instead, the whole hash is mixed with a multiply, whose top bits depend on all of it, so that
+  // the keys in one partition still spread over all of its buckets.
+  int PartitionFor(keyhash_t hash) const {
+    return ((hash * 0x9e3779b97f4a7c15ULL) >> 32) % num_partitions_;
+  }
+
+  // Must be called from the thread that owns PartitionFor(entry.hash).
+  bool Insert(const Entry& entry, uint32_t ttl_seconds = 0);
+
+  // May be called from any thread.
+  bool Read(const std::string& key, keyhash_t hash, std::string* value);
+
+  int num_partitions() const { return num_partitions_; }
+
+  FormicaStore* partition(int idx) { return partitions_[idx].get(); }
+
+  // Totals over all partitions.
+  int64_t index_misses() const;
+  int64_t log_overwritten() const;
+  int64_t log_other_key() const;
+  StatsSnapshot stats() const;
+  MemoryFootprint MemoryUsage() const;
+
+ private:
+  const int num_partitions_;
+
+  // Each partition is allocated separately, so that no two partitions share a cache line.
+  std::vector<std::unique_ptr<FormicaStore>> partitions_;
+};
+
+}
@@ -0,0 +1,128 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "perf-counters.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+
+namespace formica {
+
+#if defined(__linux__)
+
+static int OpenEvent(PerfCounters::Event event) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  switch (event) {
+    case PerfCounters::INSTRUCTIONS:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PerfCounters::BRANCH_MISSES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case PerfCounters::L1D_MISSES:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    case PerfCounters::LLC_MISSES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    case PerfCounters::DTLB_MISSES:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    default:
+      return -1;
+  }
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  // This thread, on any CPU.
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+PerfCounters::PerfCounters() {
+  for (int i = 0; i < NUM_EVENTS; ++i) fds_[i] = OpenEvent(static_cast<Event>(i));
+}
+
+PerfCounters::~PerfCounters() {
+  for (int fd: fds_) {
+    if (fd >= 0) close(fd);
+  }
+}
+
+void PerfCounters::Start() {
+  for (int fd: fds_) {
+    if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+void PerfCounters::Stop() {
+  for (int fd: fds_) {
+    if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+}
+
+uint64_t PerfCounters::Read(Event event) const {
+  if (!available(event)) return 0;
+  // The value, then the time enabled and the time running, in ns.
+  uint64_t values[3];
+  if (read(fds_[event], values, sizeof(values)) != sizeof(values) || values[2] == 0) return 0;
+  if (values[2] == values[1]) return values[0];
+  return static_cast<double>(values[0]) * values[1] / values[2];
+}
+
+#else
+
+PerfCounters::PerfCounters() {
+  for (int i = 0; i < NUM_EVENTS; ++i) fds_[i] = -1;
+}
+
+PerfCounters::~PerfCounters() { }
+void PerfCounters::Start() { }
+void PerfCounters::Stop() { }
+uint64_t PerfCounters::Read(Event event) const { return 0; }
+
+#endif
+
+bool PerfCounters::available() const {
+  for (int fd: fds_) {
+    if (fd >= 0) return true;
+  }
+  return false;
+}
+
+std::string PerfCounters::Name(Event event) {
+  switch (event) {
+    case INSTRUCTIONS: return "Instructions";
+    case BRANCH_MISSES: return "Branch misses";
+    case L1D_MISSES: return "L1d misses";
+    case LLC_MISSES: return "LLC misses";
+    case DTLB_MISSES: return "dTLB misses";
+    default: return "";
+  }
+}
+
+}
@@ -0,0 +1,65 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace formica {
+
+// Hardware performance counters for the calling thread, read with perf_event_open(), e.g. to
+// compare index and log layouts by cache misses per operation rather than by time alone.
+//
+// Each event is opened on its own rather than as a group, so that a CPU or VM that lacks some of
+// them still counts the rest. If the kernel has more events open than the PMU has counters, it
+// multiplexes them, and values are scaled up from the time each was actually counting.
+//
+// Counters are unavailable off Linux, in containers that block perf_event_open(), or when
+// /proc/sys/kernel/perf_event_paranoid is above 2. In that case available() is false and every
+// value reads as 0. Only user-space events are counted, which an unprivileged process may do.
+class PerfCounters {
+ public:
+  enum Event {
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    LLC_MISSES,
+    DTLB_MISSES,
+    NUM_EVENTS
+  };
+
+  PerfCounters();
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  // Counting is cumulative across Start() / Stop() pairs.
+  void Start();
+  void Stop();
+
+  // Whether any event could be opened, and whether 'event' could.
+  bool available() const;
+  bool available(Event event) const { return fds_[event] >= 0; }
+
+  // The count of 'event' while started, or 0 if it is not available.
+  uint64_t Read(Event event) const;
+
+  // A short name for 'event', e.g. "LLC misses".
+  static std::string Name(Event event);
+
+ private:
+  int fds_[NUM_EVENTS];
+};
+
+}
@@ -0,0 +1,136 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "segmented-log.h"
+
+#include <cassert>
+#include <cstring>
+
+using std::string;
+
+namespace formica {
+
+struct SegmentEntryHeader {
+  entrysize_t keylen;
+  entrysize_t valuelen;
+  tag_t tag;
+  uint32_t expiry;
+};
+
+SegmentedLog::SegmentedLog(space_t size, space_t segment_size, const MemoryOptions& options)
+    : segment_size_(segment_size) {
+  assert(segment_size_ > sizeof(SegmentEntryHeader));
+  int num_segments = size / segment_size_;
+  assert(num_segments >= 2);
+  region_ = AllocateRegion(num_segments * segment_size_, options);
+  CheckMapped(region_, "the segmented log");
+  bufptr_ = reinterpret_cast<int8_t*>(region_.ptr);
+  segments_.resize(num_segments);
+  // Hands out segments from the start of the buffer first.
+  for (int i = num_segments - 1; i >= 0; --i) free_.push_back(i);
+}
+
+SegmentedLog::~SegmentedLog() {
+  FreeRegion(region_);
+}
+
+offset_t SegmentedLog::Append(const string& key, const string& value, keyhash_t hash,
+    Stream stream, int reserve, uint32_t expiry) {
+  space_t required = SpaceFor(key, value);
+  if (required > segment_size_) return -1;
+
+  int* open = &open_[static_cast<int>(stream)];
+  if (*open == -1 || segments_[*open].used + required > segment_size_) {
+    if (free_.size() <= reserve) return -1;
+    if (*open != -1) segments_[*open].full = true;
+    *open = free_.back();
+    free_.pop_back();
+  }
+
+  Segment* segment = &segments_[*open];
+  offset_t offset = SegmentStart(*open) + segment->used;
+  int8_t* ptr = bufptr_ + offset;
+  SegmentEntryHeader header = {static_cast<entrysize_t>(key.size()),
+      static_cast<entrysize_t>(value.size()), ExtractLogTag(hash), expiry};
+  memcpy(ptr, &header, sizeof(header));
+  memcpy(ptr + sizeof(header), key.data(), key.size());
+  memcpy(ptr + sizeof(header) + key.size(), value.data(), value.size());
+  segment->used += required;
+  segment->live += required;
+  live_bytes_ += required;
+  return offset;
+}
+
+void SegmentedLog::Scan(offset_t offset, ScannedEntry* entry) const {
+  SegmentEntryHeader header;
+  memcpy(&header, bufptr_ + offset, sizeof(header));
+  const char* key = reinterpret_cast<const char*>(bufptr_ + offset + sizeof(header));
+  entry->key.data = key;
+  entry->key.len = header.keylen;
+  entry->value.data = key + header.keylen;
+  entry->value.len = header.valuelen;
+  entry->key.entry_offset = entry->value.entry_offset = offset;
+  entry->tag = header.tag;
+  entry->expiry = header.expiry;
+  entry->next = offset + sizeof(header) + header.keylen + header.valuelen;
+}
+
+bool SegmentedLog::Read(offset_t offset, keyhash_t expected, LogSlice* key,
+    LogSlice* value) const {
+  ScannedEntry entry;
+  Scan(offset, &entry);
+  if (entry.tag != ExtractLogTag(expected)) return false;
+  if (entry.expiry != 0 && entry.expiry <= CoarseClock::Now()) return false;
+  *key = entry.key;
+  *value = entry.value;
+  value->expiry = entry.expiry;
+  return true;
+}
+
+bool SegmentedLog::IsExpired(offset_t offset) const {
+  ScannedEntry entry;
+  Scan(offset, &entry);
+  return entry.expiry != 0 && entry.expiry <= CoarseClock::Now();
+}
+
+void SegmentedLog::MarkDead(offset_t offset) {
+  SegmentEntryHeader header;
+  memcpy(&header, bufptr_ + offset, sizeof(header));
+  space_t space = sizeof(header) + header.keylen + header.valuelen;
+  Segment* segment = &segments_[offset / segment_size_];
+  assert(segment->live >= space);
+  segment->live -= space;
+  live_bytes_ -= space;
+}
+
+int SegmentedLog::PickVictim() const {
+  int victim = -1;
+  for (int i = 0; i < segments_.size(); ++i) {
+    const Segment& segment = segments_[i];
+    if (!segment.full || segment.live == segment.used) continue;
+    if (victim == -1 || segment.live < segments_[victim].live) victim = i;
+  }
+  return victim;
+}
+
+void SegmentedLog::Free(int segment) {
+  assert(segments_[segment].full);
+  live_bytes_ -= segments_[segment].live;
+  segments_[segment] = Segment();
+  free_.push_back(segment);
+}
+
+space_t SegmentedLog::SpaceFor(const string& key, const string& value) {
+  return sizeof(SegmentEntryHeader) + key.size() + value.size();
+}
+
+}
@@ -0,0 +1,111 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "circular-log.h"
+#include "common.h"
+#include "memory.h"
+
+namespace formica {
+
+// A log for stores that index every key, and so must never overwrite a live entry. The buffer is
+// split into fixed-size segments. Writes are appended to an open segment, and when it fills up, a
+// new one is taken from the free list. The log counts the live bytes in every segment, so that a
+// cleaner can pick the segments that are mostly dead, copy their live entries to the tail, and
+// free them (see StdMapStore).
+//
+// Offsets are positions in the buffer: an entry's segment is (offset / segment_size()). Entries
+// never span segments.
+//
+// Not thread-safe; callers must serialize all calls.
+class SegmentedLog {
+ public:
+  SegmentedLog(space_t size, space_t segment_size,
+      const MemoryOptions& options = MemoryOptions());
+  ~SegmentedLog();
+
+  // Which open segment an append goes to. Entries moved by the cleaner, which have already lived
+  // through at least one cleaning, are kept apart from new writes, so that segments tend to hold
+  // entries of similar ages.
+  enum class Stream { WRITE, CLEAN };
+
+  // Returns the offset of the new entry, or -1 if it's larger than a segment, or a new segment is
+  // needed and there are no more than 'reserve' free ones. 'expiry' is as for CircularLog.
+  offset_t Append(const std::string& key, const std::string& value, keyhash_t hash,
+      Stream stream = Stream::WRITE, int reserve = 0, uint32_t expiry = 0);
+
+  // Returns false if the entry's tag doesn't match 'expected', or it has expired. The slices stay
+  // valid until the entry's segment is freed.
+  bool Read(offset_t offset, keyhash_t expected, LogSlice* key, LogSlice* value) const;
+
+  // Whether the entry at 'offset' has an expiry time, and it has passed.
+  bool IsExpired(offset_t offset) const;
+
+  // Takes the entry at 'offset' out of its segment's live bytes. Must be called exactly once for
+  // every entry that is no longer wanted.
+  void MarkDead(offset_t offset);
+
+  struct ScannedEntry {
+    // The offset of the entry after this one, which is SegmentEnd() after the last one.
+    offset_t next;
+    LogSlice key;
+    LogSlice value;
+    tag_t tag;
+    uint32_t expiry;
+  };
+
+  // Entries in 'segment' can be scanned from SegmentStart() to SegmentEnd().
+  offset_t SegmentStart(int segment) const { return segment * segment_size_; }
+  offset_t SegmentEnd(int segment) const { return SegmentStart(segment) + segments_[segment].used; }
+  void Scan(offset_t offset, ScannedEntry* entry) const;
+
+  // Returns the full segment with the fewest live bytes, or -1 if every full segment is entirely
+  // live, in which case cleaning would free nothing.
+  int PickVictim() const;
+
+  // Returns 'segment' to the free list. Whatever it still holds is dropped, so the caller must first
+  // have moved the entries it wants to keep.
+  void Free(int segment);
+
+  // The space that an entry takes up in a segment.
+  static space_t SpaceFor(const std::string& key, const std::string& value);
+
+  int num_segments() const { return segments_.size(); }
+  int free_segments() const { return free_.size(); }
+  space_t segment_size() const { return segment_size_; }
+  space_t live_bytes() const { return live_bytes_; }
+  const Region& region() const { return region_; }
+
+ private:
+  struct Segment {
+    space_t used = 0;
+    space_t live = 0;
+    // Full segments are those that aren't free and aren't open in either stream.
+    bool full = false;
+  };
+
+  const space_t segment_size_;
+  int8_t* bufptr_ = nullptr;
+  Region region_;
+
+  std::vector<Segment> segments_;
+  std::vector<int> free_;
+  // The open segment for each Stream, or -1.
+  int open_[2] = {-1, -1};
+  space_t live_bytes_ = 0;
+};
+
+}
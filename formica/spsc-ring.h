@@ -0,0 +1,101 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+namespace formica {
+
+// A bounded, lock-free queue between exactly one producer thread and one consumer thread.
+//
+// The producer's and consumer's indexes are on separate cache lines, and each side keeps a cached
+// copy of the other's index, so the line only moves between cores when a cached copy runs out.
+// Popping a batch, or publishing a batch of pushes, moves each line at most once for the batch.
+template <typename T>
+class SpscRing {
+ public:
+  // 'capacity' must be a power of two.
+  explicit SpscRing(uint32_t capacity) : mask_(capacity - 1), slots_(new T[capacity]) {
+    assert(capacity > 0 && (capacity & mask_) == 0);
+  }
+
+  // The indexes are aligned to cache lines, which plain operator new doesn't honour before C++17,
+  // so rings allocated with new get their alignment from posix_memalign() instead.
+  static void* operator new(size_t size) {
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, alignof(SpscRing), size) != 0) throw std::bad_alloc();
+    return ptr;
+  }
+  static void operator delete(void* ptr) { free(ptr); }
+
+  uint32_t capacity() const { return mask_ + 1; }
+
+  // Producer only. Returns how many items (up to 'wanted') can be pushed without failing.
+  uint32_t Writable(uint32_t wanted) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    if (capacity() - (tail - cached_head_) < wanted) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+    }
+    uint32_t writable = capacity() - (tail - cached_head_);
+    return writable < wanted ? writable : wanted;
+  }
+
+  // Producer only. Returns false if the ring is full.
+  bool TryPush(const T& item) {
+    if (Writable(1) == 0) return false;
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    slots_[tail & mask_] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Producer only. Pushes all of 'items', which must fit (see Writable()), and publishes them at
+  // once.
+  void PushBatch(const T* items, uint32_t n) {
+    assert(Writable(n) == n);
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < n; ++i) slots_[(tail + i) & mask_] = items[i];
+    tail_.store(tail + n, std::memory_order_release);
+  }
+
+  // Consumer only. Pops up to 'max' items into 'items', returning how many were popped.
+  uint32_t PopBatch(T* items, uint32_t max) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    if (cached_tail_ - head < max) cached_tail_ = tail_.load(std::memory_order_acquire);
+    uint32_t n = cached_tail_ - head < max ? cached_tail_ - head : max;
+    for (uint32_t i = 0; i < n; ++i) items[i] = slots_[(head + i) & mask_];
+    if (n > 0) head_.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  bool TryPop(T* item) { return PopBatch(item, 1) == 1; }
+
+ private:
+  // Written by the producer.
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  uint64_t cached_head_ = 0;
+
+  // Written by the consumer.
+  alignas(64) std::atomic<uint64_t> head_{0};
+  uint64_t cached_tail_ = 0;
+
+  alignas(64) const uint64_t mask_;
+  std::unique_ptr<T[]> slots_;
+};
+
+}
@@ -0,0 +1,123 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "stats.h"
+
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace formica {
+
+constexpr int Stats::NUM_SHARDS;
+constexpr int Stats::SHARED_SHARD;
+
+void StatsSnapshot::Merge(const StatsSnapshot& other) {
+  for (int i = 0; i < NUM_STATS; ++i) values_[i] += other.values_[i];
+}
+
+std::string StatsSnapshot::ToJson() const {
+  std::stringstream out;
+  out << "{";
+  for (int i = 0; i < NUM_STATS; ++i) {
+    out << (i == 0 ? "" : ", ") << "\"" << Name(static_cast<Stat>(i)) << "\": " << values_[i];
+  }
+  out << "}";
+  return out.str();
+}
+
+std::string StatsSnapshot::ToText() const {
+  std::stringstream out;
+  for (int i = 0; i < NUM_STATS; ++i) {
+    out << Name(static_cast<Stat>(i)) << " " << values_[i] << "\n";
+  }
+  return out.str();
+}
+
+const char* StatsSnapshot::Name(Stat stat) {
+  switch (stat) {
+    case Stat::READS: return "reads";
+    case Stat::INDEX_MISSES: return "index_misses";
+    case Stat::LOG_OVERWRITTEN: return "log_overwritten";
+    case Stat::LOG_OTHER_KEY: return "log_other_key";
+    case Stat::INSERTS: return "inserts";
+    case Stat::UPDATES: return "updates";
+    case Stat::DELETES: return "deletes";
+    case Stat::INSERT_FAILURES: return "insert_failures";
+    case Stat::EVICTIONS: return "evictions";
+    case Stat::BYTES_WRITTEN: return "bytes_written";
+    case Stat::LOG_WRAPS: return "log_wraps";
+    case Stat::SEGMENTS_CLEANED: return "segments_cleaned";
+    case Stat::BYTES_RELOCATED: return "bytes_relocated";
+    case Stat::FRONT_CACHE_HITS: return "front_cache_hits";
+    case Stat::FRONT_CACHE_MISSES: return "front_cache_misses";
+    case Stat::INDEX_ENTRIES: return "index_entries";
+    case Stat::INDEX_CAPACITY: return "index_capacity";
+    case Stat::OVERFLOW_BUCKETS: return "overflow_buckets";
+    case Stat::LIVE_BYTES: return "live_bytes";
+    case Stat::LOG_CAPACITY: return "log_capacity";
+    case Stat::NUM_STATS: break;
+  }
+  return "";
+}
+
+Stats::Stats() {
+  // The region is zeroed, which is what every value starts as.
+  region_ = AllocateRegion(NUM_SHARDS * sizeof(Shard), MemoryOptions());
+  CheckMapped(region_, "stats shards");
+  shards_ = static_cast<Shard*>(region_.ptr);
+}
+
+Stats::~Stats() { FreeRegion(region_); }
+
+// The owned shards that no running thread has claimed. The mutex also orders a shard's last store
+// by one owner before the first load by the next.
+static std::mutex free_shards_mu;
+static std::vector<int> free_shards;
+static int next_shard = 0;
+
+Stats::ShardClaim::ShardClaim() {
+  std::lock_guard<std::mutex> lock(free_shards_mu);
+  if (!free_shards.empty()) {
+    shard = free_shards.back();
+    free_shards.pop_back();
+  } else {
+    shard = next_shard < SHARED_SHARD ? next_shard++ : SHARED_SHARD;
+  }
+}
+
+Stats::ShardClaim::~ShardClaim() {
+  if (shard == SHARED_SHARD) return;
+  std::lock_guard<std::mutex> lock(free_shards_mu);
+  free_shards.push_back(shard);
+}
+
+int64_t Stats::Get(Stat stat) const {
+  int64_t total = 0;
+  for (int i = 0; i < NUM_SHARDS; ++i) {
+    total += shards_[i].values[static_cast<int>(stat)].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+StatsSnapshot Stats::Snapshot() const {
+  StatsSnapshot snapshot;
+  for (int i = 0; i < NUM_SHARDS; ++i) {
+    for (int j = NUM_STATS - 1; j >= 0; --j) {
+      Stat stat = static_cast<Stat>(j);
+      snapshot.Set(stat, snapshot[stat] + shards_[i].values[j].load(std::memory_order_acquire));
+    }
+  }
+  return snapshot;
+}
+
+}
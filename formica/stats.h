@@ -0,0 +1,152 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "memory.h"
+
+namespace formica {
+
+// What the stores count. Counters only go up; gauges are levels, and may go down. Not every store
+// has every statistic, and those it doesn't have read as 0.
+enum class Stat {
+  // Counters.
+  // Calls to Read() and ReadView(), and requests in a MultiRead().
+  READS,
+  // Reads that missed because the index had no entry for the key...
+  INDEX_MISSES,
+  // ... because the log no longer held the entry that the index pointed at (or it had expired)...
+  LOG_OVERWRITTEN,
+  // ... or because the entry was for another key with the same tag.
+  LOG_OTHER_KEY,
+  // Successful Insert()s, Update()s and Delete()s.
+  INSERTS,
+  UPDATES,
+  DELETES,
+  // Insert()s that failed because the store was full.
+  INSERT_FAILURES,
+  // Live entries evicted from a full index bucket or chain to make room for another.
+  EVICTIONS,
+  // Bytes appended to the log, including padding and entries moved by the cleaner.
+  BYTES_WRITTEN,
+  // Times the CircularLog's tail has gone round the buffer.
+  LOG_WRAPS,
+  // In the cleaned logs, segments freed and the bytes of the live entries moved out of them.
+  SEGMENTS_CLEANED,
+  BYTES_RELOCATED,
+  FRONT_CACHE_HITS,
+  FRONT_CACHE_MISSES,
+
+  // Gauges.
+  // Occupied index entries, whether or not the log still holds what they point at, out of a
+  // capacity of INDEX_CAPACITY (0 if the index grows as needed). Their ratio is the bucket fill.
+  INDEX_ENTRIES,
+  INDEX_CAPACITY,
+  // Overflow buckets chained onto full buckets, in a STORE mode FormicaStore.
+  OVERFLOW_BUCKETS,
+  // Bytes of the log taken up by entries that are still wanted, in the stores that keep track, out
+  // of LOG_CAPACITY.
+  LIVE_BYTES,
+  LOG_CAPACITY,
+
+  NUM_STATS
+};
+
+constexpr int NUM_STATS = static_cast<int>(Stat::NUM_STATS);
+
+// The value of every Stat at one point in time.
+class StatsSnapshot {
+ public:
+  int64_t operator[](Stat stat) const { return values_[static_cast<int>(stat)]; }
+  void Set(Stat stat, int64_t value) { values_[static_cast<int>(stat)] = value; }
+
+  // Adds every value in 'other' to this one, e.g. to total up several stores.
+  void Merge(const StatsSnapshot& other);
+
+  // A JSON object with a member per Stat, e.g. {"reads": 10, "index_misses": 2, ...}.
+  std::string ToJson() const;
+  // A line per Stat, e.g. "reads 10".
+  std::string ToText() const;
+
+  // The name of 'stat' in the exports, e.g. "index_misses".
+  static const char* Name(Stat stat);
+  static bool IsGauge(Stat stat) { return stat >= Stat::INDEX_ENTRIES; }
+
+ private:
+  int64_t values_[NUM_STATS] = {};
+};
+
+// A store's statistics, which any thread may update and read. Each thread owns one of NUM_SHARDS
+// shards, a cache line or so of its own, while it runs. As the only writer, it adds with a plain
+// load and store rather than a locked read-modify-write, so Add() is cheap enough for every GET.
+// Threads beyond the first NUM_SHARDS - 1 that are running at once share the last shard, and add to
+// it atomically.
+//
+// Stores are releases (plain stores on x86), and Snapshot() reads each shard's statistics in
+// reverse order with acquires, so a snapshot that sees an update to one statistic also sees every
+// update that the same thread made to earlier ones (in Stat order) before it: e.g. never a miss
+// without the read that missed.
+class Stats {
+ public:
+  Stats();
+  ~Stats();
+
+  Stats(const Stats&) = delete;
+  Stats& operator=(const Stats&) = delete;
+
+  void Add(Stat stat, int64_t delta = 1) {
+    int shard = ThreadShard();
+    std::atomic<int64_t>& value = shards_[shard].values[static_cast<int>(stat)];
+    if (shard == SHARED_SHARD) {
+      value.fetch_add(delta, std::memory_order_release);
+    } else {
+      value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_release);
+    }
+  }
+
+  // The current total of one statistic.
+  int64_t Get(Stat stat) const;
+
+  StatsSnapshot Snapshot() const;
+
+  static constexpr int NUM_SHARDS = 64;
+
+ private:
+  static constexpr int SHARED_SHARD = NUM_SHARDS - 1;
+
+  struct alignas(64) Shard {
+    std::atomic<int64_t> values[NUM_STATS];
+  };
+
+  // Claims a shard for a thread when it first calls Add(), and gives it back when the thread exits,
+  // so that short-lived threads don't use up the owned shards.
+  struct ShardClaim {
+    ShardClaim();
+    ~ShardClaim();
+    int shard;
+  };
+
+  // The calling thread's shard. A thread uses the same shard in every Stats.
+  static int ThreadShard() {
+    thread_local ShardClaim claim;
+    return claim.shard;
+  }
+
+  Region region_;
+  Shard* shards_;
+};
+
+}
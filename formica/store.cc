@@ -12,129 +12,1018 @@
 
 #include "store.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <iostream>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 namespace formica {
 
 using std::string;
 using std::cout;
 using std::endl;
+using std::vector;
 
-StdMapStore::StdMapStore(space_t size) : log_(size) { }
+// The bytes that 'str' has allocated on the heap: none if it is short enough to be kept inside the
+// string object itself.
+static int64_t HeapBytes(const string& str) {
+  const char* object = reinterpret_cast<const char*>(&str);
+  if (str.data() >= object && str.data() < object + sizeof(str)) return 0;
+  return str.capacity() + 1;
+}
 
-void StdMapStore::Insert(const Entry& entry) {
-  // TODO: Could check if entry exists and use Update directly.
-  offset_t offset = log_.Insert(entry.key, entry.value, entry.hash);
-  idx_[entry.key] = {entry.hash, offset};
+// The bytes a front cache takes, if there is one.
+static int64_t FrontCacheBytes(const FrontCache* front) {
+  return front == nullptr ? 0 : sizeof(FrontCache) + front->region().mapped_size;
 }
 
-bool StdMapStore::Update(const Entry& entry) {
-  auto it = idx_.find(entry.key);
-  if (it == idx_.end()) return false;
+static space_t SegmentSizeFor(space_t size) {
+  return std::max(size / StdMapStore::NUM_SEGMENTS,
+      std::min(size / 4, StdMapStore::MIN_SEGMENT_SIZE));
+}
+
+StdMapStore::StdMapStore(space_t size) : log_(size, SegmentSizeFor(size)) { }
+
+StdMapStore::~StdMapStore() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stopping_ = true;
+  }
+  cleaner_wake_.notify_all();
+  pass_done_.notify_all();
+  if (cleaner_.joinable()) cleaner_.join();
+}
+
+bool StdMapStore::Insert(const Entry& entry, uint32_t ttl_seconds) {
+  CoarseClock::Tick();
+  uint32_t expiry = ttl_seconds == 0 ? 0 : CoarseClock::Now() + ttl_seconds;
+  std::unique_lock<std::mutex> lock(mu_);
+  offset_t offset = Append(&lock, entry, expiry);
+  if (offset == -1) {
+    stats_.Add(Stat::INSERT_FAILURES);
+    return false;
+  }
+  auto result = idx_.insert({entry.key, {entry.hash, offset}});
+  if (!result.second) {
+    Discard(result.first->second.second);
+    result.first->second = {entry.hash, offset};
+  }
+  if (front_ != nullptr) front_->Invalidate(entry.hash);
+  stats_.Add(Stat::INSERTS);
+  return true;
+}
+
+bool StdMapStore::Update(const Entry& entry, uint32_t ttl_seconds) {
+  CoarseClock::Tick();
+  uint32_t expiry = ttl_seconds == 0 ? 0 : CoarseClock::Now() + ttl_seconds;
+  std::unique_lock<std::mutex> lock(mu_);
+  if (idx_.find(entry.key) == idx_.end()) return false;
 
-  offset_t offset = log_.Update(it->second.second, entry.key, entry.value, entry.hash);
+  offset_t offset = Append(&lock, entry, expiry);
   if (offset == -1) return false;
-  it->second.second = offset;
+  auto it = idx_.find(entry.key);
+  if (it == idx_.end()) {
+    // Deleted while we waited for the cleaner.
+    Discard(offset);
+    return false;
+  }
+  Discard(it->second.second);
+  it->second = {entry.hash, offset};
+  if (front_ != nullptr) front_->Invalidate(entry.hash);
+  stats_.Add(Stat::UPDATES);
   return true;
 }
 
-void StdMapStore::Delete(const string& key) {
-  idx_.erase(key);
+bool StdMapStore::Delete(const string& key, keyhash_t hash) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto it = idx_.find(key);
+  if (it == idx_.end()) return false;
+  Discard(it->second.second);
+  idx_.erase(it);
+  if (front_ != nullptr) front_->Invalidate(hash);
+  stats_.Add(Stat::DELETES);
+  return true;
+}
+
+void StdMapStore::EnableFrontCache(space_t capacity, int slot_size) {
+  front_.reset(new FrontCache(capacity, slot_size));
 }
 
 bool StdMapStore::Read(const std::string& key, keyhash_t hash, std::string* value) {
+  stats_.Add(Stat::READS);
+  uint32_t expiry;
+  if (front_ == nullptr) return ReadLocked(key, hash, value, &expiry);
+  if (front_->Read(key, hash, value)) return true;
+  // Writes invalidate the cache while holding the lock, so BeginFill() must come before it.
+  uint32_t ticket = front_->BeginFill(hash);
+  if (!ReadLocked(key, hash, value, &expiry)) return false;
+  front_->Fill(ticket, key, hash, *value, expiry);
+  return true;
+}
+
+bool StdMapStore::ReadLocked(const string& key, keyhash_t hash, string* value, uint32_t* expiry) {
+  std::lock_guard<std::mutex> lock(mu_);
   auto it = idx_.find(key);
   if (it == idx_.end()) {
-    ++index_misses_;
+    stats_.Add(Stat::INDEX_MISSES);
     return false;
   }
 
-  string stored_key;
-  if (!log_.ReadFrom(it->second.second, hash, &stored_key, value)) {
-    ++log_overwritten_;
+  // Fails if the entry has expired, or 'hash' is wrong.
+  LogSlice stored_key, stored_value;
+  if (!log_.Read(it->second.second, hash, &stored_key, &stored_value)) {
+    stats_.Add(log_.IsExpired(it->second.second) ? Stat::LOG_OVERWRITTEN : Stat::LOG_OTHER_KEY);
     return false;
   }
 
   // This is the only time that the key is completely compared to the requested one.
-  if (key != stored_key) {
-    ++log_other_key_;
+  if (!stored_key.Equals(key)) {
+    stats_.Add(Stat::LOG_OTHER_KEY);
     return false;
   }
+  stored_value.CopyTo(value);
+  *expiry = stored_value.expiry;
   return true;
 }
 
-LossyHash::LossyHash(bucket_count_t num_buckets) : num_buckets_(num_buckets) {
-  buckets_ = new Bucket[num_buckets];
+void StdMapStore::Discard(offset_t offset) {
+  log_.MarkDead(offset);
+  garbage_ = true;
 }
 
-offset_t LossyHash::Lookup(keyhash_t hash) {
-  tag_t bucket_number = ExtractHashTag(hash);
-  Bucket* bucket = &(buckets_[bucket_number % num_buckets_]);
+offset_t StdMapStore::Append(std::unique_lock<std::mutex>* lock, const Entry& entry,
+    uint32_t expiry) {
+  while (true) {
+    offset_t offset = log_.Append(entry.key, entry.value, entry.hash,
+        SegmentedLog::Stream::WRITE, CLEANER_RESERVE, expiry);
+    if (offset != -1) {
+      stats_.Add(Stat::BYTES_WRITTEN, SegmentedLog::SpaceFor(entry.key, entry.value));
+      if (cleaner_.joinable() && log_.free_segments() < low_watermark()) {
+        cleaner_wake_.notify_one();
+      }
+      return offset;
+    }
+    if (SegmentedLog::SpaceFor(entry.key, entry.value) > log_.segment_size()) return -1;
 
-  tag_t log_tag = ExtractLogTag(hash);
+    if (!cleaner_.joinable()) {
+      if (!CleanSegment(nullptr)) return -1;
+      continue;
+    }
+
+    // The background cleaner has fallen behind, so wait for it to finish a pass.
+    if (!garbage_ || stopping_) return -1;
+    int passes = cleaner_passes_;
+    cleaner_wake_.notify_one();
+    pass_done_.wait(*lock, [&]() { return cleaner_passes_ != passes || stopping_; });
+    if (!cleaner_progress_) return -1;
+  }
+}
+
+bool StdMapStore::CleanSegment(std::unique_lock<std::mutex>* lock) {
+  int victim = log_.PickVictim();
+  if (victim == -1) return false;
+
+  // The victim is full, so nothing is appended to it while the lock is released.
+  offset_t end = log_.SegmentEnd(victim);
+  SegmentedLog::ScannedEntry entry;
+  int moved = 0;
+  for (offset_t offset = log_.SegmentStart(victim); offset < end; offset = entry.next) {
+    log_.Scan(offset, &entry);
+    entry.key.CopyTo(&clean_key_);
+    auto it = idx_.find(clean_key_);
+    if (it == idx_.end() || it->second.second != offset) continue;
+    if (entry.expiry != 0 && entry.expiry <= CoarseClock::Now()) {
+      idx_.erase(it);
+      continue;
+    }
+
+    entry.value.CopyTo(&clean_value_);
+    offset_t new_offset = log_.Append(clean_key_, clean_value_, it->second.first,
+        SegmentedLog::Stream::CLEAN, 0, entry.expiry);
+    // Can't happen while CLEANER_RESERVE is kept free, since the victim has some dead space.
+    if (new_offset == -1) return false;
+    it->second.second = new_offset;
+    space_t space = SegmentedLog::SpaceFor(clean_key_, clean_value_);
+    stats_.Add(Stat::BYTES_RELOCATED, space);
+    stats_.Add(Stat::BYTES_WRITTEN, space);
+
+    if (lock != nullptr && ++moved % CLEAN_BATCH_SIZE == 0) {
+      lock->unlock();
+      lock->lock();
+    }
+  }
+  log_.Free(victim);
+  stats_.Add(Stat::SEGMENTS_CLEANED);
+  return true;
+}
+
+void StdMapStore::StartCleaner() {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (!cleaner_.joinable()) cleaner_ = std::thread(&StdMapStore::RunCleaner, this);
+}
+
+void StdMapStore::RunCleaner() {
+  std::unique_lock<std::mutex> lock(mu_);
+  while (true) {
+    cleaner_wake_.wait(lock, [this]() {
+      return stopping_ || (garbage_ && log_.free_segments() < low_watermark());
+    });
+    if (stopping_) return;
+
+    bool progress = false;
+    while (!stopping_ && log_.free_segments() < high_watermark() && CleanSegment(&lock)) {
+      progress = true;
+    }
+    if (!progress) garbage_ = false;
+    cleaner_progress_ = progress;
+    ++cleaner_passes_;
+    pass_done_.notify_all();
+  }
+}
+
+int StdMapStore::low_watermark() const {
+  return std::max(CLEANER_RESERVE + 1, log_.num_segments() / 16);
+}
+
+int StdMapStore::high_watermark() const {
+  return std::min(log_.num_segments(), 2 * low_watermark());
+}
+
+StatsSnapshot StdMapStore::stats() {
+  std::lock_guard<std::mutex> lock(mu_);
+  StatsSnapshot snapshot = stats_.Snapshot();
+  snapshot.Set(Stat::INDEX_ENTRIES, idx_.size());
+  snapshot.Set(Stat::LIVE_BYTES, log_.live_bytes());
+  snapshot.Set(Stat::LOG_CAPACITY, static_cast<int64_t>(log_.num_segments()) * log_.segment_size());
+  snapshot.Set(Stat::FRONT_CACHE_HITS, front_cache_hits());
+  snapshot.Set(Stat::FRONT_CACHE_MISSES, front_cache_misses());
+  return snapshot;
+}
+
+MemoryFootprint StdMapStore::MemoryUsage() {
+  std::lock_guard<std::mutex> lock(mu_);
+  MemoryFootprint usage;
+  // A node holds the next pointer, the key and value, and the key's cached hash.
+  constexpr int64_t NODE_SIZE = sizeof(void*) + sizeof(decltype(idx_)::value_type) + sizeof(size_t);
+  usage.index_bytes = idx_.bucket_count() * sizeof(void*) + idx_.size() * NODE_SIZE;
+  for (const auto& entry: idx_) usage.index_bytes += HeapBytes(entry.first);
+  usage.log_bytes = log_.region().mapped_size;
+  usage.overhead_bytes = sizeof(*this) + FrontCacheBytes(front_.get());
+  return usage;
+}
+
+constexpr offset_t LossyHash::INLINE;
+
+LossyHash::LossyHash(bucket_count_t num_buckets, space_t log_size, const MemoryOptions& options,
+    bucket_count_t num_overflow_buckets) : num_buckets_(num_buckets), log_size_(log_size),
+    num_overflow_buckets_(num_overflow_buckets) {
+  assert(log_size_ < (1LL << (OFFSET_BITS - 1)));
+  // Regions are page-aligned and zeroed, which is a table of empty, unchained buckets at version 0.
+  region_ = AllocateRegion(sizeof(Bucket) * (num_buckets_ + num_overflow_buckets_), options);
+  CheckMapped(region_, "the hash index");
+  buckets_ = reinterpret_cast<Bucket*>(region_.ptr);
+}
+
+LossyHash::~LossyHash() {
+  FreeRegion(region_);
+}
+
+uint32_t LossyHash::MatchTags(const Bucket* bucket, uint16_t tag) {
+  // The tag is the top 16-bit lane of each 64-bit word. The header word can match, since the top
+  // of it is the overflow index, so it's shifted off the end of the mask.
+  const int8_t* words = reinterpret_cast<const int8_t*>(bucket);
+  uint32_t word_mask = 0;
+#if defined(__AVX2__)
+  __m256i needle = _mm256_set1_epi16(tag);
+  for (int i = 0; i < sizeof(Bucket); i += sizeof(__m256i)) {
+    __m256i lanes = _mm256_load_si256(reinterpret_cast<const __m256i*>(words + i));
+    uint32_t matches = _mm256_movemask_epi8(_mm256_cmpeq_epi16(lanes, needle)) & 0x80808080;
+    for (; matches != 0; matches &= matches - 1) {
+      word_mask |= 1U << ((i + __builtin_ctz(matches)) / sizeof(Entry));
+    }
+  }
+#elif defined(__SSE2__)
+  __m128i needle = _mm_set1_epi16(tag);
+  for (int i = 0; i < sizeof(Bucket); i += sizeof(__m128i)) {
+    __m128i lanes = _mm_load_si128(reinterpret_cast<const __m128i*>(words + i));
+    uint32_t matches = _mm_movemask_epi8(_mm_cmpeq_epi16(lanes, needle)) & 0x8080;
+    for (; matches != 0; matches &= matches - 1) {
+      word_mask |= 1U << ((i + __builtin_ctz(matches)) / sizeof(Entry));
+    }
+  }
+#else
   for (int i = 0; i < Bucket::NUM_ENTRIES; ++i) {
-    if (bucket->entries[i].tag == log_tag) return bucket->entries[i].offset;
+    if (EntryTag(bucket->entries[i]) == tag) word_mask |= 1U << (i + 1);
   }
+#endif
+  return word_mask >> 1;
+}
 
-  return -1;
+void LossyHash::EraseRecord(Bucket* bucket, int idx) {
+  int end = std::min(idx + RecordSize(bucket->entries[idx]), static_cast<int>(Bucket::NUM_ENTRIES));
+  for (int i = idx; i < end; ++i) bucket->entries[i] = 0;
+  bucket->inline_words &= ~(((1U << end) - 1) & (~0U << (idx + 1)));
 }
 
-void LossyHash::Insert(keyhash_t hash, offset_t offset, offset_t log_tail) {
-  tag_t bucket_number = ExtractHashTag(hash);
-  Bucket* bucket = &(buckets_[bucket_number % num_buckets_]);
+offset_t LossyHash::Lookup(keyhash_t hash, offset_t log_tail) {
+  uint32_t version;
+  return Lookup(hash, log_tail, &version);
+}
 
-  tag_t log_tag = ExtractLogTag(hash);
+uint32_t LossyHash::BeginRead(keyhash_t hash) {
+  Bucket* bucket = BucketFor(hash);
+  while (true) {
+    uint32_t version = bucket->version.load(std::memory_order_acquire);
+    if ((version & 1) == 0) return version;
+  }
+}
+
+offset_t LossyHash::Lookup(keyhash_t hash, offset_t log_tail, uint32_t* version) {
+  Bucket* bucket = BucketFor(hash);
+  Slot slot;
+  while (true) {
+    *version = BeginRead(hash);
+    offset_t offset = Find(hash, log_tail, &slot) ? slot.offset : -1;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (bucket->version.load(std::memory_order_relaxed) == *version) return offset;
+  }
+}
+
+bool LossyHash::Validate(keyhash_t hash, uint32_t version) {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return BucketFor(hash)->version.load(std::memory_order_relaxed) == version;
+}
+
+void LossyHash::Prefetch(keyhash_t hash) {
+  int8_t* bucket = reinterpret_cast<int8_t*>(BucketFor(hash));
+  for (int i = 0; i < sizeof(Bucket); i += 64) __builtin_prefetch(bucket + i);
+}
+
+void LossyHash::BeginWrite(Bucket* bucket) {
+  uint32_t version = bucket->version.load(std::memory_order_relaxed);
+  bucket->version.store(version + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void LossyHash::EndWrite(Bucket* bucket) {
+  uint32_t version = bucket->version.load(std::memory_order_relaxed);
+  bucket->version.store(version + 1, std::memory_order_release);
+}
+
+bool LossyHash::Find(keyhash_t hash, offset_t log_tail, Slot* slot) {
+  slot->head = slot->bucket = BucketIndex(hash);
+  slot->entry = -1;
+  return FindNext(hash, log_tail, slot);
+}
+
+bool LossyHash::FindNext(keyhash_t hash, offset_t log_tail, Slot* slot) {
+  uint16_t tag = ExtractIndexTag(hash);
+  Bucket* bucket = &buckets_[slot->bucket];
+  while (true) {
+    uint32_t matches = MatchTags(bucket, tag) & (~0U << (slot->entry + 1));
+    if (inline_ && matches != 0) matches &= RecordStarts(bucket);
+    for (; matches != 0; matches &= matches - 1) {
+      int idx = __builtin_ctz(matches);
+      Entry entry = bucket->entries[idx];
+      offset_t offset = IsInline(entry) ? INLINE : EntryOffset(entry, log_tail);
+      if (offset != -1) {
+        slot->entry = idx;
+        slot->offset = offset;
+        return true;
+      }
+    }
+
+    bucket = NextInChain(bucket);
+    if (bucket == nullptr) return false;
+    slot->bucket = bucket - buckets_;
+    slot->entry = -1;
+  }
+}
+
+void LossyHash::Set(Slot* slot, offset_t offset) {
+  assert(offset >= 0 && slot->offset != INLINE);
+  Entry* entry = &buckets_[slot->bucket].entries[slot->entry];
+  *entry = MakeEntry(EntryTag(*entry), offset);
+  slot->offset = offset;
+}
+
+void LossyHash::Erase(const Slot& slot) {
+  EraseRecord(&buckets_[slot.bucket], slot.entry);
+  AddStat(Stat::INDEX_ENTRIES, -1);
+}
+
+void LossyHash::Delete(keyhash_t hash, offset_t log_tail) {
+  Slot slot;
+  if (!Find(hash, log_tail, &slot)) return;
+  BeginWrite(slot);
+  Erase(slot);
+  EndWrite(slot);
+}
+
+bool LossyHash::Insert(keyhash_t hash, offset_t offset, offset_t log_tail, ExpiredFn expired,
+    const void* context) {
+  Bucket* bucket = BucketFor(hash);
+  assert(offset >= 0);
+
+  uint16_t tag = ExtractIndexTag(hash);
+  if (lossless()) {
+    // Take the first empty entry in the chain, or failing that, chain a new bucket onto the end.
+    Bucket* head = bucket;
+    while (true) {
+      for (int i = 0; i < Bucket::NUM_ENTRIES; ++i) {
+        if (bucket->entries[i] != 0) continue;
+        BeginWrite(head);
+        bucket->entries[i] = MakeEntry(tag, offset);
+        EndWrite(head);
+        AddStat(Stat::INDEX_ENTRIES, 1);
+        return true;
+      }
+      Bucket* next = NextInChain(bucket);
+      if (next == nullptr) break;
+      bucket = next;
+    }
+
+    if (overflow_buckets_used_ == num_overflow_buckets_) return false;
+    // Readers can't reach the new bucket until it's linked in.
+    buckets_[num_buckets_ + overflow_buckets_used_].entries[0] = MakeEntry(tag, offset);
+    ++overflow_buckets_used_;
+    BeginWrite(head);
+    bucket->overflow = overflow_buckets_used_;
+    EndWrite(head);
+    AddStat(Stat::INDEX_ENTRIES, 1);
+    AddStat(Stat::OVERFLOW_BUCKETS, 1);
+    return true;
+  }
+
+  // Per the paper, evict the entry that is furthest behind the log tail. Entries the log has
+  // already overwritten are always older than live ones. Only the first entry of an inline record
+  // is looked at, and the rest of it is evicted along with it.
+  //
+  // An entry with the same tag must be overwritten, and any others with it cleared, to avoid false
+  // negatives on read, and so that a key's older entry can't outlive a Delete() of its newer one.
+  // Deletes leave holes, so the whole bucket is scanned for them, not just up to the first empty
+  // entry.
+  uint32_t starts = inline_ ? RecordStarts(bucket) : ~0U;
+  uint32_t same_tag = MatchTags(bucket, tag) & starts;
+  int empty_idx = -1;
+  int oldest_idx = 0;
+  int64_t oldest = -1;
+  for (int i = 0; i < Bucket::NUM_ENTRIES; ++i) {
+    if ((starts & (1U << i)) == 0 || (same_tag & (1U << i)) != 0) continue;
+    Entry entry = bucket->entries[i];
+    if (entry == 0) {
+      if (empty_idx == -1) empty_idx = i;
+      continue;
+    }
+    int64_t age = RecordAge(entry, log_tail);
+    if (age > oldest) {
+      oldest = age;
+      oldest_idx = i;
+    }
+  }
+  bool full = same_tag == 0 && empty_idx == -1;
+  int entry_idx = same_tag != 0 ? __builtin_ctz(same_tag) : full ? oldest_idx : empty_idx;
+
+  // An expired entry is as good as gone, but finding out means reading its header from the log,
+  // so only look if every entry is still live.
+  bool evicts_live = full && oldest <= log_size_;
+  if (evicts_live && expired != nullptr) {
+    for (int i = 0; i < Bucket::NUM_ENTRIES; ++i) {
+      Entry entry = bucket->entries[i];
+      if ((starts & (1U << i)) == 0 || IsInline(entry)) continue;
+      if (expired(context, log_tail - EntryAge(entry, log_tail))) {
+        entry_idx = i;
+        evicts_live = false;
+        break;
+      }
+    }
+  }
+  if (evicts_live) AddStat(Stat::EVICTIONS, 1);
+  if (bucket->entries[entry_idx] == 0) AddStat(Stat::INDEX_ENTRIES, 1);
+  uint32_t duplicates = same_tag & ~(1U << entry_idx);
+  if (duplicates != 0) AddStat(Stat::INDEX_ENTRIES, -__builtin_popcount(duplicates));
+
+  BeginWrite(bucket);
+  for (; duplicates != 0; duplicates &= duplicates - 1) {
+    EraseRecord(bucket, __builtin_ctz(duplicates));
+  }
+  if (inline_) EraseRecord(bucket, entry_idx);
+  bucket->entries[entry_idx] = MakeEntry(tag, offset);
+  EndWrite(bucket);
+  return true;
+}
+
+void LossyHash::EnableInline() {
+  assert(!lossless());
+  inline_ = true;
+}
+
+bool LossyHash::CanInline(const string& key, const string& value) {
+  return value.size() <= MAX_INLINE_VALUE_SIZE &&
+      key.size() + value.size() <= MAX_INLINE_WORDS * sizeof(Entry);
+}
+
+void LossyHash::InsertInline(keyhash_t hash, const string& key, const string& value,
+    offset_t log_tail) {
+  assert(inline_ && CanInline(key, value));
+  Bucket* bucket = BucketFor(hash);
+  uint16_t tag = ExtractIndexTag(hash);
+  Entry header = MakeEntry(tag, 0) | INLINE_BIT |
+      (static_cast<Entry>(value.size()) << (STAMP_BITS + 5)) |
+      (static_cast<Entry>(key.size()) << STAMP_BITS) |
+      (static_cast<uint64_t>(log_tail) & STAMP_MASK);
+  int size = RecordSize(header);
 
-  // TODO: Use log_tail to find the 'oldest' entry and delete that, per the paper.
-  // For now, use some of the hash to pick an entry at random.
-  int entry_idx = (0xF0F0F0F0 & hash) % Bucket::NUM_ENTRIES;
+  // Entries that are free to take: empty ones, and those of the record that this one replaces.
+  uint32_t starts = RecordStarts(bucket);
+  uint32_t same_tag = MatchTags(bucket, tag) & starts;
+  uint32_t free = 0;
+  int oldest_idx = 0;
+  int64_t oldest = -1;
   for (int i = 0; i < Bucket::NUM_ENTRIES; ++i) {
-    LossyHash::Entry* entry = &(bucket->entries[i]);
-    if (entry->offset == -1 || entry->tag == log_tag) {
-      // Either there's a spare entry, or this is a duplicate tag which we must overwrite to avoid
-      // false negatives on read.
-      entry_idx = i;
-      break;
+    Entry entry = bucket->entries[i];
+    if ((starts & (1U << i)) == 0) continue;
+    if (entry == 0) {
+      free |= 1U << i;
+      continue;
     }
+    if ((same_tag & (1U << i)) != 0) {
+      free |= ((1U << RecordSize(entry)) - 1) << i;
+      continue;
+    }
+    int64_t age = RecordAge(entry, log_tail);
+    if (age > oldest) {
+      oldest = age;
+      oldest_idx = i;
+    }
+  }
+
+  // Take the first run of 'size' free entries. Failing that, evict the oldest record, and whatever
+  // follows it that is in the way.
+  uint32_t runs = free;
+  for (int i = 1; i < size; ++i) runs &= free >> i;
+  int start = runs != 0 ? __builtin_ctz(runs) :
+      std::min(oldest_idx, Bucket::NUM_ENTRIES - size);
+  uint32_t window = ((1U << size) - 1) << start;
+
+  // Evict every record that overlaps the run, including the one that it may start in the middle
+  // of, and any other with the same tag. Entry 0 always starts a record.
+  uint32_t evict = (starts & window) | same_tag;
+  evict |= 1U << (31 - __builtin_clz(starts & ((2U << start) - 1)));
+  int erased = 0, evicted = 0;
+  for (uint32_t bits = evict; bits != 0; bits &= bits - 1) {
+    int idx = __builtin_ctz(bits);
+    if (bucket->entries[idx] == 0) continue;
+    ++erased;
+    // Records with the same tag are replaced, rather than evicted.
+    if ((same_tag & (1U << idx)) == 0 && RecordAge(bucket->entries[idx], log_tail) <= log_size_) {
+      ++evicted;
+    }
+  }
+  AddStat(Stat::INDEX_ENTRIES, 1 - erased);
+  if (evicted != 0) AddStat(Stat::EVICTIONS, evicted);
+
+  BeginWrite(bucket);
+  for (; evict != 0; evict &= evict - 1) EraseRecord(bucket, __builtin_ctz(evict));
+  bucket->entries[start] = header;
+  char* bytes = reinterpret_cast<char*>(&bucket->entries[start + 1]);
+  memcpy(bytes, key.data(), key.size());
+  memcpy(bytes + key.size(), value.data(), value.size());
+  bucket->inline_words |= window & ~(1U << start);
+  EndWrite(bucket);
+}
+
+bool LossyHash::ReadInline(const Slot& slot, LogSlice* key, LogSlice* value) {
+  const Bucket* bucket = &buckets_[slot.bucket];
+  Entry header = bucket->entries[slot.entry];
+  if (!IsInline(header) || slot.entry + RecordSize(header) > Bucket::NUM_ENTRIES) return false;
+  const char* bytes = reinterpret_cast<const char*>(&bucket->entries[slot.entry + 1]);
+  *key = LogSlice();
+  key->data = bytes;
+  key->len = InlineKeySize(header);
+  key->entry_offset = INLINE;
+  *value = LogSlice();
+  value->data = bytes + key->len;
+  value->len = InlineValueSize(header);
+  value->entry_offset = INLINE;
+  return true;
+}
+
+FormicaStore::FormicaStore(space_t size, bucket_count_t num_buckets,
+    const MemoryOptions& options) : FormicaStore(size, num_buckets, StoreMode::CACHE, options) { }
+
+FormicaStore::FormicaStore(space_t size, bucket_count_t num_buckets, StoreMode mode,
+    const MemoryOptions& options, HashFunction hash) : mode_(mode), hash_(hash),
+    idx_(num_buckets, size, options, mode == StoreMode::STORE ? num_buckets / 2 + 1 : 0),
+    log_(size, options) {
+  idx_.set_stats(&stats_);
+  if (mode_ == StoreMode::STORE) log_.set_head(0);
+}
+
+FormicaStore::FormicaStore(const string& path, space_t size, bucket_count_t num_buckets,
+    int rebuild_threads, HashFunction hash) : hash_(hash), idx_(num_buckets, size),
+    log_(path, size) {
+  idx_.set_stats(&stats_);
+  if (log_.recovered()) RebuildIndex(rebuild_threads);
+}
+
+void FormicaStore::RebuildIndex(int num_threads) {
+  vector<offset_t> starts = log_.ScanStarts();
+  if (starts.empty()) return;
+  offset_t tail = log_.tail();
+  int num_ranges = starts.size();
+  starts.push_back(tail);
+  num_threads = std::max(1, std::min(num_threads, num_ranges));
+
+  // First, each thread scans a contiguous part of the log, and rehashes the keys it finds. This is
+  // where the time goes: every page of the log is read.
+  vector<vector<std::pair<keyhash_t, offset_t>>> found(num_threads);
+  vector<std::thread> threads;
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      offset_t end = starts[num_ranges * (t + 1) / num_threads];
+      offset_t offset = starts[num_ranges * t / num_threads];
+      CircularLog::ScannedEntry entry;
+      string key;
+      while (offset < end && log_.ScanEntry(offset, &entry)) {
+        if (!entry.deleted && !entry.expired) {
+          entry.key.CopyTo(&key);
+          keyhash_t hash = hash_(key);
+          // Skips entries that weren't hashed with hash_.
+          if (ExtractLogTag(hash) == entry.tag) found[t].push_back({hash, offset});
+        }
+        offset = entry.next;
+      }
+    });
   }
+  for (auto& thread: threads) thread.join();
+  threads.clear();
 
-  bucket->entries[entry_idx] = {log_tag, offset};
+  // Then each thread inserts the entries for its own share of the buckets. Every thread inserts in
+  // log order, so later entries for a key replace earlier ones, just as they did originally.
+  for (int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (const auto& range: found) {
+        for (const auto& e: range) {
+          if (idx_.BucketIndex(e.first) % num_threads == t) idx_.Insert(e.first, e.second, tail);
+        }
+      }
+    });
+  }
+  for (auto& thread: threads) thread.join();
+}
+
+uint32_t FormicaStore::ExpiryFor(uint32_t ttl_seconds) {
+  if (ttl_seconds == 0) return 0;
+  ttl_used_ = true;
+  return CoarseClock::Now() + ttl_seconds;
 }
 
-FormicaStore::FormicaStore(space_t size, bucket_count_t num_buckets)
-    : idx_(num_buckets), log_(size) { }
+bool FormicaStore::IsExpired(const void* context, offset_t offset) {
+  return static_cast<const FormicaStore*>(context)->log_.IsExpired(offset);
+}
 
-void FormicaStore::Insert(const Entry& entry) {
-  offset_t offset = log_.Insert(entry.key, entry.value, entry.hash);
-  idx_.Insert(entry.hash, offset, -1);
+void FormicaStore::EnableInlineValues() {
+  assert(mode_ == StoreMode::CACHE);
+  idx_.EnableInline();
 }
 
-bool FormicaStore::Update(const Entry& entry) {
-  // TODO - need to refactor because we want to avoid double lookup in the hash to find the offset
-  // and then rewrite it, i.e. need hash to return an `iterator` that we can reuse.
+void FormicaStore::EnableFrontCache(space_t capacity, int slot_size) {
+  front_.reset(new FrontCache(capacity, slot_size));
+}
+
+bool FormicaStore::Insert(const Entry& entry, uint32_t ttl_seconds) {
+  CoarseClock::Tick();
+  return InsertUnticked(entry, ttl_seconds);
+}
+
+bool FormicaStore::InsertUnticked(const Entry& entry, uint32_t ttl_seconds) {
+  uint32_t expiry = ExpiryFor(ttl_seconds);
+  bool inserted = mode_ == StoreMode::STORE ? StoreWrite(entry, true, expiry) :
+      CacheWrite(entry, expiry);
+  if (front_ != nullptr) front_->Invalidate(entry.hash);
+  stats_.Add(inserted ? Stat::INSERTS : Stat::INSERT_FAILURES);
+  return inserted;
+}
+
+bool FormicaStore::CacheWrite(const Entry& entry, uint32_t expiry) {
+  // Inline records have nowhere to keep an expiry time.
+  if (idx_.inline_enabled() && expiry == 0 && LossyHash::CanInline(entry.key, entry.value)) {
+    idx_.InsertInline(entry.hash, entry.key, entry.value, log_.tail());
+    return true;
+  }
+  offset_t offset = log_.Insert(entry.key, entry.value, entry.hash, expiry);
+  if (offset == -1) return false;
+  if (ttl_used_) {
+    idx_.Insert(entry.hash, offset, log_.tail(), &FormicaStore::IsExpired, this);
+  } else {
+    idx_.Insert(entry.hash, offset, log_.tail());
+  }
+  return true;
+}
+
+bool FormicaStore::FindKey(const string& key, keyhash_t hash, LossyHash::Slot* slot) {
+  offset_t tail = log_.tail();
+  LogSlice stored_key, stored_value;
+  bool found = idx_.Find(hash, tail, slot);
+  while (found) {
+    bool read = slot->offset == LossyHash::INLINE ?
+        idx_.ReadInline(*slot, &stored_key, &stored_value) :
+        log_.ReadSlices(slot->offset, hash, &stored_key, &stored_value);
+    if (read && stored_key.Equals(key)) return true;
+    found = idx_.FindNext(hash, tail, slot);
+  }
   return false;
 }
 
-bool FormicaStore::Read(const std::string& key, keyhash_t hash, std::string* value) {
-  offset_t offset = idx_.Lookup(hash);
-  if (offset == -1) {
-    ++index_misses_;
+bool FormicaStore::Update(const Entry& entry, uint32_t ttl_seconds) {
+  CoarseClock::Tick();
+  uint32_t expiry = ExpiryFor(ttl_seconds);
+  bool updated = mode_ == StoreMode::STORE ? StoreWrite(entry, false, expiry) :
+      CacheUpdate(entry, expiry);
+  if (front_ != nullptr) front_->Invalidate(entry.hash);
+  if (updated) stats_.Add(Stat::UPDATES);
+  return updated;
+}
+
+bool FormicaStore::CacheUpdate(const Entry& entry, uint32_t expiry) {
+  LossyHash::Slot slot;
+  if (!FindKey(entry.key, entry.hash, &slot)) return false;
+  // The new value replaces the inline record, wherever it ends up.
+  if (slot.offset == LossyHash::INLINE) return CacheWrite(entry, expiry);
+
+  // Readers can't see in-place writes to the log, so keep them out of the bucket until the new
+  // value is written.
+  idx_.BeginWrite(slot);
+  offset_t offset = log_.Update(slot.offset, entry.key, entry.value, entry.hash, expiry);
+  if (offset != -1) idx_.Set(&slot, offset);
+  idx_.EndWrite(slot);
+  return offset != -1;
+}
+
+bool FormicaStore::Delete(const string& key, keyhash_t hash) {
+  LossyHash::Slot slot;
+  if (!FindKey(key, hash, &slot)) return false;
+  idx_.BeginWrite(slot);
+  idx_.Erase(slot);
+  space_t freed = slot.offset == LossyHash::INLINE ? 0 : log_.MarkDeleted(slot.offset);
+  idx_.EndWrite(slot);
+  if (mode_ == StoreMode::STORE) AddLiveBytes(-freed);
+  if (front_ != nullptr) front_->Invalidate(hash);
+  stats_.Add(Stat::DELETES);
+  return true;
+}
+
+bool FormicaStore::StoreWrite(const Entry& entry, bool insert, uint32_t expiry) {
+  // Make room first, since cleaning may move the key's current entry.
+  if (!MakeRoom(CircularLog::MaxSpaceFor(entry.key, entry.value))) return false;
+
+  LossyHash::Slot slot;
+  if (FindKey(entry.key, entry.hash, &slot)) {
+    idx_.BeginWrite(slot);
+    offset_t offset = log_.Update(slot.offset, entry.key, entry.value, entry.hash, expiry);
+    if (offset != -1 && offset != slot.offset) {
+      AddLiveBytes(log_.SpaceAt(offset) - log_.MarkDeleted(slot.offset));
+      idx_.Set(&slot, offset);
+    }
+    idx_.EndWrite(slot);
+    return offset != -1;
+  }
+  if (!insert) return false;
+
+  offset_t offset = log_.Insert(entry.key, entry.value, entry.hash, expiry);
+  if (offset == -1) return false;
+  if (!idx_.Insert(entry.hash, offset, log_.tail())) {
+    // Nothing points at the entry, so the cleaner will drop it.
+    log_.MarkDeleted(offset);
     return false;
   }
+  AddLiveBytes(log_.SpaceAt(offset));
+  return true;
+}
+
+bool FormicaStore::MakeRoom(space_t space) {
+  space_t segment_size = log_.size() / NUM_SEGMENTS;
+  if (space > segment_size || live_bytes_ + space > log_.size() - 3 * segment_size) return false;
+  if (log_.free_space() >= space + segment_size) return true;
 
-  string stored_key;
-  if (!log_.ReadFrom(offset, hash, &stored_key, value)) {
-    ++log_overwritten_;
+  // Clean a segment beyond what's needed, so that the next few writes don't have to.
+  offset_t limit = log_.head() + log_.size();
+  while (log_.free_space() < space + 2 * segment_size) {
+    offset_t head = log_.head();
+    CircularLog::ScannedEntry entry;
+    if (head == log_.tail() || head >= limit || !log_.ScanEntry(head, &entry)) return false;
+    if (!entry.deleted && !Relocate(head, entry.key)) return false;
+    log_.set_head(entry.next);
+  }
+  return true;
+}
+
+bool FormicaStore::Relocate(offset_t offset, const LogSlice& key) {
+  key.CopyTo(&clean_key_);
+  keyhash_t hash = hash_(clean_key_);
+  offset_t tail = log_.tail();
+  LossyHash::Slot slot;
+  bool found = idx_.Find(hash, tail, &slot);
+  while (found && slot.offset != offset) found = idx_.FindNext(hash, tail, &slot);
+  if (!found) {
+    // The index doesn't point at the entry, so it's garbage.
+    AddLiveBytes(-log_.MarkDeleted(offset));
+    return true;
+  }
+
+  LogSlice stored_key, stored_value;
+  if (!log_.ReadSlices(offset, hash, &stored_key, &stored_value)) {
+    if (!log_.IsExpired(offset)) return false;
+    // Readers already miss on the entry, so it can simply be dropped.
+    idx_.BeginWrite(slot);
+    idx_.Erase(slot);
+    idx_.EndWrite(slot);
+    AddLiveBytes(-log_.MarkDeleted(offset));
+    return true;
+  }
+  // In-place updates may have left the entry with room to spare, which the copy doesn't keep.
+  offset_t moved = log_.Move(offset);
+  if (moved == -1) return false;
+  AddLiveBytes(log_.SpaceAt(moved) - log_.SpaceAt(offset));
+  stats_.Add(Stat::BYTES_RELOCATED, log_.SpaceAt(moved));
+
+  // Readers of the old entry are still safe: it isn't overwritten until the tail comes round again.
+  idx_.BeginWrite(slot);
+  idx_.Set(&slot, moved);
+  idx_.EndWrite(slot);
+  return true;
+}
+
+bool FormicaStore::Read(const std::string& key, keyhash_t hash, std::string* value) {
+  stats_.Add(Stat::READS);
+  if (front_ == nullptr) return ReadUncached(key, hash, value, nullptr);
+  if (front_->Read(key, hash, value)) return true;
+  uint32_t ticket = front_->BeginFill(hash);
+  // The view is only wanted for the entry's expiry.
+  ValueView view;
+  if (!ReadUncached(key, hash, value, &view)) return false;
+  front_->Fill(ticket, key, hash, *value, view.value.expiry);
+  return true;
+}
+
+bool FormicaStore::ReadUncached(const string& key, keyhash_t hash, string* value,
+    ValueView* view) {
+  if (mode_ == StoreMode::STORE) return ReadFromStore(key, hash, value, view);
+  uint32_t version;
+  offset_t offset = idx_.Lookup(hash, log_.tail(), &version);
+  return ReadFromLog(key, hash, offset, version, value, view);
+}
+
+void FormicaStore::MultiRead(ReadRequest* requests, int n) {
+  CoarseClock::Tick();
+  stats_.Add(Stat::READS, n);
+  offset_t offsets[MAX_BATCH_SIZE];
+  uint32_t versions[MAX_BATCH_SIZE];
+  for (int start = 0; start < n; start += MAX_BATCH_SIZE) {
+    ReadRequest* batch = requests + start;
+    int batch_size = std::min(n - start, static_cast<int>(MAX_BATCH_SIZE));
+
+    for (int i = 0; i < batch_size; ++i) idx_.Prefetch(batch[i].hash);
+
+    if (mode_ == StoreMode::STORE) {
+      for (int i = 0; i < batch_size; ++i) {
+        batch[i].found = ReadFromStore(*batch[i].key, batch[i].hash, batch[i].value, nullptr);
+      }
+      continue;
+    }
+
+    for (int i = 0; i < batch_size; ++i) {
+      offsets[i] = idx_.Lookup(batch[i].hash, log_.tail(), &versions[i]);
+      if (offsets[i] >= 0) log_.Prefetch(offsets[i]);
+    }
+
+    for (int i = 0; i < batch_size; ++i) {
+      batch[i].found = ReadFromLog(*batch[i].key, batch[i].hash, offsets[i], versions[i],
+          batch[i].value, nullptr);
+    }
+  }
+}
+
+int FormicaStore::MultiInsert(const Entry* const* entries, int n, uint32_t ttl_seconds) {
+  CoarseClock::Tick();
+  int inserted = 0;
+  for (int start = 0; start < n; start += MAX_BATCH_SIZE) {
+    const Entry* const* batch = entries + start;
+    int batch_size = std::min(n - start, static_cast<int>(MAX_BATCH_SIZE));
+
+    // Appends to the log are sequential, so only the buckets are worth prefetching.
+    for (int i = 0; i < batch_size; ++i) idx_.Prefetch(batch[i]->hash);
+    for (int i = 0; i < batch_size; ++i) inserted += InsertUnticked(*batch[i], ttl_seconds);
+  }
+  return inserted;
+}
+
+bool FormicaStore::ReadView(const string& key, keyhash_t hash, ValueView* view) {
+  stats_.Add(Stat::READS);
+  return ReadUncached(key, hash, nullptr, view);
+}
+
+bool FormicaStore::IsValid(const ValueView& view) {
+  return idx_.Validate(view.hash, view.version) &&
+      (view.value.entry_offset == LossyHash::INLINE || log_.IsValid(view.value));
+}
+
+bool FormicaStore::ReadFromLog(const string& key, keyhash_t hash, offset_t offset,
+    uint32_t version, string* value, ValueView* view) {
+  LogSlice stored_key, stored_value;
+  bool found, same_key;
+  while (true) {
+    if (offset == -1) {
+      stats_.Add(Stat::INDEX_MISSES);
+      return false;
+    }
+
+    // The key is compared, and the value copied, straight out of the log, or the bucket for an
+    // inline record. If either the bucket or the log entry changed while we were doing that, start
+    // again.
+    bool in_index = offset == LossyHash::INLINE;
+    if (in_index) {
+      LossyHash::Slot slot;
+      found = idx_.Find(hash, log_.tail(), &slot) && slot.offset == LossyHash::INLINE &&
+          idx_.ReadInline(slot, &stored_key, &stored_value);
+    } else {
+      found = log_.ReadSlices(offset, hash, &stored_key, &stored_value);
+    }
+    same_key = found && stored_key.Equals(key);
+    if (same_key && value != nullptr) stored_value.CopyTo(value);
+    if (idx_.Validate(hash, version) && (!found || in_index || log_.IsValid(stored_value))) break;
+    offset = idx_.Lookup(hash, log_.tail(), &version);
+  }
+
+  if (!found) {
+    stats_.Add(Stat::LOG_OVERWRITTEN);
     return false;
   }
 
-  if (stored_key != key) {
-    ++log_other_key_;
+  if (!same_key) {
+    stats_.Add(Stat::LOG_OTHER_KEY);
     return false;
   }
+
+  if (view != nullptr) *view = {stored_value, hash, version};
   return true;
 }
 
+bool FormicaStore::ReadFromStore(const string& key, keyhash_t hash, string* value,
+    ValueView* view) {
+  LogSlice stored_key, stored_value;
+  LossyHash::Slot slot;
+  while (true) {
+    uint32_t version = idx_.BeginRead(hash);
+    offset_t tail = log_.tail();
+    bool found = false;
+    bool more = idx_.Find(hash, tail, &slot);
+    while (more && !found) {
+      found = log_.ReadSlices(slot.offset, hash, &stored_key, &stored_value) &&
+          stored_key.Equals(key);
+      if (!found) more = idx_.FindNext(hash, tail, &slot);
+    }
+    if (found && value != nullptr) stored_value.CopyTo(value);
+    if (!idx_.Validate(hash, version) || (found && !log_.IsValid(stored_value))) continue;
+
+    if (!found) {
+      stats_.Add(Stat::INDEX_MISSES);
+      return false;
+    }
+    if (view != nullptr) *view = {stored_value, hash, version};
+    return true;
+  }
+}
+
+StatsSnapshot FormicaStore::stats() const {
+  StatsSnapshot snapshot = stats_.Snapshot();
+  // The tail counts every byte ever appended, including across restarts.
+  offset_t tail = log_.tail();
+  snapshot.Set(Stat::BYTES_WRITTEN, tail);
+  snapshot.Set(Stat::LOG_WRAPS, tail / log_.size());
+  snapshot.Set(Stat::INDEX_CAPACITY, idx_.capacity());
+  snapshot.Set(Stat::LOG_CAPACITY, log_.size());
+  snapshot.Set(Stat::FRONT_CACHE_HITS, front_cache_hits());
+  snapshot.Set(Stat::FRONT_CACHE_MISSES, front_cache_misses());
+  return snapshot;
+}
+
+MemoryFootprint FormicaStore::MemoryUsage() const {
+  MemoryFootprint usage;
+  usage.index_bytes = idx_.region().mapped_size;
+  usage.log_bytes = log_.region().mapped_size;
+  usage.overhead_bytes = sizeof(*this) + FrontCacheBytes(front_.get());
+  return usage;
+}
+
 void ChainedLossyHashStore::Insert(const Entry& entry) {
   tag_t hash_tag = ExtractHashTag(entry.hash);
   bucket_count_t bucket_num = hash_tag % num_buckets_;
@@ -152,9 +1041,13 @@ void ChainedLossyHashStore::Insert(const Entry& entry) {
     node->prev->next = nullptr;
     bucket->last = node->prev;
     node->prev = nullptr;
+    stats_.Add(Stat::EVICTIONS);
   } else {
     ++bucket->chain_len;
+    stats_.Add(Stat::INDEX_ENTRIES);
   }
+  stats_.Add(Stat::INSERTS);
+  stats_.Add(Stat::BYTES_WRITTEN, entry.key.size() + entry.value.size());
 
   bucket->first = node;
   node->next = old;
@@ -170,6 +1063,7 @@ bool ChainedLossyHashStore::Read(const string& key, keyhash_t hash, string* valu
   tag_t hash_tag = ExtractHashTag(hash);
   tag_t log_tag = ExtractLogTag(hash);
 
+  stats_.Add(Stat::READS);
   Node* node = buckets_[hash_tag % num_buckets_].first;
   while (node) {
     if (node->log_tag == log_tag && node->key == key) {
@@ -179,7 +1073,7 @@ bool ChainedLossyHashStore::Read(const string& key, keyhash_t hash, string* valu
     node = node->next;
   }
 
-  ++index_misses_;
+  stats_.Add(Stat::INDEX_MISSES);
   return false;
 }
 
@@ -187,6 +1081,25 @@ ChainedLossyHashStore::ChainedLossyHashStore(int num_buckets) : num_buckets_(num
   buckets_ = new Bucket[num_buckets_];
 }
 
+StatsSnapshot ChainedLossyHashStore::stats() const {
+  StatsSnapshot snapshot = stats_.Snapshot();
+  snapshot.Set(Stat::INDEX_CAPACITY, static_cast<int64_t>(num_buckets_) * MAX_CHAIN_LENGTH);
+  return snapshot;
+}
+
+MemoryFootprint ChainedLossyHashStore::MemoryUsage() const {
+  MemoryFootprint usage;
+  usage.index_bytes = static_cast<int64_t>(num_buckets_) * sizeof(Bucket);
+  for (int i = 0; i < num_buckets_; ++i) {
+    for (Node* node = buckets_[i].first; node != nullptr; node = node->next) {
+      usage.index_bytes += sizeof(Node);
+      usage.log_bytes += HeapBytes(node->key) + HeapBytes(node->value);
+    }
+  }
+  usage.overhead_bytes = sizeof(*this);
+  return usage;
+}
+
 ChainedLossyHashStore::~ChainedLossyHashStore() {
   if (buckets_ == nullptr) return;
   for (int i = 0; i < num_buckets_; ++i) {
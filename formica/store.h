@@ -12,7 +12,16 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include "circular-log.h"
+#include "front-cache.h"
+#include "segmented-log.h"
+#include "stats.h"
 
 namespace formica {
 
@@ -20,8 +29,17 @@ namespace formica {
 // index the hash tables, otherwise there are going to be lots of unused buckets.
 typedef int32_t bucket_count_t;
 
-// The StdMapStore uses a std::unordered_map to index offsets into a CircularLog. The offsets are
+// The StdMapStore uses a std::unordered_map to index offsets into a SegmentedLog. The offsets are
 // indexed by the full key, not the log-tag, to avoid having high-impact collisions.
+//
+// The index is lossless, so the log must never overwrite a live entry. Instead, overwritten and
+// deleted entries are left as dead space, which a cleaner reclaims by moving the live entries out of
+// the segments with the most dead space, and freeing them. By default, a write that finds no free
+// segment cleans one itself. Once StartCleaner() is called, a background thread does the cleaning
+// instead, starting whenever free segments run low, so that writes only wait for it if it falls
+// behind.
+//
+// Every operation takes a lock, so the store may be used from any number of threads.
 class StdMapStore {
  public:
   StdMapStore(space_t size);
@@ -29,86 +47,556 @@ class StdMapStore {
   // So that we can use indexes as template parameters with identical c'tor signatures.
   StdMapStore(space_t size, bucket_count_t dummy) : StdMapStore(size) { }
 
-  void Insert(const Entry& entry);
-  bool Update(const Entry& entry);
-  void Delete(const std::string& key);
+  // Stops the background cleaner, if there is one.
+  ~StdMapStore();
+
+  // Entries inserted with a non-zero 'ttl_seconds' can't be read after that many seconds. Insert()
+  // returns false, and Update() fails, if there's no room: every segment is in use, and none of them
+  // has any dead space to clean.
+  bool Insert(const Entry& entry, uint32_t ttl_seconds = 0);
+  bool Update(const Entry& entry, uint32_t ttl_seconds = 0);
+  bool Delete(const std::string& key, keyhash_t hash);
   bool Read(const std::string& key, keyhash_t hash, std::string* value);
 
+  void StartCleaner();
+
+  // Puts a FrontCache (see front-cache.h) in front of the store, which Read() checks before taking
+  // the lock. Must be called before the store is shared between threads.
+  void EnableFrontCache(space_t capacity = FrontCache::DEFAULT_CAPACITY,
+      int slot_size = FrontCache::DEFAULT_SLOT_SIZE);
+
   void DebugDump();
 
-  int index_misses() { return index_misses_; }
-  int log_overwritten() { return log_overwritten_; }
-  int log_other_key() { return log_other_key_; }
+  // Reads served by the front cache, and reads that missed it. Both are 0 if there is none.
+  int64_t front_cache_hits() const { return front_ == nullptr ? 0 : front_->hits(); }
+  int64_t front_cache_misses() const { return front_ == nullptr ? 0 : front_->misses(); }
+
+  int64_t index_misses() const { return stats_.Get(Stat::INDEX_MISSES); }
+  // The log never overwrites a live entry, so these are only reads of entries that had expired.
+  int64_t log_overwritten() const { return stats_.Get(Stat::LOG_OVERWRITTEN); }
+  int64_t log_other_key() const { return stats_.Get(Stat::LOG_OTHER_KEY); }
+
+  // How much cleaning has been done.
+  int64_t segments_cleaned() const { return stats_.Get(Stat::SEGMENTS_CLEANED); }
+  int64_t bytes_relocated() const { return stats_.Get(Stat::BYTES_RELOCATED); }
+
+  // All of the above, and more (see Stat). Takes the lock, for the gauges.
+  StatsSnapshot stats();
+
+  // The index's bytes are estimated from the sizes of the unordered_map's buckets and nodes (as
+  // libstdc++ lays them out), and of the keys that don't fit inside a std::string. Takes the lock,
+  // and visits every key.
+  MemoryFootprint MemoryUsage();
+
+  // Segments are 1 / NUM_SEGMENTS of the log, but no smaller than MIN_SEGMENT_SIZE unless the log
+  // is very small.
+  static constexpr int NUM_SEGMENTS = 64;
+  static constexpr space_t MIN_SEGMENT_SIZE = 4096;
+
+  // Writes never take the last free segment, so that the cleaner always has somewhere to move
+  // entries to.
+  static constexpr int CLEANER_RESERVE = 1;
+
+  // The background cleaner releases the lock after moving this many entries, to let other
+  // operations in.
+  static constexpr int CLEAN_BATCH_SIZE = 64;
 
  private:
-  CircularLog log_;
+  // Appends 'entry', cleaning first, or waiting for the cleaner, if there's no room. Returns -1 if
+  // there's still no room. May release 'lock' while waiting, so iterators into 'idx_' don't
+  // survive it.
+  offset_t Append(std::unique_lock<std::mutex>* lock, const Entry& entry, uint32_t expiry);
+
+  // Moves the live entries out of the segment with the most dead space, and frees it. Returns false
+  // if there was no segment worth cleaning. If 'lock' is given, releases it every CLEAN_BATCH_SIZE
+  // entries.
+  bool CleanSegment(std::unique_lock<std::mutex>* lock);
+
+  // Marks an entry that the index no longer points at as dead.
+  void Discard(offset_t offset);
+
+  void RunCleaner();
+
+  // Read(), without the front cache. Sets 'expiry' to the entry's expiry time.
+  bool ReadLocked(const std::string& key, keyhash_t hash, std::string* value, uint32_t* expiry);
+
+  // The background cleaner starts when there are fewer than low_watermark() free segments, and
+  // stops when there are high_watermark(), or nothing more can be cleaned.
+  int low_watermark() const;
+  int high_watermark() const;
+
+  std::mutex mu_;
+  SegmentedLog log_;
+  std::unique_ptr<FrontCache> front_;
 
   // Index (hash, offset) pairs by the full key. It's easy to change this to use a tag_t for better
   // performance, but a lot more collisions.
   std::unordered_map<std::string, std::pair<keyhash_t, offset_t>> idx_;
 
-  int index_misses_ = 0;
-  int log_overwritten_ = 0;
-  int log_other_key_ = 0;
+  std::thread cleaner_;
+  // Wakes the cleaner when free segments run low.
+  std::condition_variable cleaner_wake_;
+  // Wakes writers waiting for the cleaner to finish a pass.
+  std::condition_variable pass_done_;
+  bool stopping_ = false;
+  int cleaner_passes_ = 0;
+  // Whether the last pass freed anything.
+  bool cleaner_progress_ = true;
+  // Whether any entry has died since the cleaner last failed to free anything. If not, cleaning
+  // again can't help.
+  bool garbage_ = true;
+
+  std::string clean_key_;
+  std::string clean_value_;
+
+  Stats stats_;
 };
 
 // This is the Formica version of MICA's lossy hash table.
+//
+// It indexes the logical offsets of a CircularLog of 'log_size' bytes, and is passed the log's tail
+// on every call, so it can tell which entries point at data that the log has since overwritten.
+// Those entries are never returned by lookups, and are the first to be evicted.
+//
+// If 'num_overflow_buckets' is not 0, the table is lossless instead, as in MICA's store mode: a full
+// bucket is chained to an overflow bucket from a pool shared by all buckets, and Insert() fails
+// only once the pool is used up. Overflow buckets are never returned to the pool.
 class LossyHash {
  public:
-  LossyHash(bucket_count_t num_buckets);
-
-  offset_t Lookup(keyhash_t hash);
-  void Insert(keyhash_t hash, offset_t offset, offset_t log_tail);
+  LossyHash(bucket_count_t num_buckets, space_t log_size,
+      const MemoryOptions& options = MemoryOptions(), bucket_count_t num_overflow_buckets = 0);
+  ~LossyHash();
+
+  offset_t Lookup(keyhash_t hash, offset_t log_tail);
+
+  // Returns true if the log entry at 'offset' has expired. Passed to Insert() with a 'context'.
+  typedef bool (*ExpiredFn)(const void* context, offset_t offset);
+
+  // If the bucket is full, evicts the entry with the oldest offset, or if the table is lossless,
+  // adds an overflow bucket. Returns false if a lossless table has no more room. If 'expired' is
+  // given, an entry that it says has expired is evicted ahead of the oldest, unless the log has
+  // already overwritten one.
+  //
+  // A lossy table keeps at most one entry per index tag in a bucket, replacing any existing one. A
+  // lossless table doesn't, so the caller must check that the key isn't already present.
+  bool Insert(keyhash_t hash, offset_t offset, offset_t log_tail, ExpiredFn expired = nullptr,
+      const void* context = nullptr);
+
+  // Concurrent readers use the per-bucket version as a seqlock: Lookup() returns a consistent
+  // snapshot of the bucket, along with the version it was read at. Once the reader is done with
+  // the offset (i.e. has read from the log), it must call Validate() with the same version, and
+  // retry if that returns false. Lookup() never blocks, but will retry if a write to the bucket is
+  // in progress.
+  //
+  // Only one thread may call Insert() at a time.
+  offset_t Lookup(keyhash_t hash, offset_t log_tail, uint32_t* version);
+  bool Validate(keyhash_t hash, uint32_t version);
+
+  // Waits for any write to the bucket for 'hash' to finish, and returns its version, for readers
+  // that walk the bucket with Find() and FindNext() rather than calling Lookup().
+  uint32_t BeginRead(keyhash_t hash);
+
+  // Issues prefetches for the bucket that 'hash' maps to.
+  void Prefetch(keyhash_t hash);
+
+  // Removes the entry with the index tag for 'hash', which may belong to a different key. Use
+  // FormicaStore::Delete(), which checks the key in the log first, to be sure.
+  void Delete(keyhash_t hash, offset_t log_tail);
+
+  // A handle to one entry in the table, so that it can be changed without looking it up again.
+  struct Slot {
+    // The bucket that 'hash' maps to, whose version covers its whole overflow chain.
+    bucket_count_t head = -1;
+    // The bucket that holds the entry, either 'head' or one of its overflow buckets.
+    bucket_count_t bucket = -1;
+    int8_t entry = -1;
+    offset_t offset = -1;
+  };
 
-  // TODO: Does deletion require a full read from the log to confirm we're deleting the right thing?
-  void Delete(keyhash_t hash);
+  // Finds the first live entry with the index tag for 'hash'. FindNext() finds the one after
+  // 'slot', for when the first belongs to a different key. Neither checks the bucket version, so
+  // readers must call BeginRead() first and Validate() after.
+  bool Find(keyhash_t hash, offset_t log_tail, Slot* slot);
+  bool FindNext(keyhash_t hash, offset_t log_tail, Slot* slot);
+
+  // Points 'slot' at a new offset, or empties it. Must be called between BeginWrite() and
+  // EndWrite() for the slot. Only Erase() may be used on an inline slot.
+  void Set(Slot* slot, offset_t offset);
+  void Erase(const Slot& slot);
+
+  // Makes concurrent readers of the slot's bucket retry until EndWrite() is called. Also used to
+  // cover writes to the log that readers can't otherwise detect.
+  void BeginWrite(const Slot& slot) { BeginWrite(&buckets_[slot.head]); }
+  void EndWrite(const Slot& slot) { EndWrite(&buckets_[slot.head]); }
+
+  const Region& region() const { return region_; }
+  bool lossless() const { return num_overflow_buckets_ > 0; }
+  bucket_count_t overflow_buckets_used() const { return overflow_buckets_used_; }
+
+  // The entries in the main buckets, not counting any overflow buckets.
+  int64_t capacity() const { return static_cast<int64_t>(num_buckets_) * Bucket::NUM_ENTRIES; }
+
+  // Counts EVICTIONS, and keeps the INDEX_ENTRIES and OVERFLOW_BUCKETS gauges, in 'stats', which
+  // must outlive the table. Must be called before anything is inserted.
+  void set_stats(Stats* stats) { stats_ = stats; }
+
+  // Returned by Lookup(), and set in Slot::offset, for an entry whose value is stored in the index
+  // itself, rather than the log.
+  static constexpr offset_t INLINE = -2;
+
+  // Lets the table hold inline records, which keep a small key and value in the bucket itself (see
+  // InsertInline()). Only for lossy tables, and must be called before anything is inserted.
+  void EnableInline();
+  bool inline_enabled() const { return inline_; }
+
+  // An inline record takes up one entry for its header, followed by up to MAX_INLINE_WORDS entries
+  // holding the key and then the value. Returns true if 'key' and 'value' fit.
+  static constexpr int MAX_INLINE_WORDS = 3;
+  static constexpr int MAX_INLINE_VALUE_SIZE = 8;
+  static bool CanInline(const std::string& key, const std::string& value);
+
+  // Stores 'key' and 'value', which must fit, in the bucket for 'hash', replacing any entry with
+  // the same index tag as Insert() does. If the bucket doesn't have enough empty entries in a row,
+  // evicts its oldest record, along with any that follow it and are in the way.
+  void InsertInline(keyhash_t hash, const std::string& key, const std::string& value,
+      offset_t log_tail);
+
+  // For a slot whose offset is INLINE, points 'key' and 'value' at the record in the bucket. Like
+  // the rest of the bucket, they must be read between BeginRead() and Validate(). Returns false if
+  // the record is malformed, which a reader may see while the bucket is being written.
+  bool ReadInline(const Slot& slot, LogSlice* key, LogSlice* value);
+
+  // Writes to different buckets may be made from different threads, as long as each bucket only
+  // ever has one writer.
+  bucket_count_t BucketIndex(keyhash_t hash) const { return ExtractHashTag(hash) % num_buckets_; }
 
  private:
-  struct Entry {
-    tag_t tag = 0;
-    offset_t offset = -1;
-  };
-  struct Bucket {
-    // sizeof(Entry) == 12 right now, so to copy the paper and fit into two cache lines we have 128
-    // / 12 == 10 entries per bucket. The paper says they have 15 entries per bucket, so their entry
-    // must be smaller. Perhaps they are using 56-bit offsets and packing everything into a 64-bit
-    // Entry? That would fit directly into 128 bytes, but they need to save some space for the
-    // version field, which we don't have.
-    //
-    // Right now this is tweaked so that the benchmark runs don't have any misses, and so this is
-    // about 4.5 cache lines.
-    static constexpr int8_t NUM_ENTRIES = 24;
+  // Each entry packs a 16-bit index tag (see ExtractIndexTag()) into the top of a 64-bit word, over
+  // a bit that marks inline records, and the low 47 bits of a log offset. An all-zero entry is
+  // empty; index tags are never 0.
+  typedef uint64_t Entry;
+  static constexpr int TAG_SHIFT = 48;
+  static constexpr int OFFSET_BITS = 47;
+  static constexpr Entry OFFSET_MASK = (1ULL << OFFSET_BITS) - 1;
+  static constexpr Entry INLINE_BIT = 1ULL << OFFSET_BITS;
+
+  static Entry MakeEntry(uint16_t tag, offset_t offset) {
+    return (static_cast<Entry>(tag) << TAG_SHIFT) | (static_cast<Entry>(offset) & OFFSET_MASK);
+  }
+  static uint16_t EntryTag(Entry entry) { return entry >> TAG_SHIFT; }
+
+  // An inline record is a header entry, with the index tag and INLINE_BIT, followed by entries that
+  // hold the key's bytes and then the value's. In place of an offset, the header has the sizes of
+  // the key and value, and the low STAMP_BITS of the log tail when the record was inserted, which
+  // gives it an age to compare with other entries' when choosing what to evict.
+  static constexpr int STAMP_BITS = 38;
+  static constexpr Entry STAMP_MASK = (1ULL << STAMP_BITS) - 1;
+  static bool IsInline(Entry entry) { return (entry & INLINE_BIT) != 0; }
+  static int InlineKeySize(Entry entry) { return (entry >> STAMP_BITS) & 31; }
+  static int InlineValueSize(Entry entry) { return (entry >> (STAMP_BITS + 5)) & 15; }
+
+  // The number of entries taken up by the record that starts with 'entry'.
+  static int RecordSize(Entry entry) {
+    return IsInline(entry) ? 1 + (InlineKeySize(entry) + InlineValueSize(entry) + 7) / 8 : 1;
+  }
+
+  // As EntryAge(), for any record. Inline records are never stale.
+  static int64_t RecordAge(Entry entry, offset_t log_tail) {
+    if (!IsInline(entry)) return EntryAge(entry, log_tail);
+    return (static_cast<uint64_t>(log_tail) - entry) & STAMP_MASK;
+  }
+
+  // Returns how far behind 'log_tail' the entry's offset is. Offsets are stored modulo 2^47, which
+  // is unambiguous because live entries are never more than log_size_ behind the tail. A reader may
+  // see an entry appended after it read the tail, which comes out as a small negative distance.
+  static int64_t EntryAge(Entry entry, offset_t log_tail) {
+    int64_t age = (static_cast<uint64_t>(log_tail) - entry) & OFFSET_MASK;
+    return age >= (1LL << (OFFSET_BITS - 1)) ? age - (1LL << OFFSET_BITS) : age;
+  }
+
+  // Returns the full offset of 'entry', or -1 if the log has overwritten it.
+  offset_t EntryOffset(Entry entry, offset_t log_tail) const {
+    int64_t age = EntryAge(entry, log_tail);
+    return age > log_size_ ? -1 : log_tail - age;
+  }
+
+  // As in the paper, a bucket is two cache lines: an 8-byte header followed by 15 entries. This
+  // replaces a layout of 24 unpacked {tag, offset} pairs which took about 4.5 cache lines.
+  struct alignas(64) Bucket {
+    // Odd while a writer is modifying this bucket or its overflow chain, incremented twice per
+    // write. Unused in overflow buckets.
+    std::atomic<uint32_t> version;
+
+    union {
+      // 1 + the index in the overflow pool of the next bucket in the chain, or 0 at the end of it.
+      uint32_t overflow;
+
+      // In a table with inline records, which is never lossless, bit i is set if entry i holds part
+      // of an inline record's key or value, rather than starting a record. This saves walking the
+      // bucket record by record, which would be a chain of dependent loads.
+      uint32_t inline_words;
+    };
+
+    static constexpr int8_t NUM_ENTRIES = 15;
     Entry entries[NUM_ENTRIES];
-    int32_t padding;
-    int16_t padding2;
   };
+  static_assert(sizeof(Bucket) == 128, "Buckets should be exactly two cache lines");
+
+  // Returns a mask with bit i set if entry i of 'bucket' has 'tag'. Uses SSE2 or AVX2 if available.
+  static uint32_t MatchTags(const Bucket* bucket, uint16_t tag);
+
+  // Returns a mask with bit i set if entry i of 'bucket' starts a record, or is empty, rather than
+  // holding part of an inline record's key or value, which may look like anything. Only for tables
+  // with inline records.
+  static uint32_t RecordStarts(const Bucket* bucket) {
+    return ~bucket->inline_words & ((1U << Bucket::NUM_ENTRIES) - 1);
+  }
+
+  // Empties every entry of the record that starts at entry 'idx' of 'bucket'.
+  static void EraseRecord(Bucket* bucket, int idx);
+
+  void AddStat(Stat stat, int64_t delta) {
+    if (stats_ != nullptr) stats_->Add(stat, delta);
+  }
+
+  // Returns the next bucket in the chain after 'bucket', or nullptr. Readers may see a torn
+  // 'overflow' index, and lossy tables may use it for 'inline_words', so it is bounds-checked.
+  Bucket* NextInChain(const Bucket* bucket) {
+    uint32_t next = bucket->overflow;
+    if (next == 0 || next > num_overflow_buckets_) return nullptr;
+    return &buckets_[num_buckets_ + next - 1];
+  }
+
+  Bucket* BucketFor(keyhash_t hash) { return &(buckets_[BucketIndex(hash)]); }
+
+  void BeginWrite(Bucket* bucket);
+  void EndWrite(Bucket* bucket);
 
   bucket_count_t num_buckets_ = 0;
+  const space_t log_size_;
+
+  // The overflow pool follows the 'num_buckets_' main buckets in 'buckets_', and is handed out in
+  // order.
+  const bucket_count_t num_overflow_buckets_;
+  bucket_count_t overflow_buckets_used_ = 0;
+
+  // If not set, there are no inline records, so every entry starts a record.
+  bool inline_ = false;
+
+  Stats* stats_ = nullptr;
+
   Bucket* buckets_;
+  Region region_;
+};
+
+// A single GET in a batch passed to FormicaStore::MultiRead(). 'found' is set by MultiRead().
+struct ReadRequest {
+  const std::string* key;
+  keyhash_t hash;
+  std::string* value;
+  bool found;
+};
+
+// A value returned by FormicaStore::ReadView(), which points into the store's log, along with
+// what's needed to tell if it has since been overwritten.
+struct ValueView {
+  LogSlice value;
+  keyhash_t hash;
+  uint32_t version;
+};
+
+// MICA's two modes of operation.
+enum class StoreMode {
+  // A lossy cache: full buckets evict their oldest entry, and the log overwrites its oldest entries.
+  CACHE,
+
+  // A lossless store: full buckets chain to overflow buckets, and live entries at the head of the
+  // log are moved to the tail, rather than overwritten, when the log needs room. Insert() fails
+  // once the store is actually full. Relocating an entry rehashes its key, so every hash passed to
+  // the store must come from the store's hash function.
+  STORE
 };
 
 // FormicaStore uses a LossyHash to index a CircularLog.
+//
+// Read() may be called from any number of threads while a single thread calls Insert(). Readers
+// never take a lock; instead they retry if the bucket they looked up, or the log entry they copied,
+// changed underneath them.
 class FormicaStore {
  public:
-  FormicaStore(space_t size, bucket_count_t num_buckets);
+  FormicaStore(space_t size, bucket_count_t num_buckets,
+      const MemoryOptions& options = MemoryOptions());
+
+  // In STORE mode, the index also gets a pool of num_buckets / 2 overflow buckets, and entries may
+  // be no larger than 1 / NUM_SEGMENTS of the log. 'hash' must be the function that callers hash
+  // keys with, e.g. WyHash::Hash for Entry(key, value, WyHash()).
+  FormicaStore(space_t size, bucket_count_t num_buckets, StoreMode mode,
+      const MemoryOptions& options = MemoryOptions(), HashFunction hash = DefaultHash::Hash);
+
+  // Keeps the log in the file at 'path' (see CircularLog). If the file already holds a log, the
+  // index is rebuilt from it by 'rebuild_threads' threads, each scanning a different part of the
+  // log, so that the store comes back warm. Keys are rehashed with 'hash', which must be the same
+  // function as before the restart.
+  FormicaStore(const std::string& path, space_t size, bucket_count_t num_buckets,
+      int rebuild_threads = 4, HashFunction hash = DefaultHash::Hash);
+
+  // The hash function that the store recomputes hashes with.
+  keyhash_t Hash(const std::string& key) const { return hash_(key); }
+
+  // Returns false if the entry was not inserted: in CACHE mode, only if it is larger than the log;
+  // in STORE mode, also if there's no room left for it. In STORE mode, inserting a key that is
+  // already present updates it.
+  //
+  // If 'ttl_seconds' is not 0, the entry expires that many seconds from CoarseClock::Now(). Reads
+  // of an expired entry miss, and in CACHE mode, it is the first to be evicted from its bucket; in
+  // STORE mode, the cleaner drops it rather than moving it.
+  bool Insert(const Entry& entry, uint32_t ttl_seconds = 0);
+
+  // Replaces the value of an existing key, in place in the log if the new value fits, and by
+  // appending otherwise. Returns false if the key isn't in the store (or in STORE mode, if there's
+  // no room for the new value). The new value gets a new 'ttl_seconds'.
+  bool Update(const Entry& entry, uint32_t ttl_seconds = 0);
+
+  // Returns false if the key isn't in the store.
+  bool Delete(const std::string& key, keyhash_t hash);
 
-  void Insert(const Entry& entry);
-  bool Update(const Entry& entry);
-  void Delete(const std::string& key);
   bool Read(const std::string& key, keyhash_t hash, std::string* value);
 
+  // Zero-copy version of Read(). The key is compared in place in the log, and 'view' points at the
+  // stored value rather than copying it. The bytes may be overwritten by any later write to the
+  // store (or a concurrent one, on another thread); callers must check IsValid() after they have
+  // finished reading them, and discard what they read if it returns false. If the value is
+  // compressed, so is the view: read it with CopyTo().
+  bool ReadView(const std::string& key, keyhash_t hash, ValueView* view);
+  bool IsValid(const ValueView& view);
+
+  // Batched versions of Read() and Insert(). Rather than taking the bucket and log cache misses for
+  // one key after another, each stage is done for the whole batch, prefetching what the next stage
+  // needs, so that the misses for different keys overlap. Batches larger than MAX_BATCH_SIZE are
+  // processed in chunks. Entries in a MultiInsert() batch are inserted in order, with the same
+  // 'ttl_seconds'. MultiInsert() returns the number of entries that were inserted. Both advance
+  // the CoarseClock, once per call.
+  void MultiRead(ReadRequest* requests, int n);
+  int MultiInsert(const Entry* const* entries, int n, uint32_t ttl_seconds = 0);
+  static constexpr int MAX_BATCH_SIZE = 32;
+
+  // In STORE mode, the log is cleaned a segment at a time. Three segments' worth of the log are
+  // kept free: one for the entries being moved by the cleaner, and up to two between cleanings.
+  static constexpr int NUM_SEGMENTS = 32;
+
+  StoreMode mode() const { return mode_; }
+
+  // Turns compression of values written from now on on or off (see CircularLog). Compressed
+  // values take up less of the log, so more of them fit, at the cost of compressing every write
+  // and decompressing every read.
+  void set_compression(bool enabled) { log_.set_compression(enabled); }
+
+  // Keeps entries whose value is at most LossyHash::MAX_INLINE_VALUE_SIZE bytes, and whose key and
+  // value fit in LossyHash::MAX_INLINE_WORDS index entries, in the index bucket rather than the
+  // log, so that reading them takes no log cache miss. Entries with a TTL still go to the log. Only
+  // for in-memory CACHE mode stores, since the index isn't kept across a restart, and must be
+  // called before anything is inserted.
+  void EnableInlineValues();
+
+  // Puts a FrontCache (see front-cache.h) in front of the store. Read() checks it before the index,
+  // and fills it from the log for keys that miss twice in a short while; every write invalidates
+  // it. In CACHE mode, a key may still be read from it after the store has evicted the key (but
+  // never after it has been updated or deleted). MultiRead() and ReadView() don't use it. Must be
+  // called before the store is shared between threads.
+  void EnableFrontCache(space_t capacity = FrontCache::DEFAULT_CAPACITY,
+      int slot_size = FrontCache::DEFAULT_SLOT_SIZE);
+
+  // In STORE mode, the space taken up in the log by live entries.
+  space_t live_bytes() const { return live_bytes_; }
+
   void DebugDump();
 
-  int index_misses() { return index_misses_; }
-  int log_overwritten() { return log_overwritten_; }
-  int log_other_key() { return log_other_key_; }
+  // What the index and log were actually allocated with.
+  const Region& index_region() const { return idx_.region(); }
+  const Region& log_region() const { return log_.region(); }
+
+  int64_t index_misses() const { return stats_.Get(Stat::INDEX_MISSES); }
+  int64_t log_overwritten() const { return stats_.Get(Stat::LOG_OVERWRITTEN); }
+  int64_t log_other_key() const { return stats_.Get(Stat::LOG_OTHER_KEY); }
+
+  // Reads served by the front cache, and reads that missed it. Both are 0 if there is none.
+  int64_t front_cache_hits() const { return front_ == nullptr ? 0 : front_->hits(); }
+  int64_t front_cache_misses() const { return front_ == nullptr ? 0 : front_->misses(); }
+
+  // All of the above, and more (see Stat). May be called from any thread, without blocking the
+  // store's readers or writer.
+  StatsSnapshot stats() const;
+
+  // The index and log regions, including any overflow buckets. Bytes per live key is this over
+  // stats()[Stat::INDEX_ENTRIES], which in CACHE mode may count entries whose data the log has
+  // overwritten.
+  MemoryFootprint MemoryUsage() const;
 
  private:
+  // Read() or ReadView(), without the front cache.
+  bool ReadUncached(const std::string& key, keyhash_t hash, std::string* value, ValueView* view);
+
+  // Insert(), without ticking the CoarseClock, for MultiInsert() which ticks once per batch.
+  bool InsertUnticked(const Entry& entry, uint32_t ttl_seconds);
+
+  // Inserts every live, undeleted entry in the log into the (empty) index.
+  void RebuildIndex(int num_threads);
+
+  // Finds the slot that holds 'key', checking the key in the log.
+  bool FindKey(const std::string& key, keyhash_t hash, LossyHash::Slot* slot);
+
+  // Insert() (if 'insert' is true) or Update() in STORE mode.
+  bool StoreWrite(const Entry& entry, bool insert, uint32_t expiry);
+
+  // Returns the CoarseClock time at which an entry written now with 'ttl_seconds' expires.
+  uint32_t ExpiryFor(uint32_t ttl_seconds);
+
+  // A LossyHash::ExpiredFn for 'context', a FormicaStore.
+  static bool IsExpired(const void* context, offset_t offset);
+
+  // Read() and ReadView() in STORE mode, which check every entry with a matching tag.
+  bool ReadFromStore(const std::string& key, keyhash_t hash, std::string* value, ValueView* view);
+
+  // In STORE mode, cleans the head of the log until there's room for an entry that takes up
+  // 'space' bytes, plus a segment for the cleaner. Returns false if the store is full.
+  bool MakeRoom(space_t space);
+
+  // Moves the entry at the head of the log, 'offset', to the tail, if it is still live.
+  bool Relocate(offset_t offset, const LogSlice& key);
+
+  // Insert() in CACHE mode, which Update() also uses to replace an inline record.
+  bool CacheWrite(const Entry& entry, uint32_t expiry);
+
+  // Update() in CACHE mode.
+  bool CacheUpdate(const Entry& entry, uint32_t expiry);
+
+  // Completes a Read() or ReadView() once 'hash' has been looked up in the index at 'version'.
+  // 'offset' may be LossyHash::INLINE, in which case the entry is read from the bucket instead.
+  // Either of 'value' or 'view' may be null.
+  bool ReadFromLog(const std::string& key, keyhash_t hash, offset_t offset, uint32_t version,
+      std::string* value, ValueView* view);
+
+  const StoreMode mode_ = StoreMode::CACHE;
+  const HashFunction hash_ = DefaultHash::Hash;
+  // Declared before idx_, which counts into it.
+  Stats stats_;
   LossyHash idx_;
   CircularLog log_;
-  int index_misses_ = 0;
-  int log_overwritten_ = 0;
-  int log_other_key_ = 0;
+  std::unique_ptr<FrontCache> front_;
+
+  // Set once any entry has been written with a TTL. Until then, Insert() doesn't ask the index to
+  // look for expired entries, which would mean reading the log for each entry in a full bucket.
+  bool ttl_used_ = false;
+
+  // Keeps the LIVE_BYTES gauge in step with live_bytes_.
+  void AddLiveBytes(int64_t delta) {
+    live_bytes_ += delta;
+    stats_.Add(Stat::LIVE_BYTES, delta);
+  }
+
+  // Only used in STORE mode, by the writer.
+  space_t live_bytes_ = 0;
+  std::string clean_key_;
 };
 
 // The ChainedLossyHashStore uses a traditional linear-chained hash table to both index and store
@@ -125,12 +613,18 @@ class ChainedLossyHashStore {
 
   void DebugDump();
 
-  int index_misses() { return index_misses_; }
-  int log_overwritten() { return 0; }
-  int log_other_key() { return 0; }
+  int64_t index_misses() const { return stats_.Get(Stat::INDEX_MISSES); }
+  int64_t log_overwritten() const { return 0; }
+  int64_t log_other_key() const { return 0; }
+
+  StatsSnapshot stats() const;
+
+  // The index is the buckets and chain nodes, and the log is the keys and values that don't fit
+  // inside their nodes' std::strings. Visits every node.
+  MemoryFootprint MemoryUsage() const;
 
  private:
-  int index_misses_ = 0;
+  Stats stats_;
   static constexpr int MAX_CHAIN_LENGTH = 24;
 
   struct Node {
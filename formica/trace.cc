@@ -0,0 +1,100 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "trace.h"
+
+#include <cstring>
+
+namespace formica {
+
+static constexpr char TRACE_MAGIC[] = "FMTRACE";
+static constexpr int8_t TRACE_VERSION = 1;
+static constexpr int TRACE_HEADER_SIZE = 8;
+
+static bool HasValue(TraceOp op) { return op == TraceOp::PUT || op == TraceOp::UPDATE; }
+
+TraceWriter::TraceWriter(const std::string& path) : file_(fopen(path.c_str(), "wb")) {
+  if (file_ == nullptr) return;
+  // Most records are small, so a large buffer saves most of the write() calls.
+  setvbuf(file_, nullptr, _IOFBF, 1 << 20);
+  char header[TRACE_HEADER_SIZE];
+  memcpy(header, TRACE_MAGIC, TRACE_HEADER_SIZE - 1);
+  header[TRACE_HEADER_SIZE - 1] = TRACE_VERSION;
+  failed_ = fwrite(header, 1, TRACE_HEADER_SIZE, file_) != TRACE_HEADER_SIZE;
+}
+
+TraceWriter::~TraceWriter() {
+  if (file_ != nullptr) fclose(file_);
+}
+
+void TraceWriter::Append(TraceOp op, const std::string& key, const std::string& value) {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (!ok()) return;
+  bool has_value = HasValue(op);
+  int8_t* ptr = header_;
+  *ptr++ = static_cast<int8_t>(op);
+  ptr = PutVarint(ptr, key.size());
+  if (has_value) ptr = PutVarint(ptr, value.size());
+
+  size_t header_size = ptr - header_;
+  bool written = fwrite(header_, 1, header_size, file_) == header_size &&
+      fwrite(key.data(), 1, key.size(), file_) == key.size() &&
+      (!has_value || fwrite(value.data(), 1, value.size(), file_) == value.size());
+  if (!written) {
+    failed_ = true;
+    return;
+  }
+  ++records_;
+}
+
+bool TraceWriter::Flush() {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (ok() && fflush(file_) != 0) failed_ = true;
+  return ok();
+}
+
+TraceReader::TraceReader(const std::string& path) : region_(MapFileForRead(path)) {
+  if (region_.ptr == nullptr || region_.mapped_size < TRACE_HEADER_SIZE) return;
+  const char* header = static_cast<const char*>(region_.ptr);
+  if (memcmp(header, TRACE_MAGIC, TRACE_HEADER_SIZE - 1) != 0 ||
+      header[TRACE_HEADER_SIZE - 1] != TRACE_VERSION) {
+    return;
+  }
+  ptr_ = static_cast<const int8_t*>(region_.ptr) + TRACE_HEADER_SIZE;
+  end_ = static_cast<const int8_t*>(region_.ptr) + region_.mapped_size;
+  ok_ = true;
+}
+
+TraceReader::~TraceReader() { FreeRegion(region_); }
+
+bool TraceReader::Next(TraceRecord* record) {
+  if (!ok_ || ptr_ == end_) return false;
+  const int8_t* ptr = ptr_;
+  uint8_t op = *ptr++;
+  record->op = static_cast<TraceOp>(op);
+  record->valuelen = 0;
+  if (op > static_cast<uint8_t>(TraceOp::DELETE)) ptr = nullptr;
+  if (ptr != nullptr) ptr = GetVarint(ptr, end_, &record->keylen);
+  if (ptr != nullptr && HasValue(record->op)) ptr = GetVarint(ptr, end_, &record->valuelen);
+  uint64_t size = static_cast<uint64_t>(record->keylen) + record->valuelen;
+  if (ptr == nullptr || static_cast<uint64_t>(end_ - ptr) < size) {
+    truncated_ = true;
+    ptr_ = end_;
+    return false;
+  }
+  record->key = reinterpret_cast<const char*>(ptr);
+  record->value = record->key + record->keylen;
+  ptr_ = ptr + record->keylen + record->valuelen;
+  return true;
+}
+
+}
@@ -0,0 +1,177 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "memory.h"
+
+namespace formica {
+
+// Traces of store operations, for replaying real traffic, with its real keys, value sizes and mix
+// of operations, against any store (see TraceReplay in formica-benchmark.cc).
+//
+// A trace file is an 8-byte header, "FMTRACE" and a version byte, followed by one record per
+// operation:
+//
+//   op (1 byte) | keylen | valuelen | key | value
+//
+// where the lengths are varints, and only PUT and UPDATE records have a valuelen and value. Hashes
+// aren't kept: they are recomputed from the keys on replay, with the replaying store's hash.
+enum class TraceOp : uint8_t {
+  GET,
+  // Insert().
+  PUT,
+  UPDATE,
+  DELETE
+};
+
+// Appends records to a trace file, replacing whatever was there. Records are buffered, and are only
+// all in the file once the writer is destroyed or Flush() returns. Any number of threads may call
+// Append(); records are written whole, in the order that the calls take the writer's lock.
+class TraceWriter {
+ public:
+  explicit TraceWriter(const std::string& path);
+  ~TraceWriter();
+
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+
+  // False if the file couldn't be created, or a write to it has failed, in which case Append()
+  // does nothing.
+  bool ok() const { return file_ != nullptr && !failed_; }
+
+  // 'value' is ignored for GET and DELETE.
+  void Append(TraceOp op, const std::string& key, const std::string& value = std::string());
+
+  bool Flush();
+
+  int64_t records() const { return records_; }
+
+ private:
+  std::mutex mu_;
+  FILE* file_;
+  bool failed_ = false;
+  int64_t records_ = 0;
+  // The header of the record being written.
+  int8_t header_[1 + 2 * MAX_VARINT_SIZE];
+};
+
+// Wraps a store, recording every operation on it to a TraceWriter before passing it on. Has
+// whichever of Insert(), Update(), Delete() and Read() the store has, with the same signatures.
+//
+//   TraceWriter writer("/tmp/trace");
+//   TracingStore<FormicaStore> store(&formica, &writer);
+template <typename Store>
+class TracingStore {
+ public:
+  TracingStore(Store* store, TraceWriter* writer) : store_(store), writer_(writer) { }
+
+  template <typename... Args>
+  auto Insert(const Entry& entry, Args... args) ->
+      decltype(std::declval<Store&>().Insert(entry, args...)) {
+    writer_->Append(TraceOp::PUT, entry.key, entry.value);
+    return store_->Insert(entry, args...);
+  }
+
+  template <typename... Args>
+  auto Update(const Entry& entry, Args... args) ->
+      decltype(std::declval<Store&>().Update(entry, args...)) {
+    writer_->Append(TraceOp::UPDATE, entry.key, entry.value);
+    return store_->Update(entry, args...);
+  }
+
+  template <typename... Args>
+  auto Delete(const std::string& key, keyhash_t hash, Args... args) ->
+      decltype(std::declval<Store&>().Delete(key, hash, args...)) {
+    writer_->Append(TraceOp::DELETE, key);
+    return store_->Delete(key, hash, args...);
+  }
+
+  template <typename... Args>
+  auto Read(const std::string& key, keyhash_t hash, std::string* value, Args... args) ->
+      decltype(std::declval<Store&>().Read(key, hash, value, args...)) {
+    writer_->Append(TraceOp::GET, key);
+    return store_->Read(key, hash, value, args...);
+  }
+
+  Store* store() { return store_; }
+
+ private:
+  Store* store_;
+  TraceWriter* writer_;
+};
+
+// One record of a trace, pointing into the TraceReader's mapping of the file.
+struct TraceRecord {
+  TraceOp op;
+  const char* key;
+  uint32_t keylen;
+  const char* value;
+  uint32_t valuelen;
+};
+
+// Reads a trace file through a read-only mapping, without copying it.
+class TraceReader {
+ public:
+  explicit TraceReader(const std::string& path);
+  ~TraceReader();
+
+  TraceReader(const TraceReader&) = delete;
+  TraceReader& operator=(const TraceReader&) = delete;
+
+  // False if the file couldn't be mapped, or isn't a trace of this version.
+  bool ok() const { return ok_; }
+
+  // Reads the next record, whose key and value stay valid as long as the reader. Returns false at
+  // the end of the trace, or at a malformed record, in which case truncated() is set.
+  bool Next(TraceRecord* record);
+  bool truncated() const { return truncated_; }
+
+ private:
+  Region region_;
+  const int8_t* ptr_ = nullptr;
+  const int8_t* end_ = nullptr;
+  bool ok_ = false;
+  bool truncated_ = false;
+};
+
+// A trace operation, decoded and hashed, for replay. GETs and DELETEs have an empty value.
+struct TraceOperation {
+  TraceOp op;
+  Entry entry;
+};
+
+// Decodes up to 'max_records' records from the trace at 'path', so that replaying them costs
+// nothing but the store operations. Keys are hashed with 'Hash', as for Entry. Returns false, with
+// what could be read in 'ops', if the trace couldn't be read or ended with a malformed record.
+template <typename Hash = DefaultHash>
+bool LoadTrace(const std::string& path, std::vector<TraceOperation>* ops,
+    int64_t max_records = INT64_MAX) {
+  TraceReader reader(path);
+  if (!reader.ok()) return false;
+  TraceRecord record;
+  while (static_cast<int64_t>(ops->size()) < max_records && reader.Next(&record)) {
+    ops->push_back({record.op, Entry(std::string(record.key, record.keylen),
+        std::string(record.value, record.valuelen), Hash())});
+  }
+  return !reader.truncated();
+}
+
+}
@@ -0,0 +1,150 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#include "workload.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace formica {
+
+using std::vector;
+
+ZipfianGenerator::ZipfianGenerator(uint64_t num_items, double theta)
+    : theta_(theta), alpha_(1.0 / (1.0 - theta)), zeta2_(1.0 + std::pow(0.5, theta)) {
+  assert(theta >= 0 && theta < 1);
+  Grow(num_items);
+}
+
+void ZipfianGenerator::Grow(uint64_t num_items) {
+  for (uint64_t i = num_items_; i < num_items; ++i) zetan_ += 1.0 / std::pow(i + 1, theta_);
+  num_items_ = std::max(num_items_, num_items);
+  UpdateEta();
+}
+
+void ZipfianGenerator::UpdateEta() {
+  eta_ = (1.0 - std::pow(2.0 / num_items_, 1.0 - theta_)) / (1.0 - zeta2_ / zetan_);
+}
+
+uint64_t ZipfianGenerator::Next(Random* rng) {
+  double u = rng->NextDouble();
+  double uz = u * zetan_;
+  if (uz < 1.0 || num_items_ < 2) return 0;
+  if (uz < zeta2_) return 1;
+  uint64_t rank = num_items_ * std::pow(eta_ * u - eta_ + 1.0, alpha_);
+  return std::min(rank, num_items_ - 1);
+}
+
+WorkloadSpec WorkloadSpec::Ycsb(char workload) {
+  WorkloadSpec spec;
+  spec.distribution = KeyDistribution::ZIPFIAN;
+  switch (workload) {
+    case 'A':
+      spec.read = 0.5;
+      spec.update = 0.5;
+      break;
+    case 'B':
+      spec.read = 0.95;
+      spec.update = 0.05;
+      break;
+    case 'C':
+      break;
+    case 'D':
+      spec.read = 0.95;
+      spec.insert = 0.05;
+      spec.distribution = KeyDistribution::LATEST;
+      break;
+    case 'E':
+      spec.read = 0;
+      spec.scan = 0.95;
+      spec.insert = 0.05;
+      break;
+    case 'F':
+      spec.read = 0.5;
+      spec.read_modify_write = 0.5;
+      break;
+    default:
+      assert(false && "YCSB workloads are A to F");
+  }
+  return spec;
+}
+
+Workload::Workload(const WorkloadSpec& spec, uint32_t num_keys, uint64_t seed)
+    : spec_(spec), num_keys_(num_keys), rng_(seed),
+      zipfian_(spec.distribution == KeyDistribution::ZIPFIAN ||
+          spec.distribution == KeyDistribution::LATEST ? num_keys : 1, spec.zipfian_theta) {
+  assert(num_keys > 0);
+  double proportions[] = {spec.read, spec.update, spec.insert, spec.scan, spec.read_modify_write};
+  double total = 0;
+  for (double p: proportions) total += p;
+  assert(total > 0);
+  double cumulative = 0;
+  for (int i = 0; i < 5; ++i) {
+    cumulative += proportions[i] / total;
+    thresholds_[i] = cumulative;
+  }
+  // So that rounding can't leave a draw of just under 1 with no operation.
+  thresholds_[4] = 1.0;
+}
+
+uint32_t Workload::NextKey() {
+  switch (spec_.distribution) {
+    case KeyDistribution::UNIFORM:
+      return rng_.Uniform(num_keys_);
+    case KeyDistribution::ZIPFIAN:
+      return zipfian_.Next(&rng_);
+    case KeyDistribution::LATEST:
+      return num_keys_ - 1 - zipfian_.Next(&rng_);
+    case KeyDistribution::HOTSPOT: {
+      uint32_t hot_keys = std::max<uint32_t>(1, num_keys_ * spec_.hot_set_fraction);
+      if (hot_keys == num_keys_ || rng_.NextDouble() < spec_.hot_op_fraction) {
+        return rng_.Uniform(hot_keys);
+      }
+      return hot_keys + rng_.Uniform(num_keys_ - hot_keys);
+    }
+  }
+  return 0;
+}
+
+Operation Workload::Next() {
+  double u = rng_.NextDouble();
+  int type = 0;
+  while (u >= thresholds_[type]) ++type;
+
+  Operation op;
+  op.type = static_cast<OpType>(type);
+  op.scan_length = 0;
+  if (op.type == OpType::INSERT) {
+    op.key = num_keys_++;
+    if (spec_.distribution == KeyDistribution::ZIPFIAN ||
+        spec_.distribution == KeyDistribution::LATEST) {
+      zipfian_.Grow(num_keys_);
+    }
+    return op;
+  }
+
+  op.key = NextKey();
+  if (op.type == OpType::SCAN) {
+    uint32_t length = 1 + rng_.Uniform(spec_.max_scan_length);
+    op.scan_length = std::min(length, num_keys_ - op.key);
+  }
+  return op;
+}
+
+vector<Operation> Workload::Generate(int n) {
+  vector<Operation> ops(n);
+  for (auto& op: ops) op = Next();
+  return ops;
+}
+
+}
@@ -0,0 +1,151 @@
+// Copyright 2018 Henry Robinson
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except
+// in compliance with the License.  You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software distributed under the License
+// is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.  See the License for the specific language governing permissions and limitations
+// under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace formica {
+
+// Synthetic workloads for benchmarks, after YCSB (Cooper et al., "Benchmarking Cloud Serving
+// Systems with YCSB"). A Workload draws operations on keys that are numbered from 0: the first
+// 'num_keys' are those the store was loaded with, and each INSERT adds the next one. Mapping
+// numbers to actual keys is up to the caller.
+//
+// Drawing an operation takes a few random numbers and, for skewed distributions, a pow(), which
+// is as much as some store operations cost. Benchmarks should Generate() their operations before
+// the timed loop.
+
+// A fast, seedable pseudo-random generator (SplitMix64), which unlike rand() takes no lock.
+class Random {
+ public:
+  explicit Random(uint64_t seed = 0) : state_(seed) { }
+
+  uint64_t Next() {
+    uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  // Uniform in [0, 1).
+  double NextDouble() { return (Next() >> 11) * (1.0 / (1ULL << 53)); }
+
+  // Uniform in [0, n).
+  uint64_t Uniform(uint64_t n) { return Next() % n; }
+
+ private:
+  uint64_t state_;
+};
+
+// Draws ranks in [0, num_items) from a Zipfian distribution, where rank i has probability
+// proportional to 1 / (i + 1)^theta, with the algorithm from Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases", as YCSB does. 'theta' must be in [0, 1); 0 is uniform, and
+// YCSB uses 0.99.
+class ZipfianGenerator {
+ public:
+  ZipfianGenerator(uint64_t num_items, double theta);
+
+  uint64_t Next(Random* rng);
+
+  // Adds items to the end of the distribution, i.e. as the least popular ranks. Only the new
+  // items' terms are added to the normalization constant, so growing one at a time is cheap.
+  void Grow(uint64_t num_items);
+
+  uint64_t num_items() const { return num_items_; }
+
+ private:
+  void UpdateEta();
+
+  uint64_t num_items_ = 0;
+  const double theta_;
+  const double alpha_;
+  const double zeta2_;
+  double zetan_ = 0;
+  double eta_ = 0;
+};
+
+enum class OpType : uint8_t {
+  READ,
+  UPDATE,
+  INSERT,
+  // Reads 'scan_length' keys in order, starting with 'key'.
+  SCAN,
+  // Reads the key, then writes it back.
+  READ_MODIFY_WRITE
+};
+
+// Packed into 8 bytes, so that a long run of operations can be generated up front.
+struct Operation {
+  uint32_t key;
+  OpType type;
+  uint16_t scan_length;
+};
+
+enum class KeyDistribution {
+  UNIFORM,
+  // Skewed towards the lowest-numbered keys.
+  ZIPFIAN,
+  // A fraction of the keys get a fraction of the operations, uniformly within each set.
+  HOTSPOT,
+  // Zipfian, but skewed towards the most recently inserted keys.
+  LATEST
+};
+
+// What a Workload draws. The operation proportions are normalized, so needn't add up to 1.
+struct WorkloadSpec {
+  double read = 1;
+  double update = 0;
+  double insert = 0;
+  double scan = 0;
+  double read_modify_write = 0;
+
+  KeyDistribution distribution = KeyDistribution::UNIFORM;
+  double zipfian_theta = 0.99;
+  // For HOTSPOT: the fraction of keys that are hot, and of operations that go to them.
+  double hot_set_fraction = 0.2;
+  double hot_op_fraction = 0.8;
+  // SCAN lengths are uniform in [1, max_scan_length].
+  int max_scan_length = 100;
+
+  // YCSB's core workloads, 'A' to 'F':
+  //   A: 50% reads, 50% updates, Zipfian   D: 95% reads, 5% inserts, latest
+  //   B: 95% reads, 5% updates, Zipfian    E: 95% scans, 5% inserts, Zipfian
+  //   C: 100% reads, Zipfian               F: 50% reads, 50% read-modify-writes, Zipfian
+  static WorkloadSpec Ycsb(char workload);
+};
+
+class Workload {
+ public:
+  Workload(const WorkloadSpec& spec, uint32_t num_keys, uint64_t seed = 0);
+
+  Operation Next();
+  std::vector<Operation> Generate(int n);
+
+  // The number of keys so far, including those inserted by operations drawn so far.
+  uint32_t num_keys() const { return num_keys_; }
+
+ private:
+  // Picks an existing key from the spec's distribution.
+  uint32_t NextKey();
+
+  const WorkloadSpec spec_;
+  uint32_t num_keys_;
+  Random rng_;
+  // Cumulative proportions of each OpType, in order.
+  double thresholds_[5];
+  // For ZIPFIAN and LATEST.
+  ZipfianGenerator zipfian_;
+};
+
+}